@@ -32,6 +32,8 @@ namespace Anope
 		 * ci::string, or a C-style string at any time.
 		 */
 		std::string _string;
+
+		inline bool equals_ci(const char *_str, size_t len) const { return this->_string.length() == len && !Anope::CaseCompare(this->_string.c_str(), _str, len); }
 	 public:
 		/**
 		 * Extras.
@@ -75,9 +77,9 @@ namespace Anope
 		inline bool equals_cs(const std::string &_str) const { return this->_string == _str; }
 		inline bool equals_cs(const string &_str) const { return this->_string == _str._string; }
 
-		inline bool equals_ci(const char *_str) const { return ci::string(this->_string.c_str()) == _str; }
-		inline bool equals_ci(const std::string &_str) const { return ci::string(this->_string.c_str()) == _str.c_str(); }
-		inline bool equals_ci(const string &_str) const { return ci::string(this->_string.c_str()) == _str._string.c_str(); }
+		inline bool equals_ci(const char *_str) const { return this->equals_ci(_str, strlen(_str)); }
+		inline bool equals_ci(const std::string &_str) const { return this->equals_ci(_str.c_str(), _str.length()); }
+		inline bool equals_ci(const string &_str) const { return this->equals_ci(_str.c_str(), _str.length()); }
 
 		/**
 		 * Inequality operators, exact opposites of the above.
@@ -313,7 +315,7 @@ namespace Anope
 	{
 		inline size_t operator()(const string &s) const
 		{
-			return TR1NS::hash<std::string>()(s.lower().str());
+			return Anope::CaseHash(s.c_str(), s.length());
 		}
 	};
 
@@ -335,7 +337,6 @@ namespace Anope
 
 	template<typename T> class map : public std::map<string, T, ci::less> { };
 	template<typename T> class multimap : public std::multimap<string, T, ci::less> { };
-	template<typename T> class hash_map : public TR1NS::unordered_map<string, T, hash_ci, compare> { };
 
 	static const char *const compiled = __TIME__ " " __DATE__;
 
@@ -777,4 +778,6 @@ template<typename T, typename O> inline T anope_dynamic_static_cast(O ptr)
 }
 #endif
 
+#include "hashmap.h"
+
 #endif // ANOPE_H
@@ -0,0 +1,119 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#ifndef ATOM_H
+#define ATOM_H
+
+#include "services.h"
+#include "anope.h"
+
+namespace Anope
+{
+	/** An interned string. Every atom with the same (case sensitive) value shares
+	 * one reference counted copy of it from a global pool, so the hosts, idents
+	 * and realnames of many users are stored once, and two atoms can be compared
+	 * by comparing pointers. Atoms are immutable, assigning to one makes it refer
+	 * to a different string. Atoms must only be used from the main thread.
+	 */
+	class CoreExport Atom
+	{
+	 public:
+		struct Node
+		{
+			/* Number of atoms referring to this node */
+			unsigned refs;
+			/* Case sensitive hash of value */
+			size_t hash;
+			const string value;
+
+			Node(const string &v, size_t h) : refs(0), hash(h), value(v) { }
+		};
+
+	 private:
+		Node *node;
+
+		/* The node for the empty string, which is never freed */
+		static Node Empty;
+
+		static Node *Acquire(const string &value);
+		static void Release(Node *n);
+
+		void Set(Node *n)
+		{
+			++n->refs;
+			Node *old = this->node;
+			this->node = n;
+			if (!--old->refs)
+				Release(old);
+		}
+
+	 public:
+		Atom() : node(&Empty) { ++node->refs; }
+		Atom(const string &value) : node(Acquire(value)) { ++node->refs; }
+		Atom(const char *value) : node(Acquire(value)) { ++node->refs; }
+		Atom(const Atom &other) : node(other.node) { ++node->refs; }
+
+		~Atom()
+		{
+			if (!--this->node->refs)
+				Release(this->node);
+		}
+
+		Atom &operator=(const Atom &other) { this->Set(other.node); return *this; }
+		Atom &operator=(const string &value)
+		{
+			if (value != this->node->value)
+				this->Set(Acquire(value));
+			return *this;
+		}
+		Atom &operator=(const char *value) { return *this = string(value); }
+
+		operator const string &() const { return this->node->value; }
+		const string &value() const { return this->node->value; }
+
+		/** Get the case sensitive hash of the value, which is computed once per string */
+		size_t GetHash() const { return this->node->hash; }
+
+		bool operator==(const Atom &other) const { return this->node == other.node; }
+		bool operator!=(const Atom &other) const { return this->node != other.node; }
+		bool operator==(const string &other) const { return this->node->value == other; }
+		bool operator!=(const string &other) const { return this->node->value != other; }
+		bool operator==(const char *other) const { return this->node->value == other; }
+		bool operator!=(const char *other) const { return this->node->value != other; }
+
+		bool empty() const { return this->node->value.empty(); }
+		string::size_type length() const { return this->node->value.length(); }
+		const char *c_str() const { return this->node->value.c_str(); }
+		char operator[](string::size_type n) const { return this->node->value[n]; }
+		void clear() { this->Set(&Empty); }
+
+		string::size_type find(const string &s, string::size_type pos = 0) const { return this->node->value.find(s, pos); }
+		string::size_type find(char c, string::size_type pos = 0) const { return this->node->value.find(c, pos); }
+		bool equals_ci(const string &s) const { return this->node->value.equals_ci(s); }
+		bool equals_cs(const string &s) const { return this->node->value.equals_cs(s); }
+
+		/** Get the number of distinct strings in the pool */
+		static size_t PoolSize();
+
+		struct hash
+		{
+			size_t operator()(const Atom &a) const { return a.GetHash(); }
+		};
+	};
+
+	inline std::ostream &operator<<(std::ostream &os, const Atom &a) { return os << a.value(); }
+	inline const string operator+(const Atom &a, const string &s) { return a.value() + s; }
+	inline const string operator+(const Atom &a, const char *s) { return a.value() + s; }
+	inline const string operator+(const Atom &a, char c) { return a.value() + c; }
+	inline const string operator+(const string &s, const Atom &a) { return s + a.value(); }
+	inline const string operator+(const char *s, const Atom &a) { return s + a.value(); }
+	inline const string operator+(char c, const Atom &a) { return c + a.value(); }
+}
+
+#endif // ATOM_H
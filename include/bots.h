@@ -55,6 +55,10 @@ class CoreExport BotInfo : public User, public Serializable
 	 */
 	virtual ~BotInfo();
 
+	/* Bots are counted as serializable objects, not allocated from the user pool */
+	using Serializable::operator new;
+	using Serializable::operator delete;
+
 	void Serialize(Serialize::Data &data) const;
 	static Serializable* Unserialize(Serializable *obj, Serialize::Data &);
 
@@ -14,13 +14,16 @@
 #include "extensible.h"
 #include "modes.h"
 #include "serialize.h"
+#include "slab.h"
+
+#include <bitset>
 
 typedef Anope::hash_map<Channel *> channel_map;
 
 extern CoreExport channel_map ChannelList;
 
 /* A user container, there is one of these per user per channel. */
-struct ChanUserContainer : public Extensible
+struct CoreExport ChanUserContainer : public Extensible
 {
 	User *user;
 	Channel *chan;
@@ -28,16 +31,43 @@ struct ChanUserContainer : public Extensible
 	ChannelStatus status;
 
 	ChanUserContainer(User *u, Channel *c) : user(u), chan(c) { }
+
+	/* Allocated from a slab pool */
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
 };
 
 class CoreExport Channel : public Base, public Extensible
 {
  public:
 	typedef std::multimap<Anope::string, Anope::string> ModeList;
+	/* The entries of a list mode set on a channel */
+	typedef std::vector<Entry> EntryList;
  private:
-	/** A map of channel modes with their parameters set on this channel
+	/* The modes set on this channel by ChannelMode::id, excluding status modes */
+	std::bitset<ModeManager::MaxChannelModes> mode_set;
+	/* The params of the param modes set on this channel, by ChannelMode::id */
+	std::vector<std::pair<unsigned, Anope::string> > mode_params;
+	/* The entries of the list modes set on this channel, by ChannelMode::id */
+	std::vector<std::pair<unsigned, EntryList> > mode_lists;
+
+	/** Find the param of a param mode set on this channel
+	 * @return The param, or NULL if the mode is not set
+	 */
+	Anope::string *FindParam(unsigned id);
+	const Anope::string *FindParam(unsigned id) const;
+
+	/** Find the entries of a list mode set on this channel
+	 * @param create Whether to create the list if it does not exist
+	 * @return The entries, or NULL if there are none and create is false
+	 */
+	EntryList *FindList(unsigned id, bool create = false);
+	const EntryList *FindList(unsigned id) const;
+
+	/** Give or take the status modes of a user based on their access
+	 * @param u_access The user's access, which modules may modify
 	 */
-	ModeList modes;
+	void ApplyCorrectModes(User *user, AccessGroup &u_access, bool give_modes);
 
  public:
  	/* Channel name */
@@ -48,11 +78,15 @@ class CoreExport Channel : public Base, public Extensible
 	time_t creation_time;
 	/* If the channel has just been created in a netjoin */
 	bool syncing;
+	/* The server whose burst this channel is waiting for, if it is syncing */
+	Server *sync_server;
+	/* Links in the sync_server's list of syncing channels */
+	Channel *sync_prev, *sync_next;
 	/* Is configured in the conf as a channel bots should be in */
 	bool botchannel;
 
 	/* Users in the channel */
-	typedef std::map<User *, ChanUserContainer *> ChanUserList;
+	typedef std::map<User *, ChanUserContainer *, std::less<User *>, SlabAllocator<std::pair<User * const, ChanUserContainer *> > > ChanUserList;
 	ChanUserList users;
 
 	/* Current topic of the channel */
@@ -85,6 +119,10 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	~Channel();
 
+	/* Channels are allocated from a slab pool */
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
+
 	/** Call if we need to unset all modes and clear all user status (internally).
 	 * Only useful if we get a SJOIN with a TS older than what we have here
 	 */
@@ -102,6 +140,12 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	bool CheckDelete();
 
+	/** Lower the creation time of this channel if a module wants it to be older,
+	 * such as to when it was registered, and reset the channel to it.
+	 * @return true if the channel was reset
+	 */
+	bool CheckTS();
+
 	/** Join a user internally to the channel
 	 * @param u The user
 	 * @param status The status to give the user, if any
@@ -236,15 +280,22 @@ class CoreExport Channel : public Base, public Extensible
 	bool Kick(BotInfo *bi, User *u, const char *reason = NULL, ...);
 
 	/** Get all modes set on this channel, excluding status modes.
+	 * This builds a new map, so should not be used to check for one mode.
 	 * @return a map of modes and their optional parameters.
 	 */
-	const ModeList &GetModes() const;
+	ModeList GetModes() const;
 
-	/** Get a list of modes on a channel
+	/** Get the entries of a list mode on a channel
 	 * @param name A mode name to get the list of
-	 * @return a pair of iterators for the beginning and end of the list
+	 * @return The entries, in the order they were set
 	 */
-	std::pair<ModeList::iterator, ModeList::iterator> GetModeList(const Anope::string &name);
+	const EntryList &GetModeList(const Anope::string &name) const;
+
+	/** Remove a mode from this channel without telling anyone, used when
+	 * the mode itself is being removed from Anope.
+	 * @param cm The mode
+	 */
+	void ForgetMode(ChannelMode *cm);
 
 	/** Get a string of the modes set on this channel
 	 * @param complete Include mode parameters
@@ -274,6 +325,14 @@ class CoreExport Channel : public Base, public Extensible
 	 */
 	void SetCorrectModes(User *u, bool give_modes);
 
+	/** Set the correct modes for a batch of users who have just joined, such as
+	 * from a netburst. Users logged into the same account share one access
+	 * lookup, unless the channel has access entries matching nicks or hosts.
+	 * @param users The users to give/remove modes to/from
+	 * @param give_modes if true modes may be given to the users
+	 */
+	void SetCorrectModes(const std::vector<User *> &users, bool give_modes);
+
 	/** Unbans a user from this channel.
 	 * @param u The user to unban
 	 * @param mode The mode to unban
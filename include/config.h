@@ -104,6 +104,12 @@ namespace Configuration
 		time_t TimeoutCheck;
 		/* options:usestrictprivmsg */
 		bool UseStrictPrivmsg;
+		/* options:stallthreshold, in milliseconds */
+		unsigned StallThreshold;
+		/* options:stallbacktrace */
+		bool StallBacktrace;
+		/* options:splitgrace */
+		time_t SplitGrace;
 
 		/* either "/msg " or "/" */
 		Anope::string StrictPrivmsg;
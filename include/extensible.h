@@ -14,6 +14,7 @@
 #include "serialize.h"
 #include "service.h"
 #include "logger.h"
+#include "memstats.h"
 
 class Extensible;
 
@@ -21,6 +22,8 @@ class CoreExport ExtensibleBase : public Service
 {
  protected:
 	std::map<Extensible *, void *> items;
+	/* Counts the items set */
+	MemoryCounter memory;
 
 	ExtensibleBase(Module *m, const Anope::string &n);
 	~ExtensibleBase();
@@ -58,6 +61,12 @@ class BaseExtensibleItem : public ExtensibleBase
  protected:
 	virtual T *Create(Extensible *) = 0;
 
+	/* Approximate memory used by setting an item, including its entries in items and extension_items */
+	static size_t EntrySize(const T *value)
+	{
+		return MemoryCounter::TreeNode(sizeof(std::pair<Extensible *, void *>)) + MemoryCounter::TreeNode(sizeof(ExtensibleBase *)) + (value ? sizeof(T) : 0);
+	}
+
  public:
 	BaseExtensibleItem(Module *m, const Anope::string &n) : ExtensibleBase(m, n) { }
 
@@ -71,6 +80,7 @@ class BaseExtensibleItem : public ExtensibleBase
 
 			obj->extension_items.erase(this);
 			items.erase(it);
+			this->memory.Free(EntrySize(value));
 			delete value;
 		}
 	}
@@ -89,13 +99,19 @@ class BaseExtensibleItem : public ExtensibleBase
 		Unset(obj);
 		items[obj] = t;
 		obj->extension_items.insert(this);
+		this->memory.Allocate(EntrySize(t));
 		return t;
 	}
 
 	void Unset(Extensible *obj) anope_override
 	{
+		/* Unserializing unsets every item which is not in the data, so make that cheap */
+		if (!obj->extension_items.count(this))
+			return;
+
 		T *value = Get(obj);
-		items.erase(obj);
+		if (items.erase(obj))
+			this->memory.Free(EntrySize(value));
 		obj->extension_items.erase(this);
 		delete value;
 	}
@@ -30,9 +30,22 @@ namespace Anope
 	/* Casemap in use by Anope. ci::string's comparation functions use this (and thus Anope::string) */
 	extern std::locale casemap;
 
-	extern void CaseMapRebuild();
-	extern unsigned char tolower(unsigned char);
-	extern unsigned char toupper(unsigned char);
+	/* Cache of the casemap, indexed by character. Rebuilt by CaseMapRebuild() whenever casemap changes */
+	extern CoreExport unsigned char case_map_upper[256], case_map_lower[256];
+
+	extern CoreExport void CaseMapRebuild();
+	inline unsigned char tolower(unsigned char c) { return case_map_lower[c]; }
+	inline unsigned char toupper(unsigned char c) { return case_map_upper[c]; }
+
+	/** Compare two strings of length n under the casemap. Like strncmp this stops at a NUL.
+	 * @return zero if they are equal, less than zero if s1 is less, greater than zero if s1 is greater
+	 */
+	extern CoreExport int CaseCompare(const char *s1, const char *s2, size_t n);
+
+	/** Hash a string of length n as the casemap lowercases it, so strings which
+	 * compare equal under the casemap hash equally.
+	 */
+	extern CoreExport size_t CaseHash(const char *s, size_t n);
 
 	/* ASCII case insensitive ctype. */
 	template<typename char_type>
@@ -77,6 +90,30 @@ namespace Anope
 				return ascii_ctype<char_type>::do_tolower(c);
 		}
 	};
+
+	/* ircd-rfc1459 case insensitive ctype, as rfc1459 but also ~ = ^, which is
+	 * what IRCds advertising CASEMAPPING=rfc1459 use
+	 */
+	template<typename char_type>
+	class ircd_rfc1459_ctype : public rfc1459_ctype<char_type>
+	{
+	 public:
+		char_type do_toupper(char_type c) const anope_override
+		{
+			if (c == '~')
+				return '^';
+			else
+				return rfc1459_ctype<char_type>::do_toupper(c);
+		}
+
+		char_type do_tolower(char_type c) const anope_override
+		{
+			if (c == '^')
+				return '~';
+			else
+				return rfc1459_ctype<char_type>::do_tolower(c);
+		}
+	};
 }
 
 /** The ci namespace contains a number of helper classes relevant to case insensitive strings.
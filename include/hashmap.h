@@ -0,0 +1,464 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <vector>
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define ANOPE_HASHMAP_SSE2
+#endif
+
+namespace Anope
+{
+	/** A case insensitive hash map from strings to T, used for the nick, channel and
+	 * account lists. Entries live in one flat array split into groups of 16 slots,
+	 * with a byte of metadata per slot holding 7 bits of the entry's hash. A lookup
+	 * checks a whole group's metadata at once, using SSE2 where it is available, and
+	 * only compares keys whose hash matches. The full casemapped hash of each key is
+	 * stored with it, so growing the map never hashes a key again.
+	 *
+	 * Erasing an entry never moves any other entry, so iterators other than the one
+	 * erased stay valid, and it is safe to erase while iterating. Inserting may move
+	 * every entry, and invalidates all iterators and references into the map.
+	 */
+	template<typename T> class hash_map
+	{
+	 public:
+		typedef string key_type;
+		typedef T mapped_type;
+		typedef std::pair<const string, T> value_type;
+		typedef size_t size_type;
+
+	 private:
+		struct Slot
+		{
+			size_t hash;
+			value_type kv;
+
+			Slot(size_t h, const value_type &v) : hash(h), kv(v) { }
+		};
+
+		enum
+		{
+			GroupSize = 16,
+			/* Metadata of slots which have never been used since the last rehash */
+			Empty = -128,
+			/* Metadata of slots whose entry has been erased */
+			Deleted = -2
+		};
+
+		/* One byte per slot, Empty, Deleted, or the low 7 bits of the entry's hash */
+		signed char *ctrl;
+		Slot *slots;
+		/* Number of slots, a power of 2 and at least GroupSize, or 0 */
+		size_t cap;
+		/* Number of entries */
+		size_t used;
+		/* Number of Empty slots which can still be filled before the map must grow */
+		size_t growth_left;
+
+		/** Scramble a hash so both the metadata bits and group index are well distributed */
+		static size_t Mix(size_t h)
+		{
+			uint64_t x = h;
+			x ^= x >> 33;
+			x *= 0xFF51AFD7ED558CCDULL;
+			x ^= x >> 33;
+			return static_cast<size_t>(x);
+		}
+
+		static signed char H2(size_t h) { return static_cast<signed char>(h & 0x7F); }
+		static size_t H1(size_t h) { return h >> 7; }
+
+		static size_t MaxLoad(size_t capacity) { return capacity - capacity / 8; }
+
+		static unsigned Ctz(unsigned mask)
+		{
+#ifdef __GNUC__
+			return __builtin_ctz(mask);
+#else
+			unsigned n = 0;
+			while (!(mask & 1))
+			{
+				mask >>= 1;
+				++n;
+			}
+			return n;
+#endif
+		}
+
+		/** Match every slot in a group whose metadata is c
+		 * @return A bitmask of the matching slots
+		 */
+		static unsigned Match(const signed char *group, signed char c)
+		{
+#ifdef ANOPE_HASHMAP_SSE2
+			__m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(c)));
+#else
+			unsigned mask = 0;
+			for (unsigned i = 0; i < GroupSize; ++i)
+				if (group[i] == c)
+					mask |= 1 << i;
+			return mask;
+#endif
+		}
+
+		/** Match every slot in a group which does not hold an entry */
+		static unsigned MatchFree(const signed char *group)
+		{
+#ifdef ANOPE_HASHMAP_SSE2
+			return _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(group)));
+#else
+			unsigned mask = 0;
+			for (unsigned i = 0; i < GroupSize; ++i)
+				if (group[i] < 0)
+					mask |= 1 << i;
+			return mask;
+#endif
+		}
+
+		static bool Equal(const string &s1, const string &s2)
+		{
+			return s1.equals_ci(s2);
+		}
+
+		/** Find the slot of a key
+		 * @return The slot, or cap if the key is not in the map
+		 */
+		size_t Locate(const string &key, size_t h) const
+		{
+			if (!this->cap)
+				return this->cap;
+
+			const size_t mask = this->cap / GroupSize - 1;
+			const signed char h2 = H2(h);
+			for (size_t g = H1(h) & mask, probe = 0;; g = (g + ++probe) & mask)
+			{
+				const signed char *group = this->ctrl + g * GroupSize;
+
+				for (unsigned bits = Match(group, h2); bits; bits &= bits - 1)
+				{
+					size_t i = g * GroupSize + Ctz(bits);
+					if (this->slots[i].hash == h && Equal(this->slots[i].kv.first, key))
+						return i;
+				}
+
+				/* A group with an empty slot has never been full, so the key can not be further on */
+				if (Match(group, Empty))
+					return this->cap;
+			}
+		}
+
+		/** Find the first slot a new entry with the given hash can be put in */
+		size_t FindFree(size_t h) const
+		{
+			const size_t mask = this->cap / GroupSize - 1;
+			for (size_t g = H1(h) & mask, probe = 0;; g = (g + ++probe) & mask)
+			{
+				unsigned bits = MatchFree(this->ctrl + g * GroupSize);
+				if (bits)
+					return g * GroupSize + Ctz(bits);
+			}
+		}
+
+		void Rehash(size_t newcap)
+		{
+			signed char *oldctrl = this->ctrl;
+			Slot *oldslots = this->slots;
+			size_t oldcap = this->cap;
+
+			this->cap = newcap;
+			this->ctrl = new signed char[newcap];
+			std::fill(this->ctrl, this->ctrl + newcap, static_cast<signed char>(Empty));
+			this->slots = static_cast<Slot *>(::operator new(newcap * sizeof(Slot)));
+			this->growth_left = MaxLoad(newcap) - this->used;
+
+			for (size_t i = 0; i < oldcap; ++i)
+				if (oldctrl[i] >= 0)
+				{
+					Slot &old = oldslots[i];
+					size_t j = this->FindFree(old.hash);
+
+					/* Swap the key over rather than copying it */
+					Slot *s = new (&this->slots[j]) Slot(old.hash, value_type(string(), old.kv.second));
+					const_cast<string &>(s->kv.first).str().swap(const_cast<string &>(old.kv.first).str());
+					this->ctrl[j] = H2(old.hash);
+
+					old.~Slot();
+				}
+
+			delete [] oldctrl;
+			::operator delete(oldslots);
+		}
+
+		size_t Next(size_t i) const
+		{
+			while (i < this->cap && this->ctrl[i] < 0)
+				++i;
+			return i;
+		}
+
+		void Destroy()
+		{
+			for (size_t i = 0; i < this->cap; ++i)
+				if (this->ctrl[i] >= 0)
+					this->slots[i].~Slot();
+		}
+
+		struct OrderedLess
+		{
+			bool operator()(const value_type *e1, const value_type *e2) const
+			{
+				return ci::less()(e1->first, e2->first);
+			}
+		};
+
+	 public:
+		class const_iterator
+		{
+			friend class hash_map;
+
+		 protected:
+			const hash_map *map;
+			size_t index;
+
+			const_iterator(const hash_map *m, size_t i) : map(m), index(i) { }
+
+		 public:
+			typedef std::forward_iterator_tag iterator_category;
+			typedef typename hash_map::value_type value_type;
+			typedef ptrdiff_t difference_type;
+			typedef const value_type *pointer;
+			typedef const value_type &reference;
+
+			const_iterator() : map(NULL), index(0) { }
+
+			const value_type &operator*() const { return this->map->slots[this->index].kv; }
+			const value_type *operator->() const { return &this->map->slots[this->index].kv; }
+
+			const_iterator &operator++()
+			{
+				this->index = this->map->Next(this->index + 1);
+				return *this;
+			}
+
+			const_iterator operator++(int)
+			{
+				const_iterator tmp = *this;
+				++*this;
+				return tmp;
+			}
+
+			friend bool operator==(const const_iterator &it1, const const_iterator &it2) { return it1.index == it2.index; }
+			friend bool operator!=(const const_iterator &it1, const const_iterator &it2) { return it1.index != it2.index; }
+		};
+
+		class iterator : public const_iterator
+		{
+			friend class hash_map;
+
+			iterator(const hash_map *m, size_t i) : const_iterator(m, i) { }
+
+		 public:
+			typedef value_type *pointer;
+			typedef value_type &reference;
+
+			iterator() { }
+
+			value_type &operator*() const { return this->map->slots[this->index].kv; }
+			value_type *operator->() const { return &this->map->slots[this->index].kv; }
+
+			iterator &operator++()
+			{
+				this->index = this->map->Next(this->index + 1);
+				return *this;
+			}
+
+			iterator operator++(int)
+			{
+				iterator tmp = *this;
+				++*this;
+				return tmp;
+			}
+		};
+
+		hash_map() : ctrl(NULL), slots(NULL), cap(0), used(0), growth_left(0) { }
+
+		hash_map(const hash_map &other) : ctrl(NULL), slots(NULL), cap(0), used(0), growth_left(0)
+		{
+			for (const_iterator it = other.begin(), it_end = other.end(); it != it_end; ++it)
+				this->insert(*it);
+		}
+
+		~hash_map()
+		{
+			this->Destroy();
+			delete [] this->ctrl;
+			::operator delete(this->slots);
+		}
+
+		hash_map &operator=(const hash_map &other)
+		{
+			if (this != &other)
+			{
+				this->clear();
+				for (const_iterator it = other.begin(), it_end = other.end(); it != it_end; ++it)
+					this->insert(*it);
+			}
+			return *this;
+		}
+
+		iterator begin() { return iterator(this, this->Next(0)); }
+		const_iterator begin() const { return const_iterator(this, this->Next(0)); }
+		iterator end() { return iterator(this, this->cap); }
+		const_iterator end() const { return const_iterator(this, this->cap); }
+
+		size_t size() const { return this->used; }
+		bool empty() const { return !this->used; }
+
+		iterator find(const string &key)
+		{
+			return iterator(this, this->Locate(key, Mix(hash_ci()(key))));
+		}
+
+		const_iterator find(const string &key) const
+		{
+			return const_iterator(this, this->Locate(key, Mix(hash_ci()(key))));
+		}
+
+		size_t count(const string &key) const
+		{
+			return this->find(key) != this->end();
+		}
+
+		std::pair<iterator, bool> insert(const value_type &v)
+		{
+			size_t h = Mix(hash_ci()(v.first));
+
+			size_t i = this->Locate(v.first, h);
+			if (i != this->cap)
+				return std::make_pair(iterator(this, i), false);
+
+			if (!this->cap)
+				this->Rehash(GroupSize);
+
+			i = this->FindFree(h);
+			if (this->ctrl[i] == Empty && !this->growth_left)
+			{
+				/* Grow if the map is getting full, otherwise just clear out erased slots */
+				this->Rehash(this->used >= MaxLoad(this->cap) / 2 ? this->cap * 2 : this->cap);
+				i = this->FindFree(h);
+			}
+
+			if (this->ctrl[i] == Empty)
+				--this->growth_left;
+
+			new (&this->slots[i]) Slot(h, v);
+			this->ctrl[i] = H2(h);
+			++this->used;
+
+			return std::make_pair(iterator(this, i), true);
+		}
+
+		T &operator[](const string &key)
+		{
+			return this->insert(value_type(key, T())).first->second;
+		}
+
+		void erase(const_iterator it)
+		{
+			size_t i = it.index;
+
+			this->slots[i].~Slot();
+			--this->used;
+
+			/* If this slot's group has never been full no lookup has gone past it,
+			 * so the slot can be made empty again instead of being marked erased.
+			 */
+			if (Match(this->ctrl + i / GroupSize * GroupSize, Empty))
+			{
+				this->ctrl[i] = Empty;
+				++this->growth_left;
+			}
+			else
+				this->ctrl[i] = Deleted;
+		}
+
+		size_t erase(const string &key)
+		{
+			iterator it = this->find(key);
+			if (it == this->end())
+				return 0;
+			this->erase(it);
+			return 1;
+		}
+
+		void clear()
+		{
+			this->Destroy();
+			if (this->cap)
+				std::fill(this->ctrl, this->ctrl + this->cap, static_cast<signed char>(Empty));
+			this->used = 0;
+			this->growth_left = MaxLoad(this->cap);
+		}
+
+		void swap(hash_map &other)
+		{
+			std::swap(this->ctrl, other.ctrl);
+			std::swap(this->slots, other.slots);
+			std::swap(this->cap, other.cap);
+			std::swap(this->used, other.used);
+			std::swap(this->growth_left, other.growth_left);
+		}
+
+		/** Get the number of slots in the map */
+		size_t capacity() const { return this->cap; }
+
+		/** Get the largest number of groups a lookup of an entry in the map has to check */
+		size_t longest_probe() const
+		{
+			const size_t mask = this->cap / GroupSize - 1;
+			size_t longest = 0;
+
+			for (size_t i = 0; i < this->cap; ++i)
+				if (this->ctrl[i] >= 0)
+				{
+					size_t groups = 1;
+					for (size_t g = H1(this->slots[i].hash) & mask, probe = 0; g != i / GroupSize; g = (g + ++probe) & mask)
+						++groups;
+					if (groups > longest)
+						longest = groups;
+				}
+
+			return longest;
+		}
+
+		/** Get the entries of the map ordered by key, as the LIST commands show them
+		 * @param entries Filled with the entries, which are valid until something is next inserted
+		 */
+		void ordered(std::vector<const value_type *> &entries) const
+		{
+			entries.clear();
+			entries.reserve(this->used);
+			for (const_iterator it = this->begin(), it_end = this->end(); it != it_end; ++it)
+				entries.push_back(&*it);
+			std::sort(entries.begin(), entries.end(), OrderedLess());
+		}
+	};
+}
+
+#endif // HASHMAP_H
@@ -0,0 +1,248 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#ifndef IDMAP_H
+#define IDMAP_H
+
+#include "services.h"
+#include "anope.h"
+
+/** A map from UIDs or SIDs to objects. IDs are case sensitive and short, so
+ * rather than casemapping and hashing a string on every lookup, IDs made up
+ * of at most 10 alphanumeric characters are packed into a 64 bit key and
+ * stored in an open addressing table. Anything else, which no IRCd we link
+ * to sends, falls back to an ordinary case sensitive hash map.
+ * T should be a pointer, the default value of T is returned for missing IDs.
+ */
+template<typename T> class IDMap
+{
+	struct Slot
+	{
+		/* The packed ID, 0 if the slot is empty */
+		uint64_t key;
+		T value;
+	};
+
+	Slot *slots;
+	/* Number of slots, always 0 or a power of 2 */
+	size_t capacity;
+	/* Number of used slots */
+	size_t count;
+
+	/* IDs which can not be packed */
+	typedef TR1NS::unordered_map<Anope::string, T, Anope::hash_cs> fallback_map;
+	fallback_map fallback;
+
+	IDMap(const IDMap &);
+	IDMap &operator=(const IDMap &);
+
+	/** Pack an ID into a key
+	 * @return The key, or 0 if the ID can not be packed
+	 */
+	static uint64_t Pack(const Anope::string &id)
+	{
+		if (id.empty() || id.length() > 10)
+			return 0;
+
+		uint64_t key = 0;
+		for (size_t i = 0; i < id.length(); ++i)
+		{
+			char c = id[i];
+			unsigned v;
+
+			/* 0 is never used, so IDs of different lengths never pack to the same key */
+			if (c >= '0' && c <= '9')
+				v = c - '0' + 1;
+			else if (c >= 'A' && c <= 'Z')
+				v = c - 'A' + 11;
+			else if (c >= 'a' && c <= 'z')
+				v = c - 'a' + 37;
+			else
+				return 0;
+
+			key = (key << 6) | v;
+		}
+
+		return key;
+	}
+
+	size_t Home(uint64_t key) const
+	{
+		/* Packed IDs are very regular, so mix them well, otherwise they cluster */
+		key ^= key >> 33;
+		key *= 0xFF51AFD7ED558CCDULL;
+		key ^= key >> 33;
+		key *= 0xC4CEB9FE1A85EC53ULL;
+		key ^= key >> 33;
+		return static_cast<size_t>(key) & (this->capacity - 1);
+	}
+
+	/** Find the slot of a key
+	 * @return The slot, or capacity if it is not in the table
+	 */
+	size_t Locate(uint64_t key) const
+	{
+		if (!this->capacity)
+			return this->capacity;
+
+		for (size_t i = this->Home(key);; i = (i + 1) & (this->capacity - 1))
+		{
+			if (this->slots[i].key == key)
+				return i;
+			if (!this->slots[i].key)
+				return this->capacity;
+		}
+	}
+
+	void Place(uint64_t key, const T &value)
+	{
+		size_t i = this->Home(key);
+		while (this->slots[i].key)
+			i = (i + 1) & (this->capacity - 1);
+
+		this->slots[i].key = key;
+		this->slots[i].value = value;
+	}
+
+	void Rehash(size_t newcapacity)
+	{
+		Slot *old = this->slots;
+		size_t oldcapacity = this->capacity;
+
+		this->capacity = newcapacity;
+		this->slots = newcapacity ? new Slot[newcapacity] : NULL;
+		for (size_t i = 0; i < newcapacity; ++i)
+			this->slots[i].key = 0;
+
+		for (size_t i = 0; i < oldcapacity; ++i)
+			if (old[i].key)
+				this->Place(old[i].key, old[i].value);
+
+		delete [] old;
+	}
+
+ public:
+	IDMap() : slots(NULL), capacity(0), count(0) { }
+
+	~IDMap()
+	{
+		delete [] this->slots;
+	}
+
+	/** Find an object by ID
+	 * @param id The ID
+	 * @return The object, or T() if there is none
+	 */
+	T Find(const Anope::string &id) const
+	{
+		uint64_t key = Pack(id);
+		if (!key)
+		{
+			typename fallback_map::const_iterator it = this->fallback.find(id);
+			return it != this->fallback.end() ? it->second : T();
+		}
+
+		size_t i = this->Locate(key);
+		return i != this->capacity ? this->slots[i].value : T();
+	}
+
+	/** Set the object for an ID, replacing any existing one
+	 * @param id The ID
+	 * @param value The object
+	 */
+	void Set(const Anope::string &id, const T &value)
+	{
+		uint64_t key = Pack(id);
+		if (!key)
+		{
+			this->fallback[id] = value;
+			return;
+		}
+
+		size_t i = this->Locate(key);
+		if (i != this->capacity)
+		{
+			this->slots[i].value = value;
+			return;
+		}
+
+		/* Keep the table at most 3/4 full */
+		if ((this->count + 1) * 4 > this->capacity * 3)
+			this->Rehash(this->capacity ? this->capacity * 2 : 16);
+
+		this->Place(key, value);
+		++this->count;
+	}
+
+	/** Remove an ID
+	 * @param id The ID
+	 * @return true if the ID was removed
+	 */
+	bool Erase(const Anope::string &id)
+	{
+		uint64_t key = Pack(id);
+		if (!key)
+			return this->fallback.erase(id) > 0;
+
+		size_t i = this->Locate(key);
+		if (i == this->capacity)
+			return false;
+
+		/* Shift back the entries after this one which are not in their home slot,
+		 * so lookups never need to skip over deleted slots.
+		 */
+		const size_t mask = this->capacity - 1;
+		for (size_t j = (i + 1) & mask; this->slots[j].key; j = (j + 1) & mask)
+		{
+			size_t home = this->Home(this->slots[j].key);
+			if (((j - home) & mask) >= ((j - i) & mask))
+			{
+				this->slots[i] = this->slots[j];
+				i = j;
+			}
+		}
+		this->slots[i].key = 0;
+		this->slots[i].value = T();
+		--this->count;
+
+		/* Give memory back after large splits */
+		if (this->capacity > 16 && this->count * 8 < this->capacity)
+			this->Rehash(this->capacity / 2);
+
+		return true;
+	}
+
+	/** Get the number of IDs in the map */
+	size_t Size() const
+	{
+		return this->count + this->fallback.size();
+	}
+
+	/** Get the number of slots in the table */
+	size_t Capacity() const
+	{
+		return this->capacity;
+	}
+
+	/** Get the longest distance of an entry from its home slot */
+	size_t LongestProbe() const
+	{
+		size_t longest = 0;
+		for (size_t i = 0; i < this->capacity; ++i)
+			if (this->slots[i].key)
+			{
+				size_t distance = (i - this->Home(this->slots[i].key)) & (this->capacity - 1);
+				if (distance > longest)
+					longest = distance;
+			}
+		return longest;
+	}
+};
+
+#endif // IDMAP_H
@@ -0,0 +1,102 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include "services.h"
+#include "anope.h"
+
+/** Counts the live objects of one kind and approximately how much memory
+ * they are using. Counters are updated by whatever owns the objects as they
+ * are created and destroyed, and are reported by OperServ STATS MEMORY and
+ * m_prometheus. Sizes are estimates, they include the objects themselves and
+ * the largest things they own, but not allocator overhead.
+ */
+class CoreExport MemoryCounter
+{
+	/* Every counter, this is on the heap as counters can be static */
+	static std::list<MemoryCounter *> *Counters;
+	/* Iterator into Counters */
+	std::list<MemoryCounter *>::iterator it;
+
+ public:
+	/* What kind of counter this is, eg. "serialize" or "extensible" */
+	const Anope::string category;
+	/* What is being counted */
+	const Anope::string name;
+	/* The module the objects belong to, NULL for the core */
+	Module *owner;
+	/* Number of live objects */
+	size_t objects;
+	/* Approximate size of the live objects, in bytes */
+	size_t bytes;
+
+	/** Constructor
+	 * @param c The category of the counter
+	 * @param n The name of the counter
+	 * @param o The module the objects belong to
+	 */
+	MemoryCounter(const Anope::string &c, const Anope::string &n, Module *o = NULL);
+	~MemoryCounter();
+
+	/** Count a new object
+	 * @param size Its approximate size
+	 */
+	void Allocate(size_t size)
+	{
+		++this->objects;
+		this->bytes += size;
+	}
+
+	/** Count an object being destroyed
+	 * @param size Its approximate size, as passed to Allocate()
+	 */
+	void Free(size_t size)
+	{
+		--this->objects;
+		this->bytes -= size;
+	}
+
+	/** Count an existing object changing size
+	 * @param oldsize The old size of the object
+	 * @param newsize The new size of the object
+	 */
+	void Resize(size_t oldsize, size_t newsize)
+	{
+		this->bytes = this->bytes - oldsize + newsize;
+	}
+
+	/** Get the name of the module owning this counter
+	 * @return The module name, or "core"
+	 */
+	Anope::string GetOwnerName() const;
+
+	/** Get every counter
+	 */
+	static const std::list<MemoryCounter *> &GetCounters();
+
+	/** Estimate the memory used by a node in a std::map or std::set
+	 * @param value The size of the value type of the container
+	 */
+	static size_t TreeNode(size_t value)
+	{
+		return value + 4 * sizeof(void *);
+	}
+
+	/** Estimate the memory used by a node in a hash map
+	 * @param value The size of the value type of the container
+	 */
+	static size_t HashNode(size_t value)
+	{
+		return value + 2 * sizeof(void *);
+	}
+};
+
+#endif // MEMSTATS_H
@@ -98,6 +98,8 @@ class CoreExport ChannelMode : public Mode
  public:
 	/* channel modes that can posssibly unwrap this mode */
 	std::vector<ChannelMode *> listeners;
+	/* Position of this mode in the set of modes on a channel, assigned by ModeManager::AddChannelMode */
+	unsigned id;
 
 	/** constructor
 	 * @param name The mode name
@@ -297,6 +299,9 @@ class CoreExport ModeManager
 	static unsigned GenericChannelModes;
 	static unsigned GenericUserModes;
 
+	/* Maximum number of channel modes Anope can know about at once, see ChannelMode::id */
+	static const unsigned MaxChannelModes = 128;
+
 	/** Add a user mode to Anope
 	 * @param um A UserMode or UserMode derived class
 	 * @return true on success, false on error
@@ -319,6 +324,12 @@ class CoreExport ModeManager
 	 */
 	static void RemoveChannelMode(ChannelMode *cm);
 
+	/** Find a channel mode by its id
+	 * @param id The id, see ChannelMode::id
+	 * @return The mode, or NULL
+	 */
+	static ChannelMode *FindChannelModeById(unsigned id);
+
 	/** Find a channel mode
 	 * @param mode The mode
 	 * @return The mode class
@@ -372,7 +383,8 @@ class CoreExport ModeManager
 	 */
 	static void StackerAdd(BotInfo *bi, User *u, UserMode *um, bool set, const Anope::string &param = "");
 
-	/** Process all of the modes in the stacker and send them to the IRCd to be set on channels/users
+	/** Process all of the modes in the stacker and send them to the IRCd to be set on channels/users.
+	 * This is called at the end of every iteration of the main loop.
 	 */
 	static void ProcessModes();
 
@@ -402,7 +414,7 @@ class CoreExport Entry
 	/** Get the banned mask for this entry
 	 * @return The mask
 	 */
-	const Anope::string GetMask() const;
+	const Anope::string &GetMask() const;
 
 	/** Check if this entry matches a user
 	 * @param u The user
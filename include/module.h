@@ -26,6 +26,7 @@
 #include "lists.h"
 #include "logger.h"
 #include "mail.h"
+#include "memstats.h"
 #include "memo.h"
 #include "messages.h"
 #include "modes.h"
@@ -44,6 +45,7 @@
 #include "timers.h"
 #include "uplink.h"
 #include "users.h"
+#include "watchdog.h"
 #include "xline.h"
 
 #include "modules/pseudoclients/chanserv.h"
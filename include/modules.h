@@ -20,6 +20,7 @@
 #include "timers.h"
 #include "logger.h"
 #include "extensible.h"
+#include "watchdog.h"
 
 /** This definition is used as shorthand for the various classes
  * and functions needed to make a module loadable by the OS.
@@ -58,27 +59,37 @@
  * loaded modules in a readable simple way, e.g.:
  * 
  * FOREACH_MOD(OnUserConnect, (user, exempt));
+ *
+ * Modules which do not implement an event are removed from its handler list
+ * the first time it is called, so emitting an event nothing implements is
+ * just a check of an empty list.
  */
 #define FOREACH_MOD(ename, args) \
 if (true) \
 { \
 	std::vector<Module *> &_modules = ModuleManager::EventHandlers[I_ ## ename]; \
-	for (std::vector<Module *>::iterator _i = _modules.begin(); _i != _modules.end();) \
+	if (!_modules.empty()) \
 	{ \
-		try \
-		{ \
-			(*_i)->ename args; \
-		} \
-		catch (const ModuleException &modexcept) \
+		ModuleManager::EventTimer _timer(I_ ## ename, #ename); \
+		Watchdog::Scope _scope("event", #ename); \
+		for (std::vector<Module *>::iterator _i = _modules.begin(); _i != _modules.end();) \
 		{ \
-			Log() << "Exception caught: " << modexcept.GetReason(); \
-		} \
-		catch (const NotImplementedException &) \
-		{ \
-			_i = _modules.erase(_i); \
-			continue; \
+			_scope.SetModule((*_i)->name.c_str()); \
+			try \
+			{ \
+				(*_i)->ename args; \
+			} \
+			catch (const ModuleException &modexcept) \
+			{ \
+				Log() << "Exception caught: " << modexcept.GetReason(); \
+			} \
+			catch (const NotImplementedException &) \
+			{ \
+				_i = _modules.erase(_i); \
+				continue; \
+			} \
+			++_i; \
 		} \
-		++_i; \
 	} \
 } \
 else \
@@ -97,27 +108,33 @@ if (true) \
 { \
 	ret = EVENT_CONTINUE; \
 	std::vector<Module *> &_modules = ModuleManager::EventHandlers[I_ ## ename]; \
-	for (std::vector<Module *>::iterator _i = _modules.begin(); _i != _modules.end();) \
+	if (!_modules.empty()) \
 	{ \
-		try \
+		ModuleManager::EventTimer _timer(I_ ## ename, #ename); \
+		Watchdog::Scope _scope("event", #ename); \
+		for (std::vector<Module *>::iterator _i = _modules.begin(); _i != _modules.end();) \
 		{ \
-			EventReturn res = (*_i)->ename args; \
-			if (res != EVENT_CONTINUE) \
+			_scope.SetModule((*_i)->name.c_str()); \
+			try \
 			{ \
-				ret = res; \
-				break; \
+				EventReturn res = (*_i)->ename args; \
+				if (res != EVENT_CONTINUE) \
+				{ \
+					ret = res; \
+					break; \
+				} \
 			} \
+			catch (const ModuleException &modexcept) \
+			{ \
+				Log() << "Exception caught: " << modexcept.GetReason(); \
+			} \
+			catch (const NotImplementedException &) \
+			{ \
+				_i = _modules.erase(_i); \
+				continue; \
+			} \
+			++_i; \
 		} \
-		catch (const ModuleException &modexcept) \
-		{ \
-			Log() << "Exception caught: " << modexcept.GetReason(); \
-		} \
-		catch (const NotImplementedException &) \
-		{ \
-			_i = _modules.erase(_i); \
-			continue; \
-		} \
-		++_i; \
 	} \
 } \
 else \
@@ -471,6 +488,27 @@ class CoreExport Module : public Extensible
 	 */
 	virtual void OnJoinChannel(User *u, Channel *c) { throw NotImplementedException(); }
 
+	/** Called after one or more users join a channel at once, such as when a server
+	 * bursts a channel. The users are allowed to be in the channel, as with OnJoinChannel.
+	 * By default this calls OnJoinChannel for each user, modules which can handle
+	 * the users together should implement this instead of OnJoinChannel.
+	 * @param c The channel
+	 * @param users The users
+	 */
+	virtual void OnJoinChannelBatch(Channel *c, const std::vector<User *> &users)
+	{
+		for (unsigned i = 0; i < users.size(); ++i)
+			this->OnJoinChannel(users[i], c);
+	}
+
+	/** Called when users join a channel, before any of their modes are set, to see if the
+	 * channel's creation time should be lowered. If it is the channel is reset to it once,
+	 * so modules should lower it here rather than from OnJoinChannel.
+	 * @param c The channel
+	 * @param ts The creation time the channel should have, lower it to change it
+	 */
+	virtual void OnCheckTS(Channel *c, time_t &ts) { throw NotImplementedException(); }
+
 	/** Called when a new topic is set
 	 * @param c The channel
 	 * @param setter The user who set the new topic
@@ -573,6 +611,18 @@ class CoreExport Module : public Extensible
 	 */
 	virtual void OnUserQuit(User *u, const Anope::string &msg) { throw NotImplementedException(); }
 
+	/** Called when a user is parked by options:splitgrace because their server split.
+	 * The user has been taken out of their channels and has no server.
+	 * @param u The user
+	 */
+	virtual void OnUserPark(User *u) { throw NotImplementedException(); }
+
+	/** Called when a parked user comes back with their server. Their channels
+	 * are rejoined afterwards as normal.
+	 * @param u The user
+	 */
+	virtual void OnUserRevive(User *u) { throw NotImplementedException(); }
+
 	/** Called when a user is quit, before and after being internally removed from
 	 * This is different from OnUserQuit, which takes place at the time of the quit.
 	 * This happens shortly after when all message processing is finished.
@@ -1099,7 +1149,7 @@ enum Implementation
 	I_OnPrivmsg, I_OnLog, I_OnLogMessage, I_OnDnsRequest, I_OnCheckModes, I_OnChannelSync, I_OnSetCorrectModes,
 	I_OnSerializeCheck, I_OnSerializableConstruct, I_OnSerializableDestruct, I_OnSerializableUpdate,
 	I_OnSerializeTypeCreate, I_OnSetChannelOption, I_OnSetNickOption, I_OnMessage, I_OnCanSet, I_OnCheckDelete,
-	I_OnExpireTick, I_OnNickValidate,
+	I_OnExpireTick, I_OnNickValidate, I_OnJoinChannelBatch, I_OnCheckTS, I_OnUserPark, I_OnUserRevive,
 	I_SIZE
 };
 
@@ -1112,6 +1162,54 @@ class CoreExport ModuleManager
 	 */
 	static std::vector<Module *> EventHandlers[I_SIZE];
 
+	/** Dispatch statistics for an event, only collected when ProfileEvents is set
+	 */
+	struct EventStats
+	{
+		/* The name of the event, NULL if it has not been dispatched while profiling */
+		const char *name;
+		/* Number of times the event has been dispatched to at least one module */
+		uint64_t calls;
+		/* Total time spent dispatching the event, in seconds */
+		double time;
+
+		EventStats() : name(NULL), calls(0), time(0) { }
+	};
+
+	/** Whether event dispatch is being timed, options:profileevents
+	 */
+	static bool ProfileEvents;
+
+	/** Dispatch statistics for each event
+	 */
+	static EventStats EventProfile[I_SIZE];
+
+	/** Times one dispatch of an event in FOREACH_MOD and FOREACH_RESULT.
+	 * Does nothing unless ProfileEvents is set.
+	 */
+	class CoreExport EventTimer
+	{
+		Implementation event;
+		bool active;
+		long sec, usec;
+
+		void Start(const char *name);
+		void Stop();
+
+	 public:
+		EventTimer(Implementation i, const char *name) : event(i), active(ProfileEvents)
+		{
+			if (active)
+				this->Start(name);
+		}
+
+		~EventTimer()
+		{
+			if (active)
+				this->Stop();
+		}
+	};
+
  	/** List of all modules loaded in Anope
 	 */
 	static std::list<Module *> Modules;
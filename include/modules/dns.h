@@ -129,6 +129,13 @@ namespace DNS
 		virtual void UpdateSerial() = 0;
 		virtual void Notify(const Anope::string &zone) = 0;
 		virtual uint32_t GetSerial() const = 0;
+
+		/** Get statistics about the result cache
+		 * @param hits Set to the number of requests answered from the cache
+		 * @param misses Set to the number of cacheable requests sent to the nameserver
+		 * @param entries Set to the number of records currently in the cache
+		 */
+		virtual void GetCacheStats(uint64_t &hits, uint64_t &misses, size_t &entries) const = 0;
 	};
 	
 	/** A DNS query.
@@ -7,6 +7,10 @@ enum HTTPError
 	HTTP_FOUND = 302,
 	HTTP_BAD_REQUEST = 400,
 	HTTP_PAGE_NOT_FOUND = 404,
+	HTTP_PAYLOAD_TOO_LARGE = 413,
+	HTTP_HEADERS_TOO_LARGE = 431,
+	HTTP_NOT_IMPLEMENTED = 501,
+	HTTP_SERVICE_UNAVAILABLE = 503,
 	HTTP_NOT_SUPPORTED = 505
 };
 
@@ -72,14 +76,81 @@ struct HTTPReply
 	}
 };
 
+/* Named values from a message, such as its headers or parameters, in the order
+ * they were received. Messages only have a few, so they are kept in a vector and
+ * searched. If a name is received more than once, its last value is used.
+ */
+class HTTPFields
+{
+ public:
+	typedef std::vector<std::pair<Anope::string, Anope::string> > list;
+	typedef list::const_iterator iterator;
+	typedef list::const_iterator const_iterator;
+
+ private:
+	list fields;
+	/* Whether names are case insensitive */
+	bool ci;
+
+	const Anope::string *Find(const Anope::string &name) const
+	{
+		for (list::const_reverse_iterator it = this->fields.rbegin(), it_end = this->fields.rend(); it != it_end; ++it)
+			if (this->ci ? it->first.equals_ci(name) : it->first.equals_cs(name))
+				return &it->second;
+		return NULL;
+	}
+
+ public:
+	HTTPFields(bool c = false) : ci(c) { }
+
+	void Add(const Anope::string &name, const Anope::string &value)
+	{
+		this->fields.push_back(std::make_pair(name, value));
+	}
+
+	/** Get a value
+	 * @param name The name of the value
+	 * @return The value, or an empty string if there is none
+	 */
+	const Anope::string &operator[](const Anope::string &name) const
+	{
+		static const Anope::string empty;
+		const Anope::string *value = this->Find(name);
+		return value ? *value : empty;
+	}
+
+	size_t count(const Anope::string &name) const
+	{
+		return this->Find(name) ? 1 : 0;
+	}
+
+	bool empty() const { return this->fields.empty(); }
+	size_t size() const { return this->fields.size(); }
+	void clear() { this->fields.clear(); }
+
+	iterator begin() const { return this->fields.begin(); }
+	iterator end() const { return this->fields.end(); }
+};
+
 /* A message from soneone */
 struct HTTPMessage
 {
-	std::map<Anope::string, Anope::string> headers;
-	std::map<Anope::string, Anope::string> cookies;
-	std::map<Anope::string, Anope::string> get_data;
-	std::map<Anope::string, Anope::string> post_data;
+	HTTPFields headers;
+	HTTPFields cookies;
+	HTTPFields get_data;
+	HTTPFields post_data;
 	Anope::string content;
+
+	HTTPMessage() : headers(true) { }
+
+	void Clear()
+	{
+		this->headers.clear();
+		this->cookies.clear();
+		this->get_data.clear();
+		this->post_data.clear();
+		this->content.clear();
+	}
 };
 
 class HTTPClient;
@@ -125,6 +196,13 @@ class HTTPClient : public ClientSocket, public BinarySocket, public Base
 
 	virtual void SendError(HTTPError err, const Anope::string &msg) = 0;
 	virtual void SendReply(HTTPReply *) = 0;
+
+	/** Send what has been written to a reply so far, for pages which generate large replies
+	 * in pieces. The rest of the reply is sent by later calls to this, and the reply must be
+	 * finished with SendReply. Clients which do not support chunked replies get the whole
+	 * reply when it is finished, the headers of the reply can not be changed after the first call.
+	 */
+	virtual void SendChunk(HTTPReply *) = 0;
 };
 
 class HTTPProvider : public ListenSocket, public Service
@@ -97,9 +97,13 @@ namespace SQL
 	{
 		Anope::string query;
 		std::map<Anope::string, QueryData> parameters;
+		/* Whether this query should run ahead of other queued queries, for queries
+		 * a user is waiting on. It may run before queries queued earlier.
+		 */
+		bool priority;
 
-		Query() { }
-		Query(const Anope::string &q) : query(q) { }
+		Query() : priority(false) { }
+		Query(const Anope::string &q) : query(q), priority(false) { }
 
 		Query& operator=(const Anope::string &q)
 		{
@@ -128,6 +132,119 @@ namespace SQL
 			}
 			catch (const ConvertException &ex) { }
 		}
+
+		/** Build the text of a prepared statement for this query, with a ? in place of
+		 * every escaped parameter. Parameters which are not escaped are substituted in to the text.
+		 * @param values Set to the values of the escaped parameters, in order
+		 * @return The text, or an empty string if this query can not be run as a prepared statement
+		 */
+		Anope::string Prepare(std::vector<Anope::string> &values) const
+		{
+			Anope::string statement;
+			size_t last = 0, placeholders = 0;
+
+			values.clear();
+
+			for (size_t start; (start = this->query.find('@', last)) != Anope::string::npos;)
+			{
+				size_t end = this->query.find('@', start + 1);
+				if (end == Anope::string::npos)
+					break;
+
+				std::map<Anope::string, QueryData>::const_iterator it = this->parameters.find(this->query.substr(start + 1, end - start - 1));
+				if (it == this->parameters.end())
+				{
+					statement += this->query.substr(last, end - last);
+					last = end;
+					continue;
+				}
+
+				statement += this->query.substr(last, start - last);
+				if (it->second.escape)
+				{
+					statement += "?";
+					values.push_back(it->second.data);
+				}
+				else
+					statement += it->second.data;
+				last = end + 1;
+			}
+
+			statement += this->query.substr(last);
+
+			/* A ? anywhere else, such as in a string literal, would be taken as a placeholder */
+			for (size_t i = 0; (i = statement.find('?', i)) != Anope::string::npos; ++i)
+				++placeholders;
+			if (placeholders != values.size())
+			{
+				values.clear();
+				return "";
+			}
+
+			return statement;
+		}
+	};
+
+	/** A cache of prepared statements keyed by their text, which
+	 * drops the least recently used statement once it is full.
+	 * T is the provider's statement handle, T() is never a valid handle.
+	 */
+	template<typename T> class StatementCache
+	{
+		typedef std::list<std::pair<Anope::string, T> > list_type;
+		/* Most recently used first */
+		list_type statements;
+		TR1NS::unordered_map<Anope::string, typename list_type::iterator, Anope::hash_cs> index;
+
+	 public:
+		/* The most statements kept, 0 disables the cache */
+		size_t max;
+
+		StatementCache(size_t m) : max(m) { }
+
+		/** Find a statement and mark it used
+		 * @return The statement, or T() if it is not cached
+		 */
+		T Find(const Anope::string &text)
+		{
+			typename TR1NS::unordered_map<Anope::string, typename list_type::iterator, Anope::hash_cs>::iterator it = this->index.find(text);
+			if (it == this->index.end())
+				return T();
+
+			this->statements.splice(this->statements.begin(), this->statements, it->second);
+			return it->second->second;
+		}
+
+		/** Add a statement which is not cached
+		 * @param evicted Set to the statement the caller has to free to make room, if any
+		 */
+		void Add(const Anope::string &text, T stmt, T &evicted)
+		{
+			evicted = T();
+
+			if (this->statements.size() >= this->max && !this->statements.empty())
+			{
+				evicted = this->statements.back().second;
+				this->index.erase(this->statements.back().first);
+				this->statements.pop_back();
+			}
+
+			this->statements.push_front(std::make_pair(text, stmt));
+			this->index[text] = this->statements.begin();
+		}
+
+		/** Remove every statement
+		 * @return The statements, for the caller to free
+		 */
+		std::vector<T> Clear()
+		{
+			std::vector<T> all;
+			for (typename list_type::iterator it = this->statements.begin(), it_end = this->statements.end(); it != it_end; ++it)
+				all.push_back(it->second);
+			this->statements.clear();
+			this->index.clear();
+			return all;
+		}
 	};
 
 	/** A result from a SQL query
@@ -203,13 +320,72 @@ namespace SQL
 
 		virtual Result RunQuery(const Query &query) = 0;
 
+		/** Run queries in one transaction, which is rolled back if any of them fails.
+		 * The interface is given the result of the last query, or of the one which failed.
+		 * The default runs the transaction immediately using RunTransactionQuery.
+		 */
+		virtual void RunTransaction(Interface *i, const std::vector<Query> &queries)
+		{
+			Result res = this->RunTransactionQuery(queries);
+			if (!i)
+				return;
+			if (res)
+				i->OnResult(res);
+			else
+				i->OnError(res);
+		}
+
+		/** Run queries in one transaction immediately.
+		 * @return The result of the last query, or of the one which failed
+		 */
+		virtual Result RunTransactionQuery(const std::vector<Query> &queries)
+		{
+			Result res = this->RunQuery(Query("BEGIN"));
+			for (unsigned j = 0; res && j < queries.size(); ++j)
+				res = this->RunQuery(queries[j]);
+
+			if (!res)
+				this->RunQuery(Query("ROLLBACK"));
+			else
+			{
+				Result commit = this->RunQuery(Query("COMMIT"));
+				if (!commit)
+					return commit;
+			}
+
+			return res;
+		}
+
 		virtual std::vector<Query> CreateTable(const Anope::string &table, const Data &data) = 0;
 
 		virtual Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) = 0;
 
+		/** Build one query inserting or updating many rows of a table.
+		 * @param table The table
+		 * @param rows The data of each row, keyed by id. Every id must be nonzero.
+		 * @return The query, or an empty query if this provider can only insert one row at a time
+		 */
+		virtual Query BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows) { return Query(); }
+
 		virtual Query GetTables(const Anope::string &prefix) = 0;
 
 		virtual Anope::string FromUnixtime(time_t) = 0;
+
+		/** Get the number of queries waiting to be executed on this provider.
+		 * Providers which execute queries synchronously have nothing queued.
+		 */
+		virtual size_t GetQueueSize() { return 0; }
+
+		/** Get statistics about the transactions run on this provider
+		 * @param commits Set to the number of transactions committed
+		 * @param rollbacks Set to the number of transactions rolled back
+		 * @param seconds Set to the total time from transactions being queued until they were committed
+		 */
+		virtual void GetTransactionStats(uint64_t &commits, uint64_t &rollbacks, double &seconds)
+		{
+			commits = rollbacks = 0;
+			seconds = 0;
+		}
 	};
 
 }
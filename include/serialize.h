@@ -17,6 +17,7 @@
 
 #include "anope.h"
 #include "base.h"
+#include "memstats.h"
 
 namespace Serialize
 {
@@ -69,6 +70,18 @@ class CoreExport Serializable : public virtual Base
 	size_t last_commit;
 	/* The last time this object was commited to the database */
 	time_t last_commit_time;
+	/* Memory counter for this object's type, and the size of this object if it is on the heap */
+	MemoryCounter *s_counter;
+	size_t s_size;
+	/* Objects allocated by operator new whose Serializable constructor has not run yet, and their
+	 * sizes. This is on the heap for the same reason as SerializableItems.
+	 */
+	static std::vector<std::pair<char *, size_t> > *Pending;
+
+	/** Find the allocation this object is being constructed in and take it off of Pending
+	 * @return The size of the most derived object, or 0 if it is not on the heap
+	 */
+	size_t TakePendingSize();
 
  protected:
  	Serializable(const Anope::string &serialize_type);
@@ -91,6 +104,11 @@ class CoreExport Serializable : public virtual Base
 
 	bool IsCached(Serialize::Data &);
 	void UpdateCache(Serialize::Data &);
+	/** Forget what was last commited to the database for this object, so
+	 * it is written again the next time it is checked, such as after the
+	 * commit failed.
+	 */
+	void InvalidateCache();
 
 	bool IsTSCached();
 	void UpdateTS();
@@ -103,6 +121,18 @@ class CoreExport Serializable : public virtual Base
 	virtual void Serialize(Serialize::Data &data) const = 0;
 
 	static const std::list<Serializable *> &GetItems();
+
+	/** Get the memory counter for a type of object. The counter exists for
+	 * as long as Anope runs, so it is kept when the type is reloaded.
+	 * @param type The name of the type
+	 */
+	static MemoryCounter *GetMemoryCounter(const Anope::string &type);
+
+	/* Serializable objects allocated on the heap have their size counted
+	 * against the memory counter of their type.
+	 */
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr);
 };
 
 /* A serializable type. There should be one of these classes for each type
@@ -168,6 +198,12 @@ class CoreExport Serialize::Type
 	 */
 	void UpdateTimestamp();
 
+	/** Sets the object type timestamp, for when the objects were brought up to date
+	 * by something that was started earlier, such as a query run in the background.
+	 * @param ts The time all objects of this type are now known to be updated to
+	 */
+	void UpdateTimestamp(time_t ts);
+
 	Module* GetOwner() const { return this->owner; }
 
 	static Serialize::Type *Find(const Anope::string &name);
@@ -16,6 +16,7 @@
 #include "services.h"
 #include "anope.h"
 #include "extensible.h"
+#include "idmap.h"
 
 /* Anope. We are at the top of the server tree, our uplink is
  * almost always me->GetLinks()[0]. We never have an uplink. */
@@ -35,7 +36,7 @@ namespace Servers
 
 	/* Server maps by name and id */
 	extern CoreExport Anope::map<Server *> ByName;
-	extern CoreExport Anope::map<Server *> ByID;
+	extern CoreExport IDMap<Server *> ByID;
 
 	/* CAPAB/PROTOCTL given by the uplink */
 	extern CoreExport std::set<Anope::string> Capab;
@@ -66,6 +67,10 @@ class CoreExport Server : public Extensible
 	bool quitting;
 	/* Reason this server was quit */
 	Anope::string quit_reason;
+	/* Users on this server, linked through User::server_next */
+	User *user_list;
+	/* Channels created during this server's burst, linked through Channel::sync_next */
+	Channel *syncing_channels;
 
  public:
 	/** Constructor
@@ -175,6 +180,31 @@ class CoreExport Server : public Extensible
 	 */
 	bool IsQuitting() const;
 
+	/** Adds a user to this server, setting their server
+	 * @param u The user
+	 */
+	void AddUser(User *u);
+
+	/** Removes a user from this server, clearing their server
+	 * @param u The user
+	 */
+	void DelUser(User *u);
+
+	/** Get the first user on this server, the rest can be reached through User::server_next
+	 * @return The user, or NULL if there are no users on this server
+	 */
+	User *GetUsers() const;
+
+	/** Mark a channel as syncing until this server finishes its burst
+	 * @param c The channel
+	 */
+	void AddSyncingChannel(Channel *c);
+
+	/** Stop waiting for this server's burst to sync a channel
+	 * @param c The channel
+	 */
+	void DelSyncingChannel(Channel *c);
+
 	/** Send a message to alll users on this server
 	 * @param source The source of the message
 	 * @param message The message
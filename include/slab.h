@@ -0,0 +1,157 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "services.h"
+#include "anope.h"
+
+#include <cstddef>
+#include <new>
+
+/** A pool of fixed size objects, allocated from large slabs. Objects which are
+ * created and destroyed in bursts, such as users and their channel memberships
+ * during netsplits, are allocated from these so they do not fragment the heap,
+ * and so memory can be returned to the system in bulk once a burst is over.
+ * Pools must only be used from the main thread.
+ */
+class CoreExport SlabPool
+{
+	struct Slab;
+
+	/* Every pool, on the heap as pools can be static */
+	static std::list<SlabPool *> *Pools;
+
+	/* Slabs with at least one free chunk, partially used slabs first */
+	Slab *available;
+	/* Size of each chunk, including its header */
+	size_t chunk_size;
+	/* Number of chunks in each slab */
+	size_t chunks_per_slab;
+
+	size_t slabs, empty_slabs, objects;
+	uint64_t allocations;
+
+	void Link(Slab *slab, bool front);
+	void Unlink(Slab *slab);
+	void Release(Slab *slab);
+
+ public:
+	/* Name of the pool */
+	const Anope::string name;
+	/* Size of the objects in this pool */
+	const size_t object_size;
+	/* Number of empty slabs kept around for reuse, the rest are freed immediately */
+	size_t max_empty;
+
+	/** Constructor
+	 * @param n The name of the pool
+	 * @param size The size of objects allocated from the pool
+	 * @param slab_size The approximate size of each slab
+	 */
+	SlabPool(const Anope::string &n, size_t size, size_t slab_size = 64 * 1024);
+
+	/** Destructor, frees the empty slabs. Slabs with objects still in
+	 * them are left alone, as the objects may still be in use during shutdown.
+	 */
+	~SlabPool();
+
+	/** Allocate an object
+	 * @return Memory for an object of object_size bytes
+	 */
+	void *Allocate();
+
+	/** Free an object allocated from this pool
+	 * @param ptr The object
+	 */
+	void Deallocate(void *ptr);
+
+	/** Free every empty slab
+	 */
+	void Trim();
+
+	/** Get the number of slabs allocated */
+	size_t GetSlabs() const { return this->slabs; }
+	/** Get the number of objects currently allocated */
+	size_t GetObjects() const { return this->objects; }
+	/** Get the number of objects this pool can hold without allocating another slab */
+	size_t GetCapacity() const { return this->slabs * this->chunks_per_slab; }
+	/** Get the number of bytes held by this pool */
+	size_t GetBytes() const;
+	/** Get the number of allocations made since startup */
+	uint64_t GetAllocations() const { return this->allocations; }
+
+	/** Free every empty slab in every pool
+	 */
+	static void TrimAll();
+
+	/** Get every pool
+	 */
+	static const std::list<SlabPool *> &GetPools();
+
+	/** Get the shared pool for small objects of the given size, used
+	 * for container nodes. The size is rounded up to a multiple of 16.
+	 * @param size The object size, at most 256
+	 */
+	static SlabPool *ForSize(size_t size);
+};
+
+/** A standard allocator that allocates single objects, such as the nodes of
+ * a std::map or std::set, from the shared slab pools.
+ */
+template<typename T>
+class SlabAllocator
+{
+ public:
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef T value_type;
+
+	template<typename U> struct rebind
+	{
+		typedef SlabAllocator<U> other;
+	};
+
+	SlabAllocator() { }
+	SlabAllocator(const SlabAllocator &) { }
+	template<typename U> SlabAllocator(const SlabAllocator<U> &) { }
+
+	pointer address(reference x) const { return &x; }
+	const_pointer address(const_reference x) const { return &x; }
+
+	pointer allocate(size_type n, const void * = NULL)
+	{
+		if (n == 1 && sizeof(T) <= 256)
+			return static_cast<pointer>(SlabPool::ForSize(sizeof(T))->Allocate());
+		return static_cast<pointer>(::operator new(n * sizeof(T)));
+	}
+
+	void deallocate(pointer p, size_type n)
+	{
+		if (n == 1 && sizeof(T) <= 256)
+			SlabPool::ForSize(sizeof(T))->Deallocate(p);
+		else
+			::operator delete(p);
+	}
+
+	size_type max_size() const { return static_cast<size_type>(-1) / sizeof(T); }
+
+	void construct(pointer p, const T &val) { new (p) T(val); }
+	void destroy(pointer p) { p->~T(); }
+};
+
+template<typename T, typename U> inline bool operator==(const SlabAllocator<T> &, const SlabAllocator<U> &) { return true; }
+template<typename T, typename U> inline bool operator!=(const SlabAllocator<T> &, const SlabAllocator<U> &) { return false; }
+
+#endif // SLAB_H
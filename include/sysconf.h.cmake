@@ -14,6 +14,7 @@
 #cmakedefine HAVE_EVENTFD 1
 #cmakedefine HAVE_EPOLL 1
 #cmakedefine HAVE_POLL 1
+#cmakedefine HAVE_BACKTRACE 1
 #cmakedefine GETTEXT_FOUND 1
 
 #ifdef HAVE_CSTDINT
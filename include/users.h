@@ -15,15 +15,19 @@
 #define USERS_H
 
 #include "anope.h"
+#include "atom.h"
 #include "modes.h"
 #include "extensible.h"
 #include "serialize.h"
 #include "commands.h"
 #include "account.h"
+#include "slab.h"
+#include "idmap.h"
 
 typedef Anope::hash_map<User *> user_map;
 
-extern CoreExport user_map UserListByNick, UserListByUID;
+extern CoreExport user_map UserListByNick;
+extern CoreExport IDMap<User *> UserListByUID;
 
 extern CoreExport int OperCount;
 extern CoreExport unsigned MaxUserCount;
@@ -40,8 +44,8 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
  public:
 	typedef std::map<Anope::string, Anope::string> ModeList;
  protected:
-	Anope::string vident;
-	Anope::string ident;
+	Anope::Atom vident;
+	Anope::Atom ident;
 	Anope::string uid;
 	/* If the user is on the access list of the nick theyre on */
 	bool on_access;
@@ -61,19 +65,21 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	Anope::string nick;
 
 	/* User's real hostname */
-	Anope::string host;
+	Anope::Atom host;
 	/* User's virtual hostname */
-	Anope::string vhost;
+	Anope::Atom vhost;
 	/* User's cloaked hostname */
-	Anope::string chost;
+	Anope::Atom chost;
 	/* Realname */
-	Anope::string realname;
+	Anope::Atom realname;
 	/* SSL Fingerprint */
 	Anope::string fingerprint;
 	/* User's IP */
-	Anope::string ip;
+	Anope::Atom ip;
 	/* Server user is connected to */
 	Server *server;
+	/* Links in the server's list of users, see Server::GetUsers() */
+	User *server_prev, *server_next;
 	/* When the user signed on. Set on connect and never modified. */
 	time_t signon;
 	/* Timestamp of the nick. Updated when the nick changes. */
@@ -82,7 +88,7 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	bool super_admin;
 
 	/* Channels the user is in */
-	typedef std::map<Channel *, ChanUserContainer *> ChanUserList;
+	typedef std::map<Channel *, ChanUserContainer *, std::less<Channel *>, SlabAllocator<std::pair<Channel * const, ChanUserContainer *> > > ChanUserList;
 	ChanUserList chans;
 
 	/* Last time this user sent a memo command used */
@@ -114,7 +120,40 @@ class CoreExport User : public virtual Base, public Extensible, public CommandRe
 	 */
 	virtual ~User();
 
+ private:
+	/** Bring back a user parked by Park(), applying whatever changed while they were gone
+	 */
+	void Revive(const Anope::string &snick, const Anope::string &sident, const Anope::string &shost, const Anope::string &svhost, const Anope::string &sip, Server *sserver, const Anope::string &srealname, const Anope::string &smodes, NickCore *account);
+
+ public:
+	/** Give a user parked by Park() back the oper status and account it was
+	 * taken off of, before it is revived or quit.
+	 * @param account The account the user was identified to, if it still exists
+	 */
+	void Unpark(NickCore *account);
+
  public:
+	/* Users are allocated from a slab pool, classes deriving from User are not */
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
+
+	/** Quit many users at once, such as when their server splits. Modules
+	 * see OnUserQuit for every user in turn before moving on to the next module.
+	 * @param users The users, users already quitting are skipped
+	 * @param reason The reason for the quit
+	 */
+	static void Quit(const std::vector<User *> &users, const Anope::string &reason);
+
+	/** Park the users of a server that split, for options:splitgrace. Parked users
+	 * are taken out of their channels and can not be found, do not count as opers
+	 * or towards their account, but are otherwise kept as they are. If their server relinks in time and reintroduces them with the same
+	 * ID and timestamp they are revived by OnIntroduce(), the rest are quit once the
+	 * grace period is up.
+	 * @param users The users
+	 * @param reason The reason to quit the users with if they do not come back
+	 */
+	static void Park(const std::vector<User *> &users, const Anope::string &reason);
+
 	static User* OnIntroduce(const Anope::string &snick, const Anope::string &sident, const Anope::string &shost, const Anope::string &svhost, const Anope::string &sip, Server *sserver, const Anope::string &srealname, time_t ts, const Anope::string &smodes, const Anope::string &suid, NickCore *nc);
 
 	/** Update the nickname of a user record accordingly, should be
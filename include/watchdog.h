@@ -0,0 +1,123 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+
+#include "services.h"
+
+/** Tracks the heartbeat of the main loop. Each iteration of the main loop is
+ * "busy" from the moment the socket engine returns from polling until it is
+ * about to poll again. A separate thread watches the heartbeat, and if a single
+ * iteration stays busy for longer than options:stallthreshold it takes a
+ * snapshot of what the main loop is executing, so slow subsystems can be found.
+ */
+namespace Watchdog
+{
+	/* Maximum depth of nested scopes that are recorded */
+	static const unsigned MaxDepth = 16;
+	/* Size of the buffers names are copied into, longer names are cut short */
+	static const unsigned MaxName = 32;
+
+	/** One level of what the main loop is executing. These are written by the
+	 * main thread and read without locking by the watchdog thread, so the names
+	 * are copied in rather than pointed to: the strings they come from may be
+	 * freed, such as by a module being unloaded, while the watchdog reads them.
+	 * At worst the watchdog reads a name which is being overwritten.
+	 */
+	struct Frame
+	{
+		char kind[MaxName];
+		char name[MaxName];
+		char module[MaxName];
+	};
+
+	/** Copies a name into a frame, always leaving it terminated
+	 * @param dest The frame's buffer
+	 * @param src The name, or NULL
+	 */
+	inline void CopyName(char *dest, const char *src)
+	{
+		unsigned i = 0;
+		if (src)
+			for (; i < MaxName - 1 && src[i]; ++i)
+				dest[i] = src[i];
+		dest[i] = 0;
+	}
+
+	extern CoreExport Frame Frames[MaxDepth];
+	extern CoreExport volatile unsigned Depth;
+	/* Whether options:stallthreshold is set. If not, scopes do not record their names. */
+	extern CoreExport bool Enabled;
+
+	/** Marks what the main loop is executing for as long as this object exists,
+	 * such as an IRCDMessage, a Command or a module event.
+	 */
+	class Scope
+	{
+		Frame *frame;
+
+	 public:
+		Scope(const char *kind, const char *name) : frame(Enabled && Depth < MaxDepth ? &Frames[Depth] : NULL)
+		{
+			if (frame)
+			{
+				CopyName(frame->kind, kind);
+				CopyName(frame->name, name);
+				frame->module[0] = 0;
+			}
+			++Depth;
+		}
+
+		~Scope()
+		{
+			--Depth;
+		}
+
+		/** Sets the module currently handling this scope
+		 * @param module The module name
+		 */
+		void SetModule(const char *module)
+		{
+			if (frame)
+				CopyName(frame->module, module);
+		}
+	};
+
+	/** Called by the socket engine when it returns from polling
+	 */
+	extern CoreExport void Busy();
+
+	/** Called by the main loop before it polls, logs the previous iteration if it stalled
+	 */
+	extern CoreExport void Idle();
+
+	/** Stops the watchdog thread
+	 */
+	extern CoreExport void Shutdown();
+
+	/** Get the event loop lag
+	 * @return How long the last iteration of the main loop was busy for, in seconds
+	 */
+	extern CoreExport double GetLag();
+
+	/** Get the number of stalls seen since startup
+	 */
+	extern CoreExport uint64_t GetStallCount();
+
+	/** Get the total time spent stalled since startup, in seconds
+	 */
+	extern CoreExport double GetStallTime();
+
+	/** Get the length of the longest stall seen since startup, in seconds
+	 */
+	extern CoreExport double GetLongestStall();
+}
+
+#endif // WATCHDOG_H
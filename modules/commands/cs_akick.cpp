@@ -71,10 +71,10 @@ class CommandCSAKick : public Command
 		/* Check excepts BEFORE we get this far */
 		if (ci->c)
 		{
-			std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> modes = ci->c->GetModeList("EXCEPT");
-			for (; modes.first != modes.second; ++modes.first)
+			const Channel::EntryList &excepts = ci->c->GetModeList("EXCEPT");
+			for (unsigned i = 0; i < excepts.size(); ++i)
 			{
-				if (Anope::Match(modes.first->second, mask))
+				if (Anope::Match(excepts[i].GetMask(), mask))
 				{
 					source.Reply(CHAN_EXCEPTED, mask.c_str(), ci->name.c_str());
 					return;
@@ -270,15 +270,23 @@ class CSEntryMessage : public Module
 	{
 	}
 
-	void OnJoinChannel(User *u, Channel *c) anope_override
+	void OnJoinChannelBatch(Channel *c, const std::vector<User *> &users) anope_override
 	{
-		if (u && c && c->ci && u->server->IsSynced())
+		if (!c->ci)
+			return;
+
+		EntryMessageList *messages = c->ci->GetExt<EntryMessageList>("entrymsg");
+		if (messages == NULL || (*messages)->empty())
+			return;
+
+		for (unsigned i = 0; i < users.size(); ++i)
 		{
-			EntryMessageList *messages = c->ci->GetExt<EntryMessageList>("entrymsg");
+			User *u = users[i];
+			if (!u->server->IsSynced())
+				continue;
 
-			if (messages != NULL)
-				for (unsigned i = 0; i < (*messages)->size(); ++i)
-					u->SendMessage(c->ci->WhoSends(), "[%s] %s", c->ci->name.c_str(), (*messages)->at(i)->message.c_str());
+			for (unsigned j = 0; j < (*messages)->size(); ++j)
+				u->SendMessage(c->ci->WhoSends(), "[%s] %s", c->ci->name.c_str(), (*messages)->at(j)->message.c_str());
 		}
 	}
 };
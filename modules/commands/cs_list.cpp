@@ -73,13 +73,12 @@ class CommandCSList : public Command
 		ListFormatter list(source.GetAccount());
 		list.AddColumn(_("Name")).AddColumn(_("Description"));
 
-		Anope::map<ChannelInfo *> ordered_map;
-		for (registered_channel_map::const_iterator it = RegisteredChannelList->begin(), it_end = RegisteredChannelList->end(); it != it_end; ++it)
-			ordered_map[it->first] = it->second;
+		std::vector<const registered_channel_map::value_type *> ordered;
+		RegisteredChannelList->ordered(ordered);
 
-		for (Anope::map<ChannelInfo *>::const_iterator it = ordered_map.begin(), it_end = ordered_map.end(); it != it_end; ++it)
+		for (unsigned i = 0; i < ordered.size(); ++i)
 		{
-			const ChannelInfo *ci = it->second;
+			const ChannelInfo *ci = ordered[i]->second;
 
 			if (!is_servadmin)
 			{
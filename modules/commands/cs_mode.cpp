@@ -613,15 +613,11 @@ class CommandCSMode : public Command
 							}
 							else
 							{
-								std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> its = ci->c->GetModeList(cm->name);
-								for (; its.first != its.second;)
-								{
-									const Anope::string &mask = its.first->second;
-									++its.first;
-
-									if (Anope::Match(mask, param))
-										ci->c->RemoveMode(NULL, cm, mask);
-								}
+								/* Removing the matches changes the list */
+								const Channel::EntryList list = ci->c->GetModeList(cm->name);
+								for (unsigned k = 0; k < list.size(); ++k)
+									if (Anope::Match(list[k].GetMask(), param))
+										ci->c->RemoveMode(NULL, cm, list[k].GetMask());
 							}
 					}
 			}
@@ -436,7 +436,7 @@ class CSSeen : public Module
  private:
 	void UpdateUser(const User *u, const TypeInfo Type, const Anope::string &nick, const Anope::string &nick2, const Anope::string &channel, const Anope::string &message)
 	{
-		if (simple || !u->server->IsSynced())
+		if (simple || (u->server && !u->server->IsSynced()))
 			return;
 
 		SeenInfo* &info = database[nick];
@@ -1304,15 +1304,10 @@ class CSSet : public Module
 		return EVENT_CONTINUE;
 	}
 
-	void OnJoinChannel(User *u, Channel *c) anope_override
+	void OnCheckTS(Channel *c, time_t &ts) anope_override
 	{
-		if (persist_lower_ts && c->ci && persist.HasExt(c->ci) && c->creation_time > c->ci->time_registered)
-		{
-			Log(LOG_DEBUG) << "Changing TS of " << c->name << " from " << c->creation_time << " to " << c->ci->time_registered;
-			c->creation_time = c->ci->time_registered;
-			IRCD->SendChannel(c);
-			c->Reset();
-		}
+		if (persist_lower_ts && c->ci && persist.HasExt(c->ci) && ts > c->ci->time_registered)
+			ts = c->ci->time_registered;
 	}
 
 	void OnSetCorrectModes(User *user, Channel *chan, AccessGroup &access, bool &give_modes, bool &take_modes) anope_override
@@ -74,13 +74,12 @@ class CommandNSList : public Command
 
 		list.AddColumn(_("Nick")).AddColumn(_("Last usermask"));
 
-		Anope::map<NickAlias *> ordered_map;
-		for (nickalias_map::const_iterator it = NickAliasList->begin(), it_end = NickAliasList->end(); it != it_end; ++it)
-			ordered_map[it->first] = it->second;
+		std::vector<const nickalias_map::value_type *> ordered;
+		NickAliasList->ordered(ordered);
 
-		for (Anope::map<NickAlias *>::const_iterator it = ordered_map.begin(), it_end = ordered_map.end(); it != it_end; ++it)
+		for (unsigned i = 0; i < ordered.size(); ++i)
 		{
-			const NickAlias *na = it->second;
+			const NickAlias *na = ordered[i]->second;
 
 			/* Don't show private nicks to non-services admins. */
 			if (na->nc->HasExt("NS_PRIVATE") && !is_servadmin && na->nc != mync)
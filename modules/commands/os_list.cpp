@@ -168,15 +168,14 @@ class CommandOSUserList : public Command
 		else
 		{
 			/* Historically this has been ordered, so... */
-			Anope::map<User *> ordered_map;
-			for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
-				ordered_map[it->first] = it->second;
+			std::vector<const user_map::value_type *> ordered;
+			UserListByNick.ordered(ordered);
 
 			source.Reply(_("Users list:"));
 
-			for (Anope::map<User *>::const_iterator it = ordered_map.begin(); it != ordered_map.end(); ++it)
+			for (unsigned i = 0; i < ordered.size(); ++i)
 			{
-				User *u2 = it->second;
+				User *u2 = ordered[i]->second;
 
 				if (!pattern.empty())
 				{
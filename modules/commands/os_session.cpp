@@ -733,9 +733,9 @@ class OSSession : public Module
 		}
 	}
 
-	void OnUserQuit(User *u, const Anope::string &msg) anope_override
+	void DelSession(User *u)
 	{
-		if (!session_limit || !u->server || u->server->IsULined())
+		if (!session_limit)
 			return;
 
 		SessionService::SessionMap &sessions = this->ss.GetSessions();
@@ -756,6 +756,35 @@ class OSSession : public Module
 		sessions.erase(sit);
 	}
 
+	void OnUserRevive(User *u) anope_override
+	{
+		if (!session_limit || u->server->IsULined())
+			return;
+
+		cidr u_ip(u->ip, u->ip.find(':') != Anope::string::npos ? ipv6_cidr : ipv4_cidr);
+		if (!u_ip.valid())
+			return;
+
+		/* They were already let in once, so this does not check the limit */
+		Session* &session = this->ss.FindOrCreateSession(u_ip);
+		if (session)
+			++session->count;
+		else
+			session = new Session(u->ip, u->ip.find(':') != Anope::string::npos ? ipv6_cidr : ipv4_cidr);
+	}
+
+	void OnUserPark(User *u) anope_override
+	{
+		this->DelSession(u);
+	}
+
+	void OnUserQuit(User *u, const Anope::string &msg) anope_override
+	{
+		/* Users parked by options:splitgrace have no server, and left their session when parked */
+		if (u->server && !u->server->IsULined())
+			this->DelSession(u);
+	}
+
 	void OnExpireTick() anope_override
 	{
 		if (Anope::NoExpire)
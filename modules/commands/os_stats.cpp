@@ -166,31 +166,56 @@ class CommandOSStats : public Command
 	{
 		size_t entries, buckets, max_chain;
 
-		GetHashStats(UserListByNick, entries, buckets, max_chain);
-		source.Reply(_("Users (nick): %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
+		source.Reply(_("Users (nick): %lu entries, %lu slots, longest probe is %lu groups"), UserListByNick.size(), UserListByNick.capacity(), UserListByNick.longest_probe());
 
-		if (!UserListByUID.empty())
+		if (UserListByUID.Size())
+			source.Reply(_("Users (uid): %lu entries, %lu slots, longest probe is %lu"), UserListByUID.Size(), UserListByUID.Capacity(), UserListByUID.LongestProbe());
+
+		source.Reply(_("Channels: %lu entries, %lu slots, longest probe is %lu groups"), ChannelList.size(), ChannelList.capacity(), ChannelList.longest_probe());
+		source.Reply(_("Registered channels: %lu entries, %lu slots, longest probe is %lu groups"), RegisteredChannelList->size(), RegisteredChannelList->capacity(), RegisteredChannelList->longest_probe());
+		source.Reply(_("Registered nicknames: %lu entries, %lu slots, longest probe is %lu groups"), NickAliasList->size(), NickAliasList->capacity(), NickAliasList->longest_probe());
+		source.Reply(_("Registered nick groups: %lu entries, %lu slots, longest probe is %lu groups"), NickCoreList->size(), NickCoreList->capacity(), NickCoreList->longest_probe());
+
+		if (session_service)
 		{
-			GetHashStats(UserListByUID, entries, buckets, max_chain);
-			source.Reply(_("Users (uid): %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
+			GetHashStats(session_service->GetSessions(), entries, buckets, max_chain);
+			source.Reply(_("Sessions: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
 		}
+	}
 
-		GetHashStats(ChannelList, entries, buckets, max_chain);
-		source.Reply(_("Channels: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
-
-		GetHashStats(*RegisteredChannelList, entries, buckets, max_chain);
-		source.Reply(_("Registered channels: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
+	void DoStatsMemory(CommandSource &source)
+	{
+		const std::list<MemoryCounter *> &counters = MemoryCounter::GetCounters();
+		std::map<Anope::string, std::pair<size_t, size_t> > modules;
+		size_t objects = 0, bytes = 0;
 
-		GetHashStats(*NickAliasList, entries, buckets, max_chain);
-		source.Reply(_("Registered nicknames: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
+		source.Reply(_("Approximate memory usage:"));
+		for (std::list<MemoryCounter *>::const_iterator it = counters.begin(), it_end = counters.end(); it != it_end; ++it)
+		{
+			const MemoryCounter *mc = *it;
+			if (!mc->objects)
+				continue;
+
+			Anope::string mod = mc->GetOwnerName();
+			source.Reply(_("%s %s (%s): %lu objects, %lu kB"), mc->category.c_str(), mc->name.c_str(), mod.c_str(), static_cast<unsigned long>(mc->objects), static_cast<unsigned long>(mc->bytes / 1024));
+
+			std::pair<size_t, size_t> &total = modules[mod];
+			total.first += mc->objects;
+			total.second += mc->bytes;
+			objects += mc->objects;
+			bytes += mc->bytes;
+		}
 
-		GetHashStats(*NickCoreList, entries, buckets, max_chain);
-		source.Reply(_("Registered nick groups: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
+		for (std::map<Anope::string, std::pair<size_t, size_t> >::const_iterator it = modules.begin(), it_end = modules.end(); it != it_end; ++it)
+			source.Reply(_("Total for %s: %lu objects, %lu kB"), it->first.c_str(), static_cast<unsigned long>(it->second.first), static_cast<unsigned long>(it->second.second / 1024));
+		source.Reply(_("Total: %lu objects, %lu kB"), static_cast<unsigned long>(objects), static_cast<unsigned long>(bytes / 1024));
 
-		if (session_service)
+		const std::list<SlabPool *> &pools = SlabPool::GetPools();
+		for (std::list<SlabPool *>::const_iterator it = pools.begin(), it_end = pools.end(); it != it_end; ++it)
 		{
-			GetHashStats(session_service->GetSessions(), entries, buckets, max_chain);
-			source.Reply(_("Sessions: %lu entries, %lu buckets, longest chain is %d"), entries, buckets, max_chain);
+			const SlabPool *pool = *it;
+			source.Reply(_("Pool %s: %lu of %lu objects in use, %lu slabs, %lu kB, %lu allocations"), pool->name.c_str(), static_cast<unsigned long>(pool->GetObjects()), static_cast<unsigned long>(pool->GetCapacity()),
+				static_cast<unsigned long>(pool->GetSlabs()), static_cast<unsigned long>(pool->GetBytes() / 1024), static_cast<unsigned long>(pool->GetAllocations()));
 		}
 	}
 
@@ -199,7 +224,7 @@ class CommandOSStats : public Command
 		akills("XLineManager", "xlinemanager/sgline"), snlines("XLineManager", "xlinemanager/snline"), sqlines("XLineManager", "xlinemanager/sqline")
 	{
 		this->SetDesc(_("Show status of Services and network"));
-		this->SetSyntax("[AKILL | HASH | UPLINK | UPTIME | ALL | RESET]");
+		this->SetSyntax("[AKILL | HASH | MEMORY | UPLINK | UPTIME | ALL | RESET]");
 	}
 
 	void Execute(CommandSource &source, const std::vector<Anope::string> &params) anope_override
@@ -217,13 +242,16 @@ class CommandOSStats : public Command
 		if (extra.equals_ci("ALL") || extra.equals_ci("HASH"))
 			this->DoStatsHash(source);
 
+		if (extra.equals_ci("ALL") || extra.equals_ci("MEMORY"))
+			this->DoStatsMemory(source);
+
 		if (extra.equals_ci("ALL") || extra.equals_ci("UPLINK"))
 			this->DoStatsUplink(source);
 
 		if (extra.empty() || extra.equals_ci("ALL") || extra.equals_ci("UPTIME"))
 			this->DoStatsUptime(source);
 
-		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("HASH") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
+		if (!extra.empty() && !extra.equals_ci("ALL") && !extra.equals_ci("AKILL") && !extra.equals_ci("HASH") && !extra.equals_ci("MEMORY") && !extra.equals_ci("UPLINK") && !extra.equals_ci("UPTIME"))
 			source.Reply(_("Unknown STATS option: \002%s\002"), extra.c_str());
 	}
 
@@ -246,6 +274,10 @@ class CommandOSStats : public Command
 				" \n"
 				"The \002HASH\002 option displays information about the hash maps.\n"
 				" \n"
+				"The \002MEMORY\002 option displays the approximate amount of\n"
+				"memory used by each kind of object, and by each module, and\n"
+				"the state of the memory pools.\n"
+				" \n"
 				"The \002ALL\002 option displays all of the above statistics."));
 		return true;
 	}
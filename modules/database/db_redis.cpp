@@ -53,24 +53,127 @@ class Data : public Serialize::Data
 	}
 };
 
-class TypeLoader : public Interface
+/** Data used to unserialize loaded objects. One is reused for every object, so the
+ * streams for each field are only created once, and asking for a field which the
+ * object does not have, which unserializing extensible items does a lot, does not
+ * create a stream either.
+ */
+class LoadData : public Serialize::Data
 {
-	Anope::string type;
+	struct Field
+	{
+		std::stringstream *stream;
+		/* The object this field was last set for */
+		unsigned generation;
+
+		Field() : stream(NULL), generation(0) { }
+	};
+
+	std::map<Anope::string, Field> fields;
+	unsigned generation;
+	/* Returned for fields the current object does not have */
+	std::stringstream empty;
+
  public:
-	TypeLoader(Module *creator, const Anope::string &t) : Interface(creator), type(t) { }
+	LoadData() : generation(0) { }
 
-	void OnResult(const Reply &r) anope_override;
+	~LoadData()
+	{
+		for (std::map<Anope::string, Field>::iterator it = fields.begin(), it_end = fields.end(); it != it_end; ++it)
+			delete it->second.stream;
+	}
+
+	/** Start unserializing another object
+	 * @param values The field names and values of the object
+	 */
+	void Load(const std::vector<std::pair<Anope::string, Anope::string> > &values)
+	{
+		++this->generation;
+
+		for (unsigned i = 0; i < values.size(); ++i)
+		{
+			Field &f = this->fields[values[i].first];
+			if (!f.stream)
+				f.stream = new std::stringstream();
+
+			f.stream->clear();
+			f.stream->str(values[i].second.str());
+			f.generation = this->generation;
+		}
+	}
+
+	std::iostream& operator[](const Anope::string &key) anope_override
+	{
+		std::map<Anope::string, Field>::iterator it = this->fields.find(key);
+		if (it != this->fields.end() && it->second.generation == this->generation)
+			return *it->second.stream;
+
+		this->empty.clear();
+		this->empty.str("");
+		return this->empty;
+	}
+
+	std::set<Anope::string> KeySet() const anope_override
+	{
+		std::set<Anope::string> keys;
+		for (std::map<Anope::string, Field>::const_iterator it = this->fields.begin(), it_end = this->fields.end(); it != it_end; ++it)
+			if (it->second.generation == this->generation)
+				keys.insert(it->first);
+		return keys;
+	}
+
+	size_t Hash() const anope_override
+	{
+		size_t hash = 0;
+		for (std::map<Anope::string, Field>::const_iterator it = this->fields.begin(), it_end = this->fields.end(); it != it_end; ++it)
+			if (it->second.generation == this->generation && !it->second.stream->str().empty())
+				hash ^= Anope::hash_cs()(it->second.stream->str());
+		return hash;
+	}
+};
+
+/** An object which has been fetched but not unserialized yet */
+struct LoadedObject
+{
+	uint64_t id;
+	std::vector<std::pair<Anope::string, Anope::string> > fields;
 };
 
-class ObjectLoader : public Interface
+/** A type whose objects are being loaded */
+struct LoadingType
 {
 	Anope::string type;
-	int64_t id;
+	/* Objects which have been fetched but not unserialized yet */
+	std::deque<LoadedObject> objects;
+	/* Number of chunks of objects which have been asked for but not received */
+	unsigned pending;
+	/* Whether every object has been fetched */
+	bool done;
+
+	LoadingType(const Anope::string &t) : type(t), pending(0), done(false) { }
+};
 
+/** Receives the ids of the objects of a type */
+class TypeLoader : public Interface
+{
+	LoadingType *lt;
  public:
-	ObjectLoader(Module *creator, const Anope::string &t, int64_t i) : Interface(creator), type(t), id(i) { }
+	TypeLoader(Module *creator, LoadingType *l) : Interface(creator), lt(l) { }
 
 	void OnResult(const Reply &r) anope_override;
+	void OnError(const Anope::string &error) anope_override;
+};
+
+/** Receives a chunk of objects of a type from the load script */
+class ChunkLoader : public Interface
+{
+	LoadingType *lt;
+	std::vector<uint64_t> ids;
+ public:
+	ChunkLoader(Module *creator, LoadingType *l, const std::vector<uint64_t> &i) : Interface(creator), lt(l), ids(i) { }
+
+	void OnResult(const Reply &r) anope_override;
+	void OnError(const Anope::string &error) anope_override;
 };
 
 class IDInterface : public Interface
@@ -82,24 +185,30 @@ class IDInterface : public Interface
 	void OnResult(const Reply &r) anope_override;
 };
 
-class Deleter : public Interface
+/** Receives the SHA1 of the store script once Redis has loaded it */
+class ScriptLoader : public Interface
 {
-	Anope::string type;
-	int64_t id;
  public:
-	Deleter(Module *creator, const Anope::string &t, int64_t i) : Interface(creator), type(t), id(i) { }
+	ScriptLoader(Module *creator) : Interface(creator) { }
 
 	void OnResult(const Reply &r) anope_override;
 };
 
-class Updater : public Interface
+/** A batch of object updates and deletions, sent as one call to the store script */
+class BatchWriter : public Interface
 {
-	Anope::string type;
-	int64_t id;
  public:
-	Updater(Module *creator, const Anope::string &t, int64_t i) : Interface(creator), type(t), id(i) { }
+	/* The arguments to the store script */
+	std::vector<Anope::string> args;
+	/* The objects the batch updates, and those of them whose hset notification is being ignored */
+	std::vector<Reference<Serializable> > objects, ignoring;
+	/* Type and id of the objects the batch deletes */
+	std::vector<std::pair<Anope::string, uint64_t> > deletes;
+
+	BatchWriter(Module *creator) : Interface(creator) { }
 
 	void OnResult(const Reply &r) anope_override;
+	void OnError(const Anope::string &error) anope_override;
 };
 
 class ModifiedObject : public Interface
@@ -120,57 +229,372 @@ class SubscriptionListener : public Interface
 	void OnResult(const Reply &r) anope_override;
 };
 
+/* The script which stores objects. Its arguments are a list of objects, each given as
+ * an operation ('u' to update or 'd' to delete), the type, the id, the number of fields,
+ * and then the field names and values. The old values of each object are removed from
+ * the value sets before the new ones are added, all atomically.
+ */
+static const char *store_script =
+	"local i = 1\n"
+	"while i <= #ARGV do\n"
+	"	local op, type, id, n = ARGV[i], ARGV[i + 1], ARGV[i + 2], tonumber(ARGV[i + 3])\n"
+	"	local hash = 'hash:' .. type .. ':' .. id\n"
+	"	local old = redis.call('HGETALL', hash)\n"
+	"	for j = 1, #old, 2 do\n"
+	"		redis.call('SREM', 'value:' .. type .. ':' .. old[j] .. ':' .. old[j + 1], id)\n"
+	"	end\n"
+	"	if op == 'd' then\n"
+	"		redis.call('DEL', hash)\n"
+	"		redis.call('SREM', 'ids:' .. type, id)\n"
+	"	else\n"
+	"		redis.call('SADD', 'ids:' .. type, id)\n"
+	"		if n > 0 then\n"
+	"			local fields = {}\n"
+	"			for j = 1, n * 2, 2 do\n"
+	"				local key, value = ARGV[i + 3 + j], ARGV[i + 4 + j]\n"
+	"				fields[j], fields[j + 1] = key, value\n"
+	"				redis.call('SADD', 'value:' .. type .. ':' .. key .. ':' .. value, id)\n"
+	"			end\n"
+	"			redis.call('HMSET', hash, unpack(fields))\n"
+	"		end\n"
+	"	end\n"
+	"	i = i + 4 + n * 2\n"
+	"end\n"
+	"return 1\n";
+
+/* The script which loads objects. It is given a type and object ids, and returns
+ * the fields of each object.
+ */
+static const char *load_script =
+	"local out = {}\n"
+	"for i = 2, #ARGV do\n"
+	"	out[i - 1] = redis.call('HGETALL', 'hash:' .. ARGV[1] .. ':' .. ARGV[i])\n"
+	"end\n"
+	"return out\n";
+
+/* How many objects to ask for in each call to the load script */
+static const unsigned load_count = 100;
+
+/* The most objects sent in one call to the store script, so Redis is not blocked for too long */
+static const unsigned max_batch = 256;
+
 class DatabaseRedis : public Module, public Pipe
 {
 	SubscriptionListener sl;
+	/* Objects changed since the last batch was sent */
 	std::set<Serializable *> updated_items;
+	/* Type and id of objects deleted since the last batch was sent */
+	std::vector<std::pair<Anope::string, uint64_t> > deleted_items;
+	/* Types being loaded, in the order their objects must be unserialized */
+	std::deque<LoadingType *> loading;
+	LoadData load_data;
+	/* Whether the pipe has been notified since the last batch was sent */
+	bool notified;
+	/* Batches held back while batches Redis lost the script for are sent again, in the order they were made */
+	std::deque<BatchWriter *> held_batches;
+
+	/** Send a batch to the store script, or hold it back if it could overtake a batch being sent again
+	 * @param batch The batch
+	 */
+	void WriteBatch(BatchWriter *batch)
+	{
+		if (this->reloading)
+		{
+			this->held_batches.push_back(batch);
+			return;
+		}
+
+		std::vector<Anope::string> &args = batch->args;
+
+		/* Until Redis has told us the script's SHA1 the whole script has to be sent */
+		if (this->script_sha.empty())
+		{
+			args[0] = "EVAL";
+			args[1] = store_script;
+		}
+		else
+		{
+			args[0] = "EVALSHA";
+			args[1] = this->script_sha;
+		}
+
+		++this->batches_in_flight;
+		redis->SendCommand(batch, args);
+	}
+
+	/** Send a batch of objects to the store script
+	 * @param batch The batch being built, NULL if it is empty
+	 * @param objects The number of objects in the batch
+	 */
+	void SendBatch(BatchWriter *&batch, unsigned &objects)
+	{
+		if (batch == NULL)
+			return;
+
+		this->WriteBatch(batch);
+
+		batch = NULL;
+		objects = 0;
+	}
+
+	/** Start a new batch of objects for the store script
+	 */
+	BatchWriter *StartBatch()
+	{
+		BatchWriter *batch = new BatchWriter(this);
+		/* The command and script, filled in by WriteBatch */
+		batch->args.push_back("");
+		batch->args.push_back("");
+		/* The number of keys */
+		batch->args.push_back("0");
+		return batch;
+	}
 
  public:
 	ServiceReference<Provider> redis;
+	/* SHA1 of the store script, once Redis has loaded it */
+	Anope::string script_sha;
+	/* Batches sent which Redis has not answered yet */
+	unsigned batches_in_flight;
+	/* Whether Redis lost the store script. The batches in flight are sent again with the
+	 * whole script as their errors come back, and new batches are held until they are done.
+	 */
+	bool reloading;
 
-	DatabaseRedis(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sl(this)
+	DatabaseRedis(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sl(this), notified(false), batches_in_flight(0), reloading(false)
 	{
 		me = this;
 
 	}
 
+	~DatabaseRedis()
+	{
+		for (unsigned i = 0; i < this->loading.size(); ++i)
+			delete this->loading[i];
+		for (unsigned i = 0; i < this->held_batches.size(); ++i)
+			delete this->held_batches[i];
+	}
+
+	/** Ask for the objects of a type, in chunks which are all sent at once
+	 * @param lt The type
+	 * @param ids The ids of its objects
+	 */
+	void LoadChunks(LoadingType *lt, const std::vector<uint64_t> &ids)
+	{
+		for (unsigned i = 0; i < ids.size(); i += load_count)
+		{
+			std::vector<uint64_t> chunk(ids.begin() + i, ids.begin() + std::min<size_t>(i + load_count, ids.size()));
+
+			std::vector<Anope::string> args;
+			args.push_back("EVAL");
+			args.push_back(load_script);
+			args.push_back("0");
+			args.push_back(lt->type);
+			for (unsigned j = 0; j < chunk.size(); ++j)
+				args.push_back(stringify(chunk[j]));
+
+			redis->SendCommand(new ChunkLoader(this, lt, chunk), args);
+			++lt->pending;
+		}
+	}
+
+	/** Unserialize the objects which have been fetched. Objects of a type are only
+	 * unserialized once every type before it is loaded, as they may depend on them.
+	 */
+	void LoadObjects()
+	{
+		while (!this->loading.empty())
+		{
+			LoadingType *lt = this->loading.front();
+			Serialize::Type *st = Serialize::Type::Find(lt->type);
+
+			for (unsigned i = 0; st && i < lt->objects.size(); ++i)
+			{
+				const LoadedObject &lo = lt->objects[i];
+
+				this->load_data.Load(lo.fields);
+
+				Serializable* &obj = st->objects[lo.id];
+				obj = st->Unserialize(obj, this->load_data);
+				if (obj)
+				{
+					obj->id = lo.id;
+					obj->UpdateCache(this->load_data);
+				}
+			}
+			lt->objects.clear();
+
+			if (!lt->done)
+				break;
+
+			this->loading.pop_front();
+			delete lt;
+		}
+	}
+
+	/** Load the store script into Redis, so batches only need to send its SHA1
+	 */
+	void LoadScript()
+	{
+		std::vector<Anope::string> args;
+		args.push_back("SCRIPT");
+		args.push_back("LOAD");
+		args.push_back(store_script);
+
+		redis->SendCommand(new ScriptLoader(this), args);
+	}
+
 	/* Insert or update an object */
 	void InsertObject(Serializable *obj)
 	{
-		Serialize::Type *t = obj->GetSerializableType();
+		this->updated_items.insert(obj);
+		this->QueueWrite();
+	}
 
-		/* If there is no id yet for ths object, get one */
-		if (!obj->id)
-			redis->SendCommand(new IDInterface(this, obj), "INCR id:" + t->GetName());
-		else
+	/** Send what has changed once we are back in the main loop. The pipe is only
+	 * written to once, however many objects change, such as during loading.
+	 */
+	void QueueWrite()
+	{
+		if (!this->notified)
 		{
+			this->notified = true;
+			this->Notify();
+		}
+	}
+
+	/** Called when Redis has answered a batch
+	 */
+	void OnBatchDone()
+	{
+		--this->batches_in_flight;
+
+		/* Every batch which could have been overtaken is done, send the ones held back.
+		 * This is done from the pipe, as this may be called while the connection is being closed.
+		 */
+		if (this->reloading && !this->batches_in_flight)
+		{
+			this->reloading = false;
+			if (!this->held_batches.empty())
+				this->QueueWrite();
+		}
+	}
+
+	void OnNotify() anope_override
+	{
+		this->notified = false;
+
+		if (!redis)
+			return;
+
+		while (!this->reloading && !this->held_batches.empty())
+		{
+			this->WriteBatch(this->held_batches.front());
+			this->held_batches.pop_front();
+		}
+
+		/* Every object changed since the last time is sent in as few calls to the store script
+		 * as possible. The commands are all written to the socket at once, so they only take
+		 * one round trip.
+		 */
+		BatchWriter *batch = NULL;
+		unsigned objects = 0;
+
+		for (unsigned i = 0; i < this->deleted_items.size(); ++i)
+		{
+			if (batch == NULL)
+				batch = this->StartBatch();
+
+			std::vector<Anope::string> &args = batch->args;
+			args.push_back("d");
+			args.push_back(this->deleted_items[i].first);
+			args.push_back(stringify(this->deleted_items[i].second));
+			args.push_back("0");
+			batch->deletes.push_back(this->deleted_items[i]);
+
+			if (++objects == max_batch)
+				this->SendBatch(batch, objects);
+		}
+		this->deleted_items.clear();
+
+		for (std::set<Serializable *>::iterator it = this->updated_items.begin(), it_end = this->updated_items.end(); it != it_end; ++it)
+		{
+			Serializable *obj = *it;
+			Serialize::Type *t = obj->GetSerializableType();
+
+			/* If there is no id yet for this object, get one. It is sent with the next batch. */
+			if (!obj->id)
+			{
+				redis->SendCommand(new IDInterface(this, obj), "INCR id:" + t->GetName());
+				continue;
+			}
+
 			Data data;
 			obj->Serialize(data);
 
 			if (obj->IsCached(data))
-				return;
+				continue;
 
 			obj->UpdateCache(data);
 
-			std::vector<Anope::string> args;
-			args.push_back("HGETALL");
-			args.push_back("hash:" + t->GetName() + ":" + stringify(obj->id));
+			if (batch == NULL)
+				batch = this->StartBatch();
 
-			/* Get object attrs to clear before updating */
-			redis->SendCommand(new Updater(this, t->GetName(), obj->id), args);
+			std::vector<Anope::string> &args = batch->args;
+			args.push_back("u");
+			args.push_back(t->GetName());
+			args.push_back(stringify(obj->id));
+			args.push_back(stringify(data.data.size()));
+
+			typedef std::map<Anope::string, std::stringstream *> items;
+			for (items::iterator it2 = data.data.begin(), it2_end = data.data.end(); it2 != it2_end; ++it2)
+			{
+				args.push_back(it2->first);
+				args.push_back(it2->second->str());
+			}
+
+			batch->objects.push_back(obj);
+
+			/* Storing the fields causes one hset notification, which we know about already */
+			if (!data.data.empty())
+			{
+				++obj->redis_ignore;
+				batch->ignoring.push_back(obj);
+			}
+
+			if (++objects == max_batch)
+				this->SendBatch(batch, objects);
 		}
+		this->updated_items.clear();
+
+		this->SendBatch(batch, objects);
 	}
 
-	void OnNotify() anope_override
+	/** Queue the objects of a batch Redis did not store to be sent again. They are not sent
+	 * until something else changes, so a Redis which is down is not retried in a loop.
+	 * @param batch The batch
+	 */
+	void Requeue(BatchWriter *batch)
 	{
-		for (std::set<Serializable *>::iterator it = this->updated_items.begin(), it_end = this->updated_items.end(); it != it_end; ++it)
+		/* No notification is coming for these */
+		for (unsigned i = 0; i < batch->ignoring.size(); ++i)
 		{
-			Serializable *s = *it;
+			Serializable *obj = batch->ignoring[i];
+			if (obj && obj->redis_ignore)
+				--obj->redis_ignore;
+		}
 
-			this->InsertObject(s);
+		for (unsigned i = 0; i < batch->objects.size(); ++i)
+		{
+			Serializable *obj = batch->objects[i];
+			if (obj)
+			{
+				obj->InvalidateCache();
+				this->updated_items.insert(obj);
+			}
 		}
 
-		this->updated_items.clear();
+		this->deleted_items.insert(this->deleted_items.end(), batch->deletes.begin(), batch->deletes.end());
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
@@ -190,6 +614,8 @@ class DatabaseRedis : public Module, public Pipe
 
 		while (redis->BlockAndProcess());
 
+		this->LoadScript();
+
 		redis->Subscribe(&this->sl, "__keyspace@*__:hash:*");
 
 		return EVENT_STOP;
@@ -200,39 +626,39 @@ class DatabaseRedis : public Module, public Pipe
 		if (!redis)
 			return;
 
+		LoadingType *lt = new LoadingType(sb->GetName());
+		this->loading.push_back(lt);
+
 		std::vector<Anope::string> args;
 		args.push_back("SMEMBERS");
 		args.push_back("ids:" + sb->GetName());
-		
-		redis->SendCommand(new TypeLoader(this, sb->GetName()), args);
+
+		redis->SendCommand(new TypeLoader(this, lt), args);
 	}
 
 	void OnSerializableConstruct(Serializable *obj) anope_override
 	{
 		this->updated_items.insert(obj);
-		this->Notify();
+		this->QueueWrite();
 	}
 
 	void OnSerializableDestruct(Serializable *obj) anope_override
 	{
 		Serialize::Type *t = obj->GetSerializableType();
 
-		std::vector<Anope::string> args;
-		args.push_back("HGETALL");
-		args.push_back("hash:" + t->GetName() + ":" + stringify(obj->id));
-
-		/* Get all of the attributes for this object */
-		redis->SendCommand(new Deleter(this, t->GetName(), obj->id), args);
+		/* Objects without an id were never stored */
+		if (obj->id)
+			this->deleted_items.push_back(std::make_pair(t->GetName(), obj->id));
 
 		this->updated_items.erase(obj);
 		t->objects.erase(obj->id);
-		this->Notify();
+		this->QueueWrite();
 	}
 
 	void OnSerializableUpdate(Serializable *obj) anope_override
 	{
 		this->updated_items.insert(obj);
-		this->Notify();
+		this->QueueWrite();
 	}
 };
 
@@ -240,10 +666,11 @@ void TypeLoader::OnResult(const Reply &r)
 {
 	if (r.type != Reply::MULTI_BULK || !me->redis)
 	{
-		delete this;
+		this->OnError("redis: unable to load objects of type " + this->lt->type);
 		return;
 	}
 
+	std::vector<uint64_t> ids;
 	for (unsigned i = 0; i < r.multi_bulk.size(); ++i)
 	{
 		const Reply *reply = r.multi_bulk[i];
@@ -251,54 +678,70 @@ void TypeLoader::OnResult(const Reply &r)
 		if (reply->type != Reply::BULK)
 			continue;
 
-		int64_t id;
 		try
 		{
-			id = convertTo<int64_t>(reply->bulk);
-		}
-		catch (const ConvertException &)
-		{
-			continue;
+			ids.push_back(convertTo<uint64_t>(reply->bulk));
 		}
+		catch (const ConvertException &) { }
+	}
 
-		std::vector<Anope::string> args;
-		args.push_back("HGETALL");
-		args.push_back("hash:" + this->type + ":" + stringify(id));
+	me->LoadChunks(this->lt, ids);
 
-		me->redis->SendCommand(new ObjectLoader(me, this->type, id), args);
+	if (!this->lt->pending)
+	{
+		this->lt->done = true;
+		me->LoadObjects();
 	}
 
 	delete this;
 }
 
-void ObjectLoader::OnResult(const Reply &r)
+void TypeLoader::OnError(const Anope::string &error)
 {
-	Serialize::Type *st = Serialize::Type::Find(this->type);
+	Interface::OnError(error);
 
-	if (r.type != Reply::MULTI_BULK || r.multi_bulk.empty() || !me->redis || !st)
-	{
-		delete this;
-		return;
-	}
+	/* Do not hold up the types after this one */
+	this->lt->done = true;
+	me->LoadObjects();
 
-	Data data;
+	delete this;
+}
 
-	for (unsigned i = 0; i + 1 < r.multi_bulk.size(); i += 2)
+void ChunkLoader::OnResult(const Reply &r)
+{
+	for (unsigned i = 0; i < r.multi_bulk.size() && i < this->ids.size(); ++i)
 	{
-		const Reply *key = r.multi_bulk[i],
-			*value = r.multi_bulk[i + 1];
+		const Reply *hash = r.multi_bulk[i];
 
-		data[key->bulk] << value->bulk;
-	}
+		if (hash->type != Reply::MULTI_BULK || hash->multi_bulk.empty())
+			continue;
 
-	Serializable* &obj = st->objects[this->id];
-	obj = st->Unserialize(obj, data);
-	if (obj)
-	{
-		obj->id = this->id;
-		obj->UpdateCache(data);
+		/* Filled in place, so the fields are not copied again */
+		this->lt->objects.push_back(LoadedObject());
+		LoadedObject &lo = this->lt->objects.back();
+
+		lo.id = this->ids[i];
+		lo.fields.reserve(hash->multi_bulk.size() / 2);
+		for (unsigned j = 0; j + 1 < hash->multi_bulk.size(); j += 2)
+			lo.fields.push_back(std::make_pair(hash->multi_bulk[j]->bulk, hash->multi_bulk[j + 1]->bulk));
 	}
 
+	if (!--this->lt->pending)
+		this->lt->done = true;
+
+	me->LoadObjects();
+
+	delete this;
+}
+
+void ChunkLoader::OnError(const Anope::string &error)
+{
+	Interface::OnError(error);
+
+	if (!--this->lt->pending)
+		this->lt->done = true;
+	me->LoadObjects();
+
 	delete this;
 }
 
@@ -324,127 +767,44 @@ void IDInterface::OnResult(const Reply &r)
 	delete this;
 }
 
-void Deleter::OnResult(const Reply &r)
+void ScriptLoader::OnResult(const Reply &r)
 {
-	if (r.type != Reply::MULTI_BULK || !me->redis || r.multi_bulk.empty())
-	{
-		delete this;
-		return;
-	}
-
-	/* Transaction start */
-	me->redis->StartTransaction();
-
-	std::vector<Anope::string> args;
-	args.push_back("DEL");
-	args.push_back("hash:" + this->type + ":" + stringify(this->id));
-
-	/* Delete hash object */
-	me->redis->SendCommand(NULL, args);
-
-	args.clear();
-	args.push_back("SREM");
-	args.push_back("ids:" + this->type);
-	args.push_back(stringify(this->id));
-
-	/* Delete id from ids set */
-	me->redis->SendCommand(NULL, args);
-
-	for (unsigned i = 0; i + 1 < r.multi_bulk.size(); i += 2)
-	{
-		const Reply *key = r.multi_bulk[i],
-			*value = r.multi_bulk[i + 1];
-
-		args.clear();
-		args.push_back("SREM");
-		args.push_back("value:" + this->type + ":" + key->bulk + ":" + value->bulk);
-		args.push_back(stringify(this->id));
-
-		/* Delete value -> object id */
-		me->redis->SendCommand(NULL, args);
-	}
-
-	/* Transaction end */
-	me->redis->CommitTransaction();
+	if (r.type == Reply::BULK)
+		me->script_sha = r.bulk;
 
 	delete this;
 }
 
-void Updater::OnResult(const Reply &r)
+void BatchWriter::OnResult(const Reply &r)
 {
-	Serialize::Type *st = Serialize::Type::Find(this->type);
+	me->OnBatchDone();
+	delete this;
+}
 
-	if (!st)
+void BatchWriter::OnError(const Anope::string &error)
+{
+	/* Redis forgets scripts when it restarts, so send the script itself and load it again.
+	 * Every batch sent after this one fails the same way and is sent again in order behind it,
+	 * and batches made from now on wait until they are all done.
+	 */
+	if (error.find("NOSCRIPT") == 0 && me->redis)
 	{
-		delete this;
-		return;
-	}
+		if (!me->reloading)
+		{
+			me->reloading = true;
+			me->script_sha.clear();
+			me->LoadScript();
+		}
 
-	Serializable *obj = st->objects[this->id];
-	if (!obj)
-	{
-		delete this;
+		this->args[0] = "EVAL";
+		this->args[1] = store_script;
+		me->redis->SendCommand(this, this->args);
 		return;
 	}
 
-	Data data;
-	obj->Serialize(data);
-
-	/* Transaction start */
-	me->redis->StartTransaction();
-
-	for (unsigned i = 0; i + 1 < r.multi_bulk.size(); i += 2)
-	{
-		const Reply *key = r.multi_bulk[i],
-			*value = r.multi_bulk[i + 1];
-
-		std::vector<Anope::string> args;
-		args.push_back("SREM");
-		args.push_back("value:" + this->type + ":" + key->bulk + ":" + value->bulk);
-		args.push_back(stringify(this->id));
-
-		/* Delete value -> object id */
-		me->redis->SendCommand(NULL, args);
-	}
-
-	/* Add object id to id set for this type */
-	std::vector<Anope::string> args;
-	args.push_back("SADD");
-	args.push_back("ids:" + this->type);
-	args.push_back(stringify(obj->id));
-	me->redis->SendCommand(NULL, args);
-
-	args.clear();
-	args.push_back("HMSET");
-	args.push_back("hash:" + this->type + ":" + stringify(obj->id));
-
-	typedef std::map<Anope::string, std::stringstream *> items;
-	for (items::iterator it = data.data.begin(), it_end = data.data.end(); it != it_end; ++it)
-	{
-		const Anope::string &key = it->first;
-		std::stringstream *value = it->second;
-
-		args.push_back(key);
-		args.push_back(value->str());
-
-		std::vector<Anope::string> args2;
-
-		args2.push_back("SADD");
-		args2.push_back("value:" + this->type + ":" + key + ":" + value->str());
-		args2.push_back(stringify(obj->id));
-
-		/* Add to value -> object id set */
-		me->redis->SendCommand(NULL, args2);
-	}
-
-	++obj->redis_ignore;
-
-	/* Add object */
-	me->redis->SendCommand(NULL, args);
-
-	/* Transaction end */
-	me->redis->CommitTransaction();
-
+	Log(me) << "redis: unable to store " << this->objects.size() << " objects and delete " << this->deletes.size() << ", they will be sent again: " << error;
+	me->Requeue(this);
+	me->OnBatchDone();
 	delete this;
 }
 
@@ -54,14 +54,38 @@ public:
 	}
 };
 
+class DBSQL;
+
+/** Queues the rows of a batch to be written again if its transaction is rolled back
+ */
+class BatchSQLInterface : public SQLSQLInterface
+{
+	DBSQL *db;
+
+ public:
+	/* The objects the batch writes and the ids it deletes from each table */
+	std::vector<Reference<Serializable> > objects;
+	std::map<Anope::string, std::vector<unsigned int> > deletes;
+
+	BatchSQLInterface(DBSQL *d);
+
+	void OnResult(const Result &r) anope_override;
+	void OnError(const Result &r) anope_override;
+};
+
 class DBSQL : public Module, public Pipe
 {
 	ServiceReference<Provider> sql;
 	SQLSQLInterface sqlinterface;
 	Anope::string prefix;
 	bool import;
+	unsigned batchsize;
 
 	std::set<Serializable *> updated_items;
+	/* Objects whose batch was rolled back, they are written again one at a time */
+	std::set<Serializable *> retry_items;
+	/* Ids of deleted objects not yet deleted from each table */
+	std::map<Anope::string, std::vector<unsigned int> > deleted_items;
 	bool shutting_down;
 	bool loading_databases;
 	bool loaded;
@@ -88,8 +112,61 @@ class DBSQL : public Module, public Pipe
 			this->sql->RunQuery(q);
 	}
 
+	void RunBackground(const std::vector<Query> &queries, BatchSQLInterface *iface)
+	{
+		if (queries.empty() || !this->sql)
+			delete iface;
+		else if (!Anope::Quitting)
+			this->sql->RunTransaction(iface, queries);
+		else
+		{
+			Result res = this->sql->RunTransactionQuery(queries);
+			if (!res)
+				Log(this) << "db_sql: Unable to write " << iface->objects.size() << " objects while shutting down: " << res.GetError();
+			delete iface;
+		}
+	}
+
+	/** Run the queries for a batch of rows in one transaction: one
+	 * DELETE per table for the deleted rows and one multi-row upsert per
+	 * table for the updated rows.
+	 */
+	void RunBatch(std::map<Anope::string, std::vector<unsigned int> > &deletes, std::map<Anope::string, std::map<unsigned int, Data *> > &upserts, std::vector<Reference<Serializable> > &objects)
+	{
+		std::vector<Query> queries;
+		BatchSQLInterface *iface = new BatchSQLInterface(this);
+		iface->objects.swap(objects);
+		iface->deletes = deletes;
+
+		for (std::map<Anope::string, std::vector<unsigned int> >::iterator it = deletes.begin(), it_end = deletes.end(); it != it_end; ++it)
+		{
+			Anope::string ids;
+			for (unsigned i = 0; i < it->second.size(); ++i)
+				ids += (i ? "," : "") + stringify(it->second[i]);
+			queries.push_back(Query("DELETE FROM `" + it->first + "` WHERE `id` IN (" + ids + ")"));
+		}
+		deletes.clear();
+
+		for (std::map<Anope::string, std::map<unsigned int, Data *> >::iterator it = upserts.begin(), it_end = upserts.end(); it != it_end; ++it)
+		{
+			Query insert = this->sql->BuildInsert(it->first, it->second);
+			if (!insert.query.empty())
+				queries.push_back(insert);
+			else
+				/* This provider can not insert many rows at once */
+				for (std::map<unsigned int, Data *>::iterator dit = it->second.begin(), dit_end = it->second.end(); dit != dit_end; ++dit)
+					queries.push_back(this->sql->BuildInsert(it->first, dit->first, *dit->second));
+
+			for (std::map<unsigned int, Data *>::iterator dit = it->second.begin(), dit_end = it->second.end(); dit != dit_end; ++dit)
+				delete dit->second;
+		}
+		upserts.clear();
+
+		this->RunBackground(queries, iface);
+	}
+
  public:
-	DBSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sql("", ""), sqlinterface(this), shutting_down(false), loading_databases(false), loaded(false), imported(false)
+	DBSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), sql("", ""), sqlinterface(this), batchsize(100), shutting_down(false), loading_databases(false), loaded(false), imported(false)
 	{
 
 
@@ -97,35 +174,120 @@ class DBSQL : public Module, public Pipe
 			throw ModuleException("db_sql can not be loaded after db_sql_live");
 	}
 
+	/** Write the rows of a rolled back batch again. They are not retried until the next
+	 * time something is written, so a database which is down is not retried in a loop.
+	 * @param objects The objects the batch wrote
+	 * @param deletes The ids the batch deleted from each table
+	 */
+	void Requeue(std::vector<Reference<Serializable> > &objects, const std::map<Anope::string, std::vector<unsigned int> > &deletes)
+	{
+		for (unsigned i = 0; i < objects.size(); ++i)
+		{
+			Serializable *obj = objects[i];
+			if (obj)
+			{
+				obj->InvalidateCache();
+				this->retry_items.insert(obj);
+			}
+		}
+
+		for (std::map<Anope::string, std::vector<unsigned int> >::const_iterator it = deletes.begin(), it_end = deletes.end(); it != it_end; ++it)
+		{
+			std::vector<unsigned int> &ids = this->deleted_items[it->first];
+			ids.insert(ids.end(), it->second.begin(), it->second.end());
+		}
+	}
+
 	void OnNotify() anope_override
 	{
+		/* Rows already in the database are updated and deleted in batches of up to batchsize rows,
+		 * each run as one transaction. New rows are inserted one at a time, as their ids are needed.
+		 */
+		std::map<Anope::string, std::vector<unsigned int> > deletes;
+		std::map<Anope::string, std::map<unsigned int, Data *> > upserts;
+		std::vector<Reference<Serializable> > objects;
+		unsigned rows = 0;
+
+		if (this->sql)
+			for (std::map<Anope::string, std::vector<unsigned int> >::iterator it = this->deleted_items.begin(), it_end = this->deleted_items.end(); it != it_end; ++it)
+				for (unsigned i = 0; i < it->second.size(); ++i)
+				{
+					deletes[it->first].push_back(it->second[i]);
+					if (++rows >= this->batchsize)
+					{
+						this->RunBatch(deletes, upserts, objects);
+						rows = 0;
+					}
+				}
+		this->deleted_items.clear();
+
+		/* Write the rows of rolled back batches on their own, so one row the database
+		 * refuses does not hold back the rest
+		 */
+		std::set<Serializable *> retrying;
+		retrying.swap(this->retry_items);
+		this->updated_items.insert(retrying.begin(), retrying.end());
+
 		for (std::set<Serializable *>::iterator it = this->updated_items.begin(), it_end = this->updated_items.end(); it != it_end; ++it)
 		{
 			Serializable *obj = *it;
 
 			if (this->sql)
 			{
-				Data data;
-				obj->Serialize(data);
+				Data *data = new Data();
+				obj->Serialize(*data);
 
-				if (obj->IsCached(data))
+				if (obj->IsCached(*data))
+				{
+					delete data;
 					continue;
+				}
 
-				obj->UpdateCache(data);
+				obj->UpdateCache(*data);
+
+				Serialize::Type *s_type = obj->GetSerializableType();
 
 				/* If we didn't load these objects and we don't want to import just update the cache and continue */
-				if (!this->loaded && !this->imported && !this->import)
+				if ((!this->loaded && !this->imported && !this->import) || !s_type)
+				{
+					delete data;
 					continue;
+				}
 
-				Serialize::Type *s_type = obj->GetSerializableType();
-				if (!s_type)
-					continue;
+				const Anope::string table = this->prefix + s_type->GetName();
 
-				std::vector<Query> create = this->sql->CreateTable(this->prefix + s_type->GetName(), data);
+				std::vector<Query> create = this->sql->CreateTable(table, *data);
 				for (unsigned i = 0; i < create.size(); ++i)
 					this->RunBackground(create[i]);
 
-				Query insert = this->sql->BuildInsert(this->prefix + s_type->GetName(), obj->id, data);
+				if (obj->id > 0 && this->imported && this->batchsize > 1)
+				{
+					if (retrying.count(obj))
+					{
+						std::map<Anope::string, std::vector<unsigned int> > no_deletes;
+						std::map<Anope::string, std::map<unsigned int, Data *> > row;
+						std::vector<Reference<Serializable> > row_object(1, obj);
+						row[table][obj->id] = data;
+						this->RunBatch(no_deletes, row, row_object);
+						continue;
+					}
+
+					Data *&row = upserts[table][obj->id];
+					delete row;
+					row = data;
+					objects.push_back(obj);
+
+					if (++rows >= this->batchsize)
+					{
+						this->RunBatch(deletes, upserts, objects);
+						rows = 0;
+					}
+					continue;
+				}
+
+				Query insert = this->sql->BuildInsert(table, obj->id, *data);
+				delete data;
+
 				if (this->imported)
 					this->RunBackground(insert, new ResultSQLSQLInterface(this, obj));
 				else
@@ -140,6 +302,9 @@ class DBSQL : public Module, public Pipe
 			}
 		}
 
+		if (rows)
+			this->RunBatch(deletes, upserts, objects);
+
 		this->updated_items.clear();
 		this->imported = true;
 	}
@@ -150,6 +315,7 @@ class DBSQL : public Module, public Pipe
 		this->sql = ServiceReference<Provider>("SQL::Provider", block->Get<const Anope::string>("engine"));
 		this->prefix = block->Get<const Anope::string>("prefix", "anope_db_");
 		this->import = block->Get<bool>("import");
+		this->batchsize = block->Get<unsigned>("batchsize", "100");
 	}
 
 	void OnShutdown() anope_override
@@ -201,8 +367,12 @@ class DBSQL : public Module, public Pipe
 			return;
 		Serialize::Type *s_type = obj->GetSerializableType();
 		if (s_type && obj->id > 0)
-			this->RunBackground("DELETE FROM `" + this->prefix + s_type->GetName() + "` WHERE `id` = " + stringify(obj->id));
+		{
+			this->deleted_items[this->prefix + s_type->GetName()].push_back(obj->id);
+			this->Notify();
+		}
 		this->updated_items.erase(obj);
+		this->retry_items.erase(obj);
 	}
 
 	void OnSerializableUpdate(Serializable *obj) anope_override
@@ -256,5 +426,28 @@ class DBSQL : public Module, public Pipe
 	}
 };
 
+BatchSQLInterface::BatchSQLInterface(DBSQL *d) : SQLSQLInterface(d), db(d)
+{
+}
+
+void BatchSQLInterface::OnResult(const Result &r)
+{
+	SQLSQLInterface::OnResult(r);
+	delete this;
+}
+
+void BatchSQLInterface::OnError(const Result &r)
+{
+	SQLSQLInterface::OnError(r);
+
+	unsigned deleted = 0;
+	for (std::map<Anope::string, std::vector<unsigned int> >::const_iterator it = this->deletes.begin(), it_end = this->deletes.end(); it != it_end; ++it)
+		deleted += it->second.size();
+	Log(this->owner) << "db_sql: Unable to write " << this->objects.size() << " objects and delete " << deleted << ", they will be written again: " << r.GetError();
+
+	this->db->Requeue(this->objects, this->deletes);
+	delete this;
+}
+
 MODULE_INIT(DBSQL)
 
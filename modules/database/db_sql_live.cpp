@@ -3,6 +3,73 @@
 
 using namespace SQL;
 
+class DBMySQL;
+
+/** Logs the result of queries whose result we do not need
+ */
+class LiveSQLInterface : public Interface
+{
+ public:
+	LiveSQLInterface(Module *o) : Interface(o) { }
+
+	void OnResult(const Result &r) anope_override
+	{
+		Log(LOG_DEBUG) << "SQL-live got " << r.Rows() << " rows for " << r.finished_query;
+	}
+
+	void OnError(const Result &r) anope_override
+	{
+		Log(LOG_DEBUG) << "SQL-live got error " << r.GetError() << " for " << r.finished_query;
+	}
+};
+
+class ChangeFeed;
+
+/** One poll of a change feed. Each poll has its own interface, so the result
+ * of a poll which was given up on can be told apart from the current one's.
+ */
+class ChangePoll : public Interface
+{
+	ChangeFeed *feed;
+
+ public:
+	/* When the poll was started, the rows it returns are at least as new as this */
+	const time_t started;
+
+	ChangePoll(DBMySQL *d, ChangeFeed *f, time_t s);
+
+	void OnResult(const Result &r) anope_override;
+	void OnError(const Result &r) anope_override;
+};
+
+/** Polls the table of one type for rows changed by other instances of Anope.
+ * Polls are run in the background by the SQL provider, and their result is
+ * applied when the provider passes it back to the main thread, so checking
+ * a type never waits for the database. Until then lookups see the objects
+ * as they were after the previous poll.
+ */
+class ChangeFeed
+{
+ public:
+	DBMySQL *db;
+	/* Name of the type polled */
+	const Anope::string type;
+	/* The poll whose result will be applied, or NULL if there is none in flight */
+	ChangePoll *current;
+	/* Every poll the provider has not answered yet, including ones given up on */
+	std::set<ChangePoll *> polls;
+	/* Objects we wrote or deleted while the current poll was in flight, their rows in the result may be older than our copy */
+	std::set<uint64_t> written;
+
+	ChangeFeed(DBMySQL *d, const Anope::string &t) : db(d), type(t), current(NULL) { }
+
+	~ChangeFeed()
+	{
+		for (std::set<ChangePoll *>::iterator it = this->polls.begin(), it_end = this->polls.end(); it != it_end; ++it)
+			delete *it;
+	}
+};
+
 class DBMySQL : public Module, public Pipe
 {
  private:
@@ -12,6 +79,9 @@ class DBMySQL : public Module, public Pipe
 	bool ro;
 	bool init;
 	std::set<Serializable *> updated_items;
+	LiveSQLInterface sqlinterface;
+	/* Change feeds of each type, by type name */
+	std::map<Anope::string, ChangeFeed *> feeds;
 
 	bool CheckSQL()
 	{
@@ -64,7 +134,7 @@ class DBMySQL : public Module, public Pipe
 	}
 
  public:
-	DBMySQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), SQL("", "")
+	DBMySQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, DATABASE | VENDOR), SQL("", ""), sqlinterface(this)
 	{
 		this->lastwarn = 0;
 		this->ro = false;
@@ -75,6 +145,12 @@ class DBMySQL : public Module, public Pipe
 			throw ModuleException("If db_sql_live is loaded it must be the first database module loaded.");
 	}
 
+	~DBMySQL()
+	{
+		for (std::map<Anope::string, ChangeFeed *>::iterator it = this->feeds.begin(), it_end = this->feeds.end(); it != it_end; ++it)
+			delete it->second;
+	}
+
 	void OnNotify() anope_override
 	{
 		if (!this->CheckInit())
@@ -109,6 +185,10 @@ class DBMySQL : public Module, public Pipe
 					obj->id = res.GetID();
 					s_type->objects[obj->id] = obj;
 				}
+
+				std::map<Anope::string, ChangeFeed *>::iterator fit = this->feeds.find(s_type->GetName());
+				if (fit != this->feeds.end() && fit->second->current)
+					fit->second->written.insert(obj->id);
 			}
 		}
 
@@ -155,7 +235,14 @@ class DBMySQL : public Module, public Pipe
 		if (s_type)
 		{
 			if (obj->id > 0)
+			{
 				this->RunQuery("DELETE FROM `" + this->prefix + s_type->GetName() + "` WHERE `id` = " + stringify(obj->id));
+
+				/* A poll in flight may still have the row, which would bring the object back */
+				std::map<Anope::string, ChangeFeed *>::iterator fit = this->feeds.find(s_type->GetName());
+				if (fit != this->feeds.end() && fit->second->current)
+					fit->second->written.insert(obj->id);
+			}
 			s_type->objects.erase(obj->id);
 		}
 		this->updated_items.erase(obj);
@@ -166,11 +253,36 @@ class DBMySQL : public Module, public Pipe
 		if (!this->CheckInit() || obj->GetTimestamp() == Anope::CurTime)
 			return;
 
+		ChangeFeed *&feed = this->feeds[obj->GetName()];
+		if (!feed)
+			feed = new ChangeFeed(this, obj->GetName());
+		/* Wait for the poll in flight, unless the provider seems to have lost it. If its
+		 * result does come back after all it is thrown away, as it is not the current poll.
+		 */
+		else if (feed->current && feed->current->started + 60 > Anope::CurTime)
+			return;
+
 		Query query("SELECT * FROM `" + this->prefix + obj->GetName() + "` WHERE (`timestamp` > " + this->SQL->FromUnixtime(obj->GetTimestamp()) + " OR `timestamp` IS NULL)");
 
-		obj->UpdateTimestamp();
+		/* The type's timestamp is only moved up to when the poll was started once it succeeds,
+		 * so the next poll after an error or a lost poll asks for the same rows again
+		 */
+		ChangePoll *poll = new ChangePoll(this, feed, Anope::CurTime);
+		feed->current = poll;
+		feed->polls.insert(poll);
+		feed->written.clear();
+		/* This may call back into ApplyChanges() immediately if the provider is not threaded */
+		this->SQL->Run(poll, query);
+	}
 
-		Result res = this->RunQueryResult(query);
+	/** Apply the rows changed by other instances
+	 * @param obj The type polled
+	 * @param feed The type's change feed
+	 * @param res The result of the poll
+	 */
+	void ApplyChanges(Serialize::Type *obj, ChangeFeed *feed, const Result &res)
+	{
+		Log(LOG_DEBUG) << "SQL-live got " << res.Rows() << " rows for " << res.finished_query;
 
 		bool clear_null = false;
 		for (int i = 0; i < res.Rows(); ++i)
@@ -188,12 +300,19 @@ class DBMySQL : public Module, public Pipe
 				continue;
 			}
 
-			if (res.Get(i, "timestamp").empty())
+			/* We wrote or deleted this object after the poll was started, so this row may be older than our copy */
+			if (feed->written.count(id))
+				continue;
+
+			std::map<uint64_t, Serializable *>::iterator oit = obj->objects.find(id);
+
+			/* Some providers leave NULL columns out of rows */
+			std::map<Anope::string, Anope::string>::const_iterator ts = row.find("timestamp");
+			if (ts == row.end() || ts->second.empty())
 			{
 				clear_null = true;
-				std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
-				if (it != obj->objects.end())
-					delete it->second; // This also removes this object from the map
+				if (oit != obj->objects.end())
+					delete oit->second; // This also removes this object from the map
 			}
 			else
 			{
@@ -202,10 +321,7 @@ class DBMySQL : public Module, public Pipe
 				for (std::map<Anope::string, Anope::string>::const_iterator it = row.begin(), it_end = row.end(); it != it_end; ++it)
 					data[it->first] << it->second;
 
-				Serializable *s = NULL;
-				std::map<uint64_t, Serializable *>::iterator it = obj->objects.find(id);
-				if (it != obj->objects.end())
-					s = it->second;
+				Serializable *s = oit != obj->objects.end() ? oit->second : NULL;
 
 				Serializable *new_s = obj->Unserialize(s, data);
 				if (new_s)
@@ -233,11 +349,8 @@ class DBMySQL : public Module, public Pipe
 			}
 		}
 
-		if (clear_null)
-		{
-			query = "DELETE FROM `" + this->prefix + obj->GetName() + "` WHERE `timestamp` IS NULL";
-			this->RunQuery(query);
-		}
+		if (clear_null && this->SQL)
+			this->SQL->Run(&this->sqlinterface, "DELETE FROM `" + this->prefix + obj->GetName() + "` WHERE `timestamp` IS NULL");
 	}
 
 	void OnSerializableUpdate(Serializable *obj) anope_override
@@ -250,5 +363,48 @@ class DBMySQL : public Module, public Pipe
 	}
 };
 
+ChangePoll::ChangePoll(DBMySQL *d, ChangeFeed *f, time_t s) : Interface(d), feed(f), started(s)
+{
+}
+
+void ChangePoll::OnResult(const Result &r)
+{
+	this->feed->polls.erase(this);
+
+	if (this->feed->current != this)
+	{
+		Log(LOG_DEBUG) << "SQL-live ignoring the result of an old poll for " << r.finished_query;
+		delete this;
+		return;
+	}
+
+	this->feed->current = NULL;
+
+	/* The type may have been unloaded while the poll was in flight */
+	Serialize::Type *t = Serialize::Type::Find(this->feed->type);
+	if (t)
+	{
+		this->feed->db->ApplyChanges(t, this->feed, r);
+		t->UpdateTimestamp(this->started);
+	}
+
+	this->feed->written.clear();
+	delete this;
+}
+
+void ChangePoll::OnError(const Result &r)
+{
+	this->feed->polls.erase(this);
+
+	if (this->feed->current == this)
+	{
+		this->feed->current = NULL;
+		this->feed->written.clear();
+	}
+
+	Log(LOG_DEBUG) << "SQL-live got error " << r.GetError() << " for " << r.finished_query;
+	delete this;
+}
+
 MODULE_INIT(DBMySQL)
 
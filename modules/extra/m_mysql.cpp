@@ -5,16 +5,30 @@
 #define NO_CLIENT_LONG_LONG
 #include <mysql/mysql.h>
 
+/* MySQL 8.0 removed my_bool, MariaDB's version numbers start at 10.0 and still have it */
+#if MYSQL_VERSION_ID >= 80000 && MYSQL_VERSION_ID < 100000
+typedef bool my_bool;
+#endif
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
 using namespace SQL;
 
 /** Non blocking threaded MySQL API, based loosely from InspIRCd's m_mysql.cpp
  *
- * This module spawns a single thread that is used to execute blocking MySQL queries.
- * When a module requests a query to be executed it is added to a list for the thread
- * (which never stops looping and sleeing) to pick up and execute, the result of which
- * is inserted in to another queue to be picked up by the main thread. The main thread
- * uses Pipe to become notified through the socket engine when there are results waiting
- * to be sent back to the modules requesting the query
+ * This module spawns a thread for each connection to the database which is used to execute blocking
+ * MySQL queries. When a module requests a query to be executed it is added to the list of one of the
+ * connections for its thread to pick up and execute, the result of which is inserted in to another queue
+ * to be picked up by the main thread. The main thread uses Pipe to become notified through the socket
+ * engine when there are results waiting, and sends back every waiting result to the modules requesting
+ * the queries at once.
+ *
+ * The queries of a module are executed in the order they are requested, a module's queries only go to
+ * a different connection once all of its earlier queries are done. If a service has more than one
+ * connection, the first only executes priority queries, such as authentication checks, so they are never
+ * stuck behind bulk writes.
  */
 
 class MySQLService;
@@ -27,10 +41,24 @@ struct QueryRequest
 	MySQLService *service;
 	/* The interface to use once we have the result to send the data back */
 	Interface *sqlinterface;
-	/* The actual query */
+	/* The module which queued the request */
+	Module *owner;
+	/* The actual query, or the last query of a transaction */
 	Query query;
+	/* The queries to run in one transaction, if this is a transaction */
+	std::vector<Query> transaction;
+	/* When the request was queued */
+	timeval queued;
+
+	QueryRequest(MySQLService *s, Interface *i, const Query &q) : service(s), sqlinterface(i), owner(i ? i->owner : NULL), query(q)
+	{
+		gettimeofday(&queued, NULL);
+	}
 
-	QueryRequest(MySQLService *s, Interface *i, const Query &q) : service(s), sqlinterface(i), query(q) { }
+	QueryRequest(MySQLService *s, Interface *i, const std::vector<Query> &t) : service(s), sqlinterface(i), owner(i ? i->owner : NULL), query(t.back()), transaction(t)
+	{
+		gettimeofday(&queued, NULL);
+	}
 };
 
 /** A query result */
@@ -85,6 +113,11 @@ class MySQLResult : public Result
 	{
 	}
 
+	void AddRow(const std::map<Anope::string, Anope::string> &data)
+	{
+		this->entries.push_back(data);
+	}
+
 	~MySQLResult()
 	{
 		if (this->res)
@@ -92,33 +125,113 @@ class MySQLResult : public Result
 	}
 };
 
-/** A MySQL connection, there can be multiple
+class MySQLService;
+
+/** A connection to a MySQL server, and the thread executing queries on it
  */
-class MySQLService : public Provider
+class MySQLConnection : public Thread, public Condition
 {
-	std::map<Anope::string, std::set<Anope::string> > active_schema;
-
-	Anope::string database;
-	Anope::string server;
-	Anope::string user;
-	Anope::string password;
-	int port;
+	MySQLService *service;
 
 	MYSQL *sql;
 
+	/* Prepared statements for queries with parameters */
+	StatementCache<MYSQL_STMT *> statements;
+
+	/* Queued requests, priority requests first */
+	std::deque<QueryRequest> requests;
+	/* Number of priority requests at the front of requests */
+	unsigned priority_requests;
+	/* Number of queued or executing requests of each module */
+	std::map<Module *, unsigned> owners;
+	/* Whether a request is executing, the module which queued it, and whether its result should be thrown away */
+	bool busy;
+	Module *executing;
+	bool cancelled;
+
 	/** Escape a query.
 	 * Note the mutex must be held!
 	 */
 	Anope::string Escape(const Anope::string &query);
 
+	/** Execute a query.
+	 * Note the mutex must be held!
+	 * @param check Whether to check the connection first
+	 */
+	Result Execute(const Query &query, bool check = true);
+
+	/** Execute a query as a prepared statement, preparing it if it is not cached.
+	 * Note the mutex must be held!
+	 * @param res Set to the result
+	 * @return false if the query can not be run as a prepared statement
+	 */
+	bool ExecutePrepared(const Query &query, Result &res);
+
  public:
-	/* Locked by the SQL thread when a query is pending on this database,
-	 * prevents us from deleting a connection while a query is executing
-	 * in the thread
+	/* Locked while a query is executing on this connection */
+	Mutex QueryLock;
+
+	MySQLConnection(MySQLService *s, unsigned cache);
+
+	~MySQLConnection();
+
+	void Connect();
+
+	bool CheckConnection();
+
+	Anope::string BuildQuery(const Query &q);
+
+	Result RunQuery(const Query &query);
+
+	/** Run queries in one transaction, without recording statistics */
+	Result Transact(const std::vector<Query> &queries);
+
+	/** Queue a request to be executed by this connection's thread */
+	void Queue(const QueryRequest &r);
+
+	/** Get how busy this connection is
+	 * @param owner A module
+	 * @param owned Set to whether the module has requests queued or executing on this connection
+	 * @return The number of queued or executing requests
 	 */
-	Mutex Lock;
+	size_t GetLoad(Module *owner, bool &owned);
+
+	/** Get the number of queued queries */
+	size_t GetQueueSize();
 
-	MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po);
+	/** Drop the requests of a module which is being unloaded */
+	void Cancel(Module *m);
+
+	/** Fail every queued request, the connection is going away */
+	void Abort();
+
+	void Run() anope_override;
+};
+
+/** A MySQL service, there can be multiple, each with one or more connections
+ */
+class MySQLService : public Provider
+{
+	std::map<Anope::string, std::set<Anope::string> > active_schema;
+
+	std::vector<MySQLConnection *> connections;
+
+	/* Transaction statistics */
+	Mutex StatsLock;
+	uint64_t commits, rollbacks;
+	double commit_time;
+
+	/** Pick the connection to execute a request on and queue it */
+	void Queue(const QueryRequest &r);
+
+ public:
+	const Anope::string database;
+	const Anope::string server;
+	const Anope::string user;
+	const Anope::string password;
+	const int port;
+
+	MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po, unsigned c, unsigned cache);
 
 	~MySQLService();
 
@@ -126,29 +239,29 @@ class MySQLService : public Provider
 
 	Result RunQuery(const Query &query) anope_override;
 
-	std::vector<Query> CreateTable(const Anope::string &table, const Data &data) anope_override;
+	void RunTransaction(Interface *i, const std::vector<Query> &queries) anope_override;
 
-	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) anope_override;
+	Result RunTransactionQuery(const std::vector<Query> &queries) anope_override;
 
-	Query GetTables(const Anope::string &prefix) anope_override;
+	/** Record a finished transaction */
+	void AddTransaction(bool committed, const timeval &queued);
 
-	void Connect();
+	std::vector<Query> CreateTable(const Anope::string &table, const Data &data) anope_override;
 
-	bool CheckConnection();
+	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data) anope_override;
 
-	Anope::string BuildQuery(const Query &q);
+	Query BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows) anope_override;
+
+	Query GetTables(const Anope::string &prefix) anope_override;
 
 	Anope::string FromUnixtime(time_t);
-};
 
-/** The SQL thread used to execute queries
- */
-class DispatcherThread : public Thread, public Condition
-{
- public:
-	DispatcherThread() : Thread() { }
+	size_t GetQueueSize() anope_override;
 
-	void Run() anope_override;
+	void GetTransactionStats(uint64_t &c, uint64_t &r, double &seconds) anope_override;
+
+	/** Drop the requests of a module which is being unloaded */
+	void Cancel(Module *m);
 };
 
 class ModuleSQL;
@@ -157,21 +270,14 @@ class ModuleSQL : public Module, public Pipe
 {
 	/* SQL connections */
 	std::map<Anope::string, MySQLService *> MySQLServices;
- public:
-	/* Pending query requests */
-	std::deque<QueryRequest> QueryRequests;
+
 	/* Pending finished requests with results */
 	std::deque<QueryResult> FinishedRequests;
-	/* The thread used to execute queries */
-	DispatcherThread *DThread;
-
+	Mutex FinishedLock;
+ public:
 	ModuleSQL(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
 	{
 		me = this;
-
-
-		DThread = new DispatcherThread();
-		DThread->Start();
 	}
 
 	~ModuleSQL()
@@ -179,11 +285,6 @@ class ModuleSQL : public Module, public Pipe
 		for (std::map<Anope::string, MySQLService *>::iterator it = this->MySQLServices.begin(); it != this->MySQLServices.end(); ++it)
 			delete it->second;
 		MySQLServices.clear();
-
-		DThread->SetExitState();
-		DThread->Wakeup();
-		DThread->Join();
-		delete DThread;
 	}
 
 	void OnReload(Configuration::Conf *conf) anope_override
@@ -223,10 +324,12 @@ class ModuleSQL : public Module, public Pipe
 				const Anope::string &user = block->Get<const Anope::string>("username", "anope");
 				const Anope::string &password = block->Get<const Anope::string>("password");
 				int port = block->Get<int>("port", "3306");
+				unsigned connections = block->Get<unsigned>("connections", "1");
+				unsigned cache = block->Get<unsigned>("statementcache", "32");
 
 				try
 				{
-					MySQLService *ss = new MySQLService(this, connname, database, server, user, password, port);
+					MySQLService *ss = new MySQLService(this, connname, database, server, user, password, port, connections, cache);
 					this->MySQLServices.insert(std::make_pair(connname, ss));
 
 					Log(LOG_NORMAL, "mysql") << "MySQL: Successfully connected to server " << connname << " (" << server << ")";
@@ -241,35 +344,33 @@ class ModuleSQL : public Module, public Pipe
 
 	void OnModuleUnload(User *, Module *m) anope_override
 	{
-		this->DThread->Lock();
-
-		for (unsigned i = this->QueryRequests.size(); i > 0; --i)
-		{
-			QueryRequest &r = this->QueryRequests[i - 1];
-
-			if (r.sqlinterface && r.sqlinterface->owner == m)
-			{
-				if (i == 1)
-				{
-					r.service->Lock.Lock();
-					r.service->Lock.Unlock();
-				}
-
-				this->QueryRequests.erase(this->QueryRequests.begin() + i - 1);
-			}
-		}
-
-		this->DThread->Unlock();
+		for (std::map<Anope::string, MySQLService *>::iterator it = this->MySQLServices.begin(); it != this->MySQLServices.end(); ++it)
+			it->second->Cancel(m);
 
 		this->OnNotify();
 	}
 
+	/** Queue a result for the main thread, called from the connection threads
+	 */
+	void AddResult(const QueryResult &qr)
+	{
+		this->FinishedLock.Lock();
+		/* The main thread takes every waiting result at once, so it only needs waking for the first */
+		bool notify = this->FinishedRequests.empty();
+		this->FinishedRequests.push_back(qr);
+		this->FinishedLock.Unlock();
+
+		if (notify)
+			this->Notify();
+	}
+
 	void OnNotify() anope_override
 	{
-		this->DThread->Lock();
-		std::deque<QueryResult> finishedRequests = this->FinishedRequests;
-		this->FinishedRequests.clear();
-		this->DThread->Unlock();
+		std::deque<QueryResult> finishedRequests;
+
+		this->FinishedLock.Lock();
+		finishedRequests.swap(this->FinishedRequests);
+		this->FinishedLock.Unlock();
 
 		for (std::deque<QueryResult>::const_iterator it = finishedRequests.begin(), it_end = finishedRequests.end(); it != it_end; ++it)
 		{
@@ -286,71 +387,149 @@ class ModuleSQL : public Module, public Pipe
 	}
 };
 
-MySQLService::MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po)
-: Provider(o, n), database(d), server(s), user(u), password(p), port(po), sql(NULL)
+MySQLService::MySQLService(Module *o, const Anope::string &n, const Anope::string &d, const Anope::string &s, const Anope::string &u, const Anope::string &p, int po, unsigned c, unsigned cache)
+: Provider(o, n), commits(0), rollbacks(0), commit_time(0), database(d), server(s), user(u), password(p), port(po)
 {
-	Connect();
+	if (c < 1)
+		c = 1;
+
+	try
+	{
+		for (unsigned i = 0; i < c; ++i)
+		{
+			this->connections.push_back(new MySQLConnection(this, cache));
+			this->connections.back()->Connect();
+		}
+	}
+	catch (const SQL::Exception &)
+	{
+		for (unsigned i = 0; i < this->connections.size(); ++i)
+			delete this->connections[i];
+		throw;
+	}
+
+	for (unsigned i = 0; i < this->connections.size(); ++i)
+		this->connections[i]->Start();
 }
 
 MySQLService::~MySQLService()
 {
-	me->DThread->Lock();
-	this->Lock.Lock();
-	mysql_close(this->sql);
-	this->sql = NULL;
+	for (unsigned i = 0; i < this->connections.size(); ++i)
+	{
+		MySQLConnection *conn = this->connections[i];
+
+		conn->Lock();
+		conn->SetExitState();
+		conn->Wakeup();
+		conn->Unlock();
+		conn->Join();
+
+		conn->Abort();
+		delete conn;
+	}
+}
+
+void MySQLService::Queue(const QueryRequest &r)
+{
+	/* The first connection is kept for priority queries if there are others */
+	if (r.query.priority || this->connections.size() == 1)
+	{
+		this->connections[0]->Queue(r);
+		return;
+	}
+
+	MySQLConnection *best = NULL;
+	size_t best_load = 0;
 
-	for (unsigned i = me->QueryRequests.size(); i > 0; --i)
+	for (unsigned i = 1; i < this->connections.size(); ++i)
 	{
-		QueryRequest &r = me->QueryRequests[i - 1];
+		bool owned;
+		size_t load = this->connections[i]->GetLoad(r.owner, owned);
+
+		/* Keep the queries of a module in order */
+		if (owned)
+		{
+			best = this->connections[i];
+			break;
+		}
 
-		if (r.service == this)
+		if (!best || load < best_load)
 		{
-			if (r.sqlinterface)
-				r.sqlinterface->OnError(Result(0, r.query, "SQL Interface is going away"));
-			me->QueryRequests.erase(me->QueryRequests.begin() + i - 1);
+			best = this->connections[i];
+			best_load = load;
 		}
 	}
-	this->Lock.Unlock();
-	me->DThread->Unlock();
+
+	best->Queue(r);
 }
 
 void MySQLService::Run(Interface *i, const Query &query)
 {
-	me->DThread->Lock();
-	me->QueryRequests.push_back(QueryRequest(this, i, query));
-	me->DThread->Unlock();
-	me->DThread->Wakeup();
+	this->Queue(QueryRequest(this, i, query));
 }
 
-Result MySQLService::RunQuery(const Query &query)
+void MySQLService::RunTransaction(Interface *i, const std::vector<Query> &queries)
 {
-	this->Lock.Lock();
+	if (queries.empty())
+		return;
 
-	Anope::string real_query = this->BuildQuery(query);
+	this->Queue(QueryRequest(this, i, queries));
+}
 
-	if (this->CheckConnection() && !mysql_real_query(this->sql, real_query.c_str(), real_query.length()))
-	{
-		MYSQL_RES *res = mysql_store_result(this->sql);
-		unsigned int id = mysql_insert_id(this->sql);
+size_t MySQLService::GetQueueSize()
+{
+	size_t count = 0;
+	for (unsigned i = 0; i < this->connections.size(); ++i)
+		count += this->connections[i]->GetQueueSize();
+	return count;
+}
 
-		/* because we enabled CLIENT_MULTI_RESULTS in our options
-		 * a multiple statement or a procedure call can return
-		 * multiple result sets.
-		 * we must process them all before the next query.
-		 */
+void MySQLService::GetTransactionStats(uint64_t &c, uint64_t &r, double &seconds)
+{
+	this->StatsLock.Lock();
+	c = this->commits;
+	r = this->rollbacks;
+	seconds = this->commit_time;
+	this->StatsLock.Unlock();
+}
 
-		while (!mysql_next_result(this->sql))
-			mysql_free_result(mysql_store_result(this->sql));
+void MySQLService::AddTransaction(bool committed, const timeval &queued)
+{
+	timeval now;
+	gettimeofday(&now, NULL);
 
-		this->Lock.Unlock();
-		return MySQLResult(id, query, real_query, res);
-	}
-	else
+	this->StatsLock.Lock();
+	if (committed)
 	{
-		Anope::string error = mysql_error(this->sql);
-		this->Lock.Unlock();
-		return MySQLResult(query, real_query, error);
+		++this->commits;
+		this->commit_time += (now.tv_sec - queued.tv_sec) + (now.tv_usec - queued.tv_usec) / 1000000.0;
 	}
+	else
+		++this->rollbacks;
+	this->StatsLock.Unlock();
+}
+
+void MySQLService::Cancel(Module *m)
+{
+	for (unsigned i = 0; i < this->connections.size(); ++i)
+		this->connections[i]->Cancel(m);
+}
+
+Result MySQLService::RunQuery(const Query &query)
+{
+	/* Queries which are waited on use the first connection, which is the least busy */
+	return this->connections[0]->RunQuery(query);
+}
+
+Result MySQLService::RunTransactionQuery(const std::vector<Query> &queries)
+{
+	timeval queued;
+	gettimeofday(&queued, NULL);
+
+	Result res = this->connections[0]->Transact(queries);
+	this->AddTransaction(res, queued);
+
+	return res;
 }
 
 std::vector<Query> MySQLService::CreateTable(const Anope::string &table, const Data &data)
@@ -439,28 +618,96 @@ Query MySQLService::BuildInsert(const Anope::string &table, unsigned int id, Dat
 	return query;
 }
 
+Query MySQLService::BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows)
+{
+	/* Every row has to have the same columns, so empty any column a row does not have */
+	std::set<Anope::string> columns = this->active_schema[table];
+	columns.erase("id");
+	columns.erase("timestamp");
+	for (std::map<unsigned int, Data *>::const_iterator it = rows.begin(), it_end = rows.end(); it != it_end; ++it)
+		for (Data::Map::const_iterator dit = it->second->data.begin(), dit_end = it->second->data.end(); dit != dit_end; ++dit)
+			columns.insert(dit->first);
+
+	Anope::string query_text = "INSERT INTO `" + table + "` (`id`";
+	for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		query_text += ",`" + *it + "`";
+	query_text += ") VALUES ";
+
+	Query query;
+	unsigned row = 0;
+	for (std::map<unsigned int, Data *>::const_iterator it = rows.begin(), it_end = rows.end(); it != it_end; ++it, ++row)
+	{
+		const Anope::string prefix = stringify(row) + ".";
+
+		query_text += (row ? ",(" : "(") + stringify(it->first);
+		for (std::set<Anope::string>::iterator cit = columns.begin(), cit_end = columns.end(); cit != cit_end; ++cit)
+		{
+			Anope::string buf;
+			Data::Map::const_iterator dit = it->second->data.find(*cit);
+			if (dit != it->second->data.end())
+				*dit->second >> buf;
+
+			query_text += ",@" + prefix + *cit + "@";
+			query.SetValue(prefix + *cit, buf);
+		}
+		query_text += ")";
+	}
+
+	query_text += " ON DUPLICATE KEY UPDATE ";
+	for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		query_text += "`" + *it + "`=VALUES(`" + *it + "`),";
+	query_text.erase(query_text.end() - 1);
+
+	query.query = query_text;
+	return query;
+}
+
 Query MySQLService::GetTables(const Anope::string &prefix)
 {
 	return Query("SHOW TABLES LIKE '" + prefix + "%';");
 }
 
-void MySQLService::Connect()
+Anope::string MySQLService::FromUnixtime(time_t t)
 {
+	return "FROM_UNIXTIME(" + stringify(t) + ")";
+}
+
+MySQLConnection::MySQLConnection(MySQLService *s, unsigned cache) : service(s), sql(NULL), statements(cache), priority_requests(0), busy(false), executing(NULL), cancelled(false)
+{
+}
+
+MySQLConnection::~MySQLConnection()
+{
+	std::vector<MYSQL_STMT *> stmts = this->statements.Clear();
+	for (unsigned i = 0; i < stmts.size(); ++i)
+		mysql_stmt_close(stmts[i]);
+
+	if (this->sql)
+		mysql_close(this->sql);
+}
+
+void MySQLConnection::Connect()
+{
+	/* Prepared statements do not survive reconnecting */
+	std::vector<MYSQL_STMT *> stmts = this->statements.Clear();
+	for (unsigned i = 0; i < stmts.size(); ++i)
+		mysql_stmt_close(stmts[i]);
+
 	this->sql = mysql_init(this->sql);
 
 	const unsigned int timeout = 1;
 	mysql_options(this->sql, MYSQL_OPT_CONNECT_TIMEOUT, reinterpret_cast<const char *>(&timeout));
 
-	bool connect = mysql_real_connect(this->sql, this->server.c_str(), this->user.c_str(), this->password.c_str(), this->database.c_str(), this->port, NULL, CLIENT_MULTI_RESULTS);
+	bool connect = mysql_real_connect(this->sql, service->server.c_str(), service->user.c_str(), service->password.c_str(), service->database.c_str(), service->port, NULL, CLIENT_MULTI_RESULTS);
 
 	if (!connect)
-		throw SQL::Exception("Unable to connect to MySQL service " + this->name + ": " + mysql_error(this->sql));
+		throw SQL::Exception("Unable to connect to MySQL service " + service->name + ": " + mysql_error(this->sql));
 	
-	Log(LOG_DEBUG) << "Successfully connected to MySQL service " << this->name << " at " << this->server << ":" << this->port;
+	Log(LOG_DEBUG) << "Successfully connected to MySQL service " << service->name << " at " << service->server << ":" << service->port;
 }
 
 
-bool MySQLService::CheckConnection()
+bool MySQLConnection::CheckConnection()
 {
 	if (!this->sql || mysql_ping(this->sql))
 	{
@@ -477,59 +724,331 @@ bool MySQLService::CheckConnection()
 	return true;
 }
 
-Anope::string MySQLService::Escape(const Anope::string &query)
+Anope::string MySQLConnection::Escape(const Anope::string &query)
 {
 	std::vector<char> buffer(query.length() * 2 + 1);
 	mysql_real_escape_string(this->sql, &buffer[0], query.c_str(), query.length());
 	return &buffer[0];
 }
 
-Anope::string MySQLService::BuildQuery(const Query &q)
+Anope::string MySQLConnection::BuildQuery(const Query &q)
 {
-	Anope::string real_query = q.query;
+	/* Substitute every @parameter@ in one pass, as batched inserts have thousands of them */
+	Anope::string real_query;
+	size_t last = 0;
+
+	for (size_t start; (start = q.query.find('@', last)) != Anope::string::npos;)
+	{
+		size_t end = q.query.find('@', start + 1);
+		if (end == Anope::string::npos)
+			break;
 
-	for (std::map<Anope::string, QueryData>::const_iterator it = q.parameters.begin(), it_end = q.parameters.end(); it != it_end; ++it)
-		real_query = real_query.replace_all_cs("@" + it->first + "@", (it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data));
+		std::map<Anope::string, QueryData>::const_iterator it = q.parameters.find(q.query.substr(start + 1, end - start - 1));
+		if (it == q.parameters.end())
+		{
+			/* Not a parameter, the closing @ may open one */
+			real_query += q.query.substr(last, end - last);
+			last = end;
+			continue;
+		}
 
+		real_query += q.query.substr(last, start - last);
+		real_query += it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data;
+		last = end + 1;
+	}
+
+	real_query += q.query.substr(last);
 	return real_query;
 }
 
-Anope::string MySQLService::FromUnixtime(time_t t)
+Result MySQLConnection::RunQuery(const Query &query)
 {
-	return "FROM_UNIXTIME(" + stringify(t) + ")";
+	this->QueryLock.Lock();
+	Result res = this->Execute(query);
+	this->QueryLock.Unlock();
+	return res;
 }
 
-void DispatcherThread::Run()
+Result MySQLConnection::Transact(const std::vector<Query> &queries)
 {
-	this->Lock();
+	this->QueryLock.Lock();
 
-	while (!this->GetExitState())
+	/* Only check the connection once, reconnecting part way through would lose the transaction */
+	Result res = this->Execute(Query("START TRANSACTION"));
+	for (unsigned i = 0; res && i < queries.size(); ++i)
+		res = this->Execute(queries[i], false);
+
+	if (res)
 	{
-		if (!me->QueryRequests.empty())
+		Result commit = this->Execute(Query("COMMIT"), false);
+		if (!commit)
+			res = commit;
+	}
+	else
+		this->Execute(Query("ROLLBACK"), false);
+
+	this->QueryLock.Unlock();
+	return res;
+}
+
+Result MySQLConnection::Execute(const Query &query, bool check)
+{
+	if (check && !this->CheckConnection())
+		return MySQLResult(query, query.query, mysql_error(this->sql));
+
+	Result prepared;
+	if (this->ExecutePrepared(query, prepared))
+		return prepared;
+
+	Anope::string real_query = this->BuildQuery(query);
+
+	if (!mysql_real_query(this->sql, real_query.c_str(), real_query.length()))
+	{
+		MYSQL_RES *res = mysql_store_result(this->sql);
+		unsigned int id = mysql_insert_id(this->sql);
+
+		/* because we enabled CLIENT_MULTI_RESULTS in our options
+		 * a multiple statement or a procedure call can return
+		 * multiple result sets.
+		 * we must process them all before the next query.
+		 */
+
+		while (!mysql_next_result(this->sql))
+			mysql_free_result(mysql_store_result(this->sql));
+
+		return MySQLResult(id, query, real_query, res);
+	}
+	else
+		return MySQLResult(query, real_query, mysql_error(this->sql));
+}
+
+bool MySQLConnection::ExecutePrepared(const Query &query, Result &res)
+{
+	if (!this->statements.max || query.parameters.empty())
+		return false;
+
+	std::vector<Anope::string> values;
+	Anope::string statement = query.Prepare(values);
+	if (values.empty())
+		return false;
+
+	MYSQL_STMT *stmt = this->statements.Find(statement);
+	if (!stmt)
+	{
+		stmt = mysql_stmt_init(this->sql);
+		if (!stmt)
+			return false;
+
+		/* Some statements can not be prepared, build those instead */
+		if (mysql_stmt_prepare(stmt, statement.c_str(), statement.length()) || mysql_stmt_param_count(stmt) != values.size())
 		{
-			QueryRequest &r = me->QueryRequests.front();
-			this->Unlock();
+			mysql_stmt_close(stmt);
+			return false;
+		}
+
+		MYSQL_STMT *evicted;
+		this->statements.Add(statement, stmt, evicted);
+		if (evicted)
+			mysql_stmt_close(evicted);
+	}
+
+	/* Every parameter is sent as a string, and converted by the server as needed */
+	std::vector<MYSQL_BIND> params(values.size());
+	std::vector<unsigned long> lengths(values.size());
+	for (unsigned i = 0; i < values.size(); ++i)
+	{
+		memset(&params[i], 0, sizeof(params[i]));
+		lengths[i] = values[i].length();
+		params[i].buffer_type = MYSQL_TYPE_STRING;
+		params[i].buffer = const_cast<char *>(values[i].c_str());
+		params[i].buffer_length = lengths[i];
+		params[i].length = &lengths[i];
+	}
+
+	if (mysql_stmt_bind_param(stmt, &params[0]) || mysql_stmt_execute(stmt))
+	{
+		res = MySQLResult(query, this->BuildQuery(query), mysql_stmt_error(stmt));
+		mysql_stmt_reset(stmt);
+		return true;
+	}
 
-			Result sresult = r.service->RunQuery(r.query);
+	MySQLResult result(mysql_stmt_insert_id(stmt), query, statement, NULL);
 
-			this->Lock();
-			if (!me->QueryRequests.empty() && me->QueryRequests.front().query == r.query)
+	MYSQL_RES *meta = mysql_stmt_result_metadata(stmt);
+	if (meta)
+	{
+		unsigned num_fields = mysql_num_fields(meta);
+		MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+
+		/* Columns are fetched in to a small buffer, longer ones are fetched again once their length is known */
+		std::vector<MYSQL_BIND> columns(num_fields);
+		std::vector<unsigned long> column_lengths(num_fields);
+		/* Not a vector, as where my_bool is bool that is a std::vector<bool>, whose elements can't be pointed to */
+		my_bool *nulls = new my_bool[num_fields]();
+		std::vector<char> buffer(num_fields * 256);
+		for (unsigned i = 0; i < num_fields; ++i)
+		{
+			memset(&columns[i], 0, sizeof(columns[i]));
+			columns[i].buffer_type = MYSQL_TYPE_STRING;
+			columns[i].buffer = &buffer[i * 256];
+			columns[i].buffer_length = 256;
+			columns[i].length = &column_lengths[i];
+			columns[i].is_null = &nulls[i];
+		}
+
+		if (num_fields && !mysql_stmt_bind_result(stmt, &columns[0]))
+		{
+			for (int fetch; (fetch = mysql_stmt_fetch(stmt)) == 0 || fetch == MYSQL_DATA_TRUNCATED;)
 			{
-				if (r.sqlinterface)
-					me->FinishedRequests.push_back(QueryResult(r.sqlinterface, sresult));
-				me->QueryRequests.pop_front();
+				std::map<Anope::string, Anope::string> items;
+
+				for (unsigned i = 0; i < num_fields; ++i)
+				{
+					Anope::string column = (fields[i].name ? fields[i].name : "");
+					Anope::string data;
+
+					if (!nulls[i] && column_lengths[i] <= 256)
+						data = Anope::string(&buffer[i * 256], column_lengths[i]);
+					else if (!nulls[i])
+					{
+						std::vector<char> longer(column_lengths[i]);
+						MYSQL_BIND bind;
+						memset(&bind, 0, sizeof(bind));
+						bind.buffer_type = MYSQL_TYPE_STRING;
+						bind.buffer = &longer[0];
+						bind.buffer_length = longer.size();
+						if (!mysql_stmt_fetch_column(stmt, &bind, i, 0))
+							data = Anope::string(&longer[0], longer.size());
+					}
+
+					items[column] = data;
+				}
+
+				result.AddRow(items);
 			}
 		}
-		else
+
+		delete [] nulls;
+		mysql_free_result(meta);
+	}
+
+	/* Stored procedures return more than one result set */
+	do
+		mysql_stmt_free_result(stmt);
+	while (!mysql_stmt_next_result(stmt));
+
+	res = result;
+	return true;
+}
+
+void MySQLConnection::Queue(const QueryRequest &r)
+{
+	this->Lock();
+	if (r.query.priority)
+		this->requests.insert(this->requests.begin() + this->priority_requests++, r);
+	else
+		this->requests.push_back(r);
+	++this->owners[r.owner];
+	this->Unlock();
+	this->Wakeup();
+}
+
+size_t MySQLConnection::GetLoad(Module *owner, bool &owned)
+{
+	this->Lock();
+	owned = this->owners.count(owner) > 0;
+	size_t load = this->requests.size() + this->busy;
+	this->Unlock();
+	return load;
+}
+
+size_t MySQLConnection::GetQueueSize()
+{
+	size_t count = 0;
+
+	this->Lock();
+	for (unsigned i = 0; i < this->requests.size(); ++i)
+		count += this->requests[i].transaction.empty() ? 1 : this->requests[i].transaction.size();
+	this->Unlock();
+
+	return count;
+}
+
+void MySQLConnection::Cancel(Module *m)
+{
+	this->Lock();
+
+	for (unsigned i = this->requests.size(); i > 0; --i)
+	{
+		QueryRequest &r = this->requests[i - 1];
+
+		if (r.owner == m)
+		{
+			if (i <= this->priority_requests)
+				--this->priority_requests;
+			if (!--this->owners[r.owner])
+				this->owners.erase(r.owner);
+			this->requests.erase(this->requests.begin() + i - 1);
+		}
+	}
+
+	/* The interface of the executing request may be gone by the time it is done */
+	if (this->busy && this->executing == m)
+		this->cancelled = true;
+
+	this->Unlock();
+}
+
+void MySQLConnection::Abort()
+{
+	this->Lock();
+	for (unsigned i = 0; i < this->requests.size(); ++i)
+	{
+		QueryRequest &r = this->requests[i];
+		if (r.sqlinterface)
+			r.sqlinterface->OnError(Result(0, r.query, "SQL Interface is going away"));
+	}
+	this->requests.clear();
+	this->priority_requests = 0;
+	this->owners.clear();
+	this->Unlock();
+}
+
+void MySQLConnection::Run()
+{
+	this->Lock();
+
+	while (!this->GetExitState())
+	{
+		if (this->requests.empty())
 		{
-			if (!me->FinishedRequests.empty())
-				me->Notify();
 			this->Wait();
+			continue;
 		}
+
+		QueryRequest r = this->requests.front();
+		this->requests.pop_front();
+		if (this->priority_requests)
+			--this->priority_requests;
+		this->busy = true;
+		this->executing = r.owner;
+		this->cancelled = false;
+		this->Unlock();
+
+		Result sresult = r.transaction.empty() ? this->RunQuery(r.query) : this->Transact(r.transaction);
+		if (!r.transaction.empty())
+			this->service->AddTransaction(sresult, r.queued);
+
+		this->Lock();
+		if (r.sqlinterface && !this->cancelled)
+			me->AddResult(QueryResult(r.sqlinterface, sresult));
+		if (!--this->owners[r.owner])
+			this->owners.erase(r.owner);
+		this->busy = false;
+		this->executing = NULL;
 	}
 
 	this->Unlock();
 }
 
 MODULE_INIT(ModuleSQL)
-
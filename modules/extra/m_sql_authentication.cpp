@@ -117,6 +117,7 @@ class ModuleSQLAuthentication : public Module
 		}
 
 		SQL::Query q(this->query);
+		q.priority = true;
 		q.SetValue("a", req->GetAccount());
 		q.SetValue("p", req->GetPassword());
 		if (u)
@@ -134,6 +134,7 @@ class ModuleSQLOper : public Module
 		}
 
 		SQL::Query q(this->query);
+		q.priority = true;
 		q.SetValue("a", u->Account()->display);
 		q.SetValue("i", u->ip);
 
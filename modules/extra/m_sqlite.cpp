@@ -4,10 +4,58 @@
 #include "modules/sql.h"
 #include <sqlite3.h>
 
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
 using namespace SQL;
 
 /* SQLite3 API, based from InspiRCd */
 
+/** Every database is opened twice in WAL mode. Queries run with RunQuery, which
+ * the caller waits on, are run by the main thread on one connection, and queries
+ * run with Run are queued for a writer thread which has the other connection. The
+ * writer thread runs every query queued since it last looked in one transaction,
+ * so a burst of writes is committed at once instead of syncing the database
+ * for each, and the main thread is woken through a pipe to send back the results.
+ * RunQuery only waits for the writer if a table it uses has writes queued.
+ */
+
+class SQLiteService;
+
+/** A query request
+ */
+struct QueryRequest
+{
+	/* The interface to use once we have the result to send the data back */
+	Interface *sqlinterface;
+	/* The module which queued the request */
+	Module *owner;
+	/* The actual query, or the last query of a transaction */
+	Query query;
+	/* The queries to run in one transaction, if this is a transaction */
+	std::vector<Query> transaction;
+	/* When the request was queued */
+	timeval queued;
+	/* The tables the request uses */
+	std::set<Anope::string> tables;
+
+	QueryRequest(Interface *i, const Query &q);
+
+	QueryRequest(Interface *i, const std::vector<Query> &t);
+};
+
+/** A query result */
+struct QueryResult
+{
+	/* The interface to send the data back on */
+	Interface *sqlinterface;
+	/* The result */
+	Result result;
+
+	QueryResult(Interface *i, const Result &r) : sqlinterface(i), result(r) { }
+};
+
 /** A SQLite result
  */
 class SQLiteResult : public Result
@@ -27,6 +75,85 @@ class SQLiteResult : public Result
 	}
 };
 
+/** A connection to a SQLite database, only used by one thread
+ */
+class SQLiteConnection
+{
+	sqlite3 *sql;
+
+	/* Prepared statements for queries with parameters */
+	StatementCache<sqlite3_stmt *> statements;
+
+	Anope::string Escape(const Anope::string &query);
+
+ public:
+	SQLiteConnection(const Anope::string &database, unsigned cache);
+
+	~SQLiteConnection();
+
+	Result RunQuery(const Query &query);
+
+	/** Whether a transaction is open on this connection */
+	bool InTransaction();
+
+	Anope::string BuildQuery(const Query &q);
+};
+
+/** The thread writing to a SQLite database
+ */
+class SQLiteWriter : public Thread, public Condition
+{
+	SQLiteService *service;
+
+	SQLiteConnection *conn;
+
+	/* Queued requests */
+	std::deque<QueryRequest> requests;
+	/* Whether queries are executing */
+	bool busy;
+	/* Modules unloaded while queries are executing, whose results should be thrown away */
+	std::set<Module *> cancelled;
+	/* How many queued or executing requests use each table */
+	std::map<Anope::string, unsigned> pending_tables;
+
+	/** Count a request's tables as pending, or not, must be locked */
+	void AddPending(const QueryRequest &r);
+	void DelPending(const QueryRequest &r);
+
+	/** Run requests in one transaction
+	 * @return The results, in the same order
+	 */
+	std::vector<Result> RunGroup(const std::deque<QueryRequest> &group);
+
+ public:
+	/* Locked to wait for the queue to be empty */
+	Condition Drained;
+	/* Whether the queue is empty and no queries are executing, locked by Drained */
+	bool idle;
+
+	SQLiteWriter(SQLiteService *s, SQLiteConnection *c);
+
+	~SQLiteWriter();
+
+	void Queue(const QueryRequest &r);
+
+	/** Wait for every queued query to be done */
+	void Flush();
+
+	/** Check whether queued queries use any of the given tables
+	 * @param tables The tables, in lower case
+	 */
+	bool HasPending(const std::set<Anope::string> &tables);
+
+	/** Get the number of queued queries */
+	size_t GetQueueSize();
+
+	/** Drop the requests of a module which is being unloaded */
+	void Cancel(Module *m);
+
+	void Run() anope_override;
+};
+
 /** A SQLite database, there can be multiple
  */
 class SQLiteService : public Provider
@@ -35,12 +162,18 @@ class SQLiteService : public Provider
 
 	Anope::string database;
 
-	sqlite3 *sql;
+	/* The main thread's connection */
+	SQLiteConnection *reader;
 
-	Anope::string Escape(const Anope::string &query);
+	SQLiteWriter *writer;
+
+	/* Transaction statistics */
+	Mutex StatsLock;
+	uint64_t commits, rollbacks;
+	double commit_time;
 
  public:
-	SQLiteService(Module *o, const Anope::string &n, const Anope::string &d);
+	SQLiteService(Module *o, const Anope::string &n, const Anope::string &d, unsigned cache);
 
 	~SQLiteService();
 
@@ -48,24 +181,45 @@ class SQLiteService : public Provider
 
 	Result RunQuery(const Query &query);
 
+	void RunTransaction(Interface *i, const std::vector<Query> &queries) anope_override;
+
+	Result RunTransactionQuery(const std::vector<Query> &queries) anope_override;
+
+	/** Record a finished transaction */
+	void AddTransaction(bool committed, const timeval &queued);
+
 	std::vector<Query> CreateTable(const Anope::string &table, const Data &data) anope_override;
 
 	Query BuildInsert(const Anope::string &table, unsigned int id, Data &data);
 
-	Query GetTables(const Anope::string &prefix);
+	Query BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows) anope_override;
 
-	Anope::string BuildQuery(const Query &q);
+	Query GetTables(const Anope::string &prefix);
 
 	Anope::string FromUnixtime(time_t);
+
+	size_t GetQueueSize() anope_override;
+
+	void GetTransactionStats(uint64_t &c, uint64_t &r, double &seconds) anope_override;
+
+	/** Drop the requests of a module which is being unloaded */
+	void Cancel(Module *m);
 };
 
-class ModuleSQLite : public Module
+class ModuleSQLite;
+static ModuleSQLite *me;
+class ModuleSQLite : public Module, public Pipe
 {
 	/* SQL connections */
 	std::map<Anope::string, SQLiteService *> SQLiteServices;
+
+	/* Pending finished requests with results */
+	std::deque<QueryResult> FinishedRequests;
+	Mutex FinishedLock;
  public:
 	ModuleSQLite(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
 	{
+		me = this;
 	}
 
 	~ModuleSQLite()
@@ -107,10 +261,11 @@ class ModuleSQLite : public Module
 			if (this->SQLiteServices.find(connname) == this->SQLiteServices.end())
 			{
 				Anope::string database = Anope::DataDir + "/" + block->Get<const Anope::string>("database", "anope");
+				unsigned cache = block->Get<unsigned>("statementcache", "32");
 
 				try
 				{
-					SQLiteService *ss = new SQLiteService(this, connname, database);
+					SQLiteService *ss = new SQLiteService(this, connname, database, cache);
 					this->SQLiteServices[connname] = ss;
 
 					Log(LOG_NORMAL, "sqlite") << "SQLite: Successfully added database " << database;
@@ -122,67 +277,200 @@ class ModuleSQLite : public Module
 			}
 		}
 	}
+
+	void OnModuleUnload(User *, Module *m) anope_override
+	{
+		for (std::map<Anope::string, SQLiteService *>::iterator it = this->SQLiteServices.begin(); it != this->SQLiteServices.end(); ++it)
+			it->second->Cancel(m);
+
+		this->OnNotify();
+	}
+
+	/** Queue a result for the main thread, called from the writer threads
+	 */
+	void AddResult(const QueryResult &qr)
+	{
+		this->FinishedLock.Lock();
+		/* The main thread takes every waiting result at once, so it only needs waking for the first */
+		bool notify = this->FinishedRequests.empty();
+		this->FinishedRequests.push_back(qr);
+		this->FinishedLock.Unlock();
+
+		if (notify)
+			this->Notify();
+	}
+
+	void OnNotify() anope_override
+	{
+		std::deque<QueryResult> finishedRequests;
+
+		this->FinishedLock.Lock();
+		finishedRequests.swap(this->FinishedRequests);
+		this->FinishedLock.Unlock();
+
+		for (std::deque<QueryResult>::const_iterator it = finishedRequests.begin(), it_end = finishedRequests.end(); it != it_end; ++it)
+		{
+			const QueryResult &qr = *it;
+
+			if (qr.result.GetError().empty())
+				qr.sqlinterface->OnResult(qr.result);
+			else
+				qr.sqlinterface->OnError(qr.result);
+		}
+	}
 };
 
-SQLiteService::SQLiteService(Module *o, const Anope::string &n, const Anope::string &d)
-: Provider(o, n), database(d), sql(NULL)
+/** Find the tables a query uses, by taking the name after every keyword which can be followed by one.
+ * This finds more than the tables, such as the columns of a join's condition, which is harmless.
+ * @param query The query
+ * @param tables Where to add the names, in lower case
+ */
+static void FindTables(const Anope::string &query, std::set<Anope::string> &tables)
 {
-	int db = sqlite3_open_v2(database.c_str(), &this->sql, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0);
-	if (db != SQLITE_OK)
-		throw SQL::Exception("Unable to open SQLite database " + database + ": " + sqlite3_errmsg(this->sql));
+	Anope::string name;
+	bool keyword = false;
+
+	/* Names end at anything which can not be in an unquoted name, such as quotes, brackets and commas */
+	for (unsigned i = 0; i <= query.length(); ++i)
+	{
+		char c = i < query.length() ? query[i] : ' ';
+		if (isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$')
+		{
+			name += c;
+			continue;
+		}
+
+		if (name.empty())
+			continue;
+
+		name = name.lower();
+		if (keyword)
+			tables.insert(name);
+		/* Changing the schema changes what reading sqlite_master returns */
+		if (name == "create" || name == "alter" || name == "drop")
+			tables.insert("sqlite_master");
+		keyword = name == "from" || name == "into" || name == "update" || name == "join" || name == "table" || name == "exists" || name == "on" || name == "table_info";
+		name.clear();
+	}
+}
+
+QueryRequest::QueryRequest(Interface *i, const Query &q) : sqlinterface(i), owner(i ? i->owner : NULL), query(q)
+{
+	gettimeofday(&queued, NULL);
+	FindTables(q.query, tables);
+}
+
+QueryRequest::QueryRequest(Interface *i, const std::vector<Query> &t) : sqlinterface(i), owner(i ? i->owner : NULL), query(t.back()), transaction(t)
+{
+	gettimeofday(&queued, NULL);
+	for (unsigned j = 0; j < t.size(); ++j)
+		FindTables(t[j].query, tables);
+}
+
+SQLiteService::SQLiteService(Module *o, const Anope::string &n, const Anope::string &d, unsigned cache)
+: Provider(o, n), database(d), reader(NULL), writer(NULL), commits(0), rollbacks(0), commit_time(0)
+{
+	SQLiteConnection *conn = new SQLiteConnection(database, cache);
+	try
+	{
+		this->reader = new SQLiteConnection(database, cache);
+	}
+	catch (const SQL::Exception &)
+	{
+		delete conn;
+		throw;
+	}
+
+	this->writer = new SQLiteWriter(this, conn);
+	this->writer->Start();
 }
 
 SQLiteService::~SQLiteService()
 {
-	sqlite3_interrupt(this->sql);
-	sqlite3_close(this->sql);
+	/* Let the writer finish what is queued, so nothing is lost on shutdown */
+	this->writer->Lock();
+	this->writer->SetExitState();
+	this->writer->Wakeup();
+	this->writer->Unlock();
+	this->writer->Join();
+	delete this->writer;
+
+	me->OnNotify();
+
+	delete this->reader;
 }
 
 void SQLiteService::Run(Interface *i, const Query &query)
 {
-	Result res = this->RunQuery(query);
-	if (!res.GetError().empty())
-		i->OnError(res);
-	else
-		i->OnResult(res);
+	this->writer->Queue(QueryRequest(i, query));
 }
 
 Result SQLiteService::RunQuery(const Query &query)
 {
-	Anope::string real_query = this->BuildQuery(query);
-	sqlite3_stmt *stmt;
-	int err = sqlite3_prepare_v2(this->sql, real_query.c_str(), real_query.length(), &stmt, NULL);
-	if (err != SQLITE_OK)
-		return SQLiteResult(query, real_query, sqlite3_errmsg(this->sql));
+	/* Queries run from the main thread see what it queued for the writer. Waiting for
+	 * everything queued is only needed when the query uses a table being written to,
+	 * or if it is not known which tables it uses.
+	 */
+	std::set<Anope::string> tables;
+	FindTables(query.query, tables);
+	if (tables.empty() || this->writer->HasPending(tables))
+		this->writer->Flush();
+
+	return this->reader->RunQuery(query);
+}
 
-	std::vector<Anope::string> columns;
-	int cols = sqlite3_column_count(stmt);
-	columns.resize(cols);
-	for (int i = 0; i < cols; ++i)
-		columns[i] = sqlite3_column_name(stmt, i);
+void SQLiteService::RunTransaction(Interface *i, const std::vector<Query> &queries)
+{
+	if (queries.empty())
+		return;
 
-	SQLiteResult result(0, query, real_query);
+	this->writer->Queue(QueryRequest(i, queries));
+}
 
-	while ((err = sqlite3_step(stmt)) == SQLITE_ROW)
+Result SQLiteService::RunTransactionQuery(const std::vector<Query> &queries)
+{
+	timeval queued;
+	gettimeofday(&queued, NULL);
+
+	Result res = Provider::RunTransactionQuery(queries);
+	this->AddTransaction(res, queued);
+
+	return res;
+}
+
+void SQLiteService::AddTransaction(bool committed, const timeval &queued)
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+
+	this->StatsLock.Lock();
+	if (committed)
 	{
-		std::map<Anope::string, Anope::string> items;
-		for (int i = 0; i < cols; ++i)
-		{
-			const char *data = reinterpret_cast<const char *>(sqlite3_column_text(stmt, i));
-			if (data && *data)
-				items[columns[i]] = data;
-		}
-		result.AddRow(items);
+		++this->commits;
+		this->commit_time += (now.tv_sec - queued.tv_sec) + (now.tv_usec - queued.tv_usec) / 1000000.0;
 	}
+	else
+		++this->rollbacks;
+	this->StatsLock.Unlock();
+}
 
-	result.id = sqlite3_last_insert_rowid(this->sql);
-
-	sqlite3_finalize(stmt);
+size_t SQLiteService::GetQueueSize()
+{
+	return this->writer->GetQueueSize();
+}
 
-	if (err != SQLITE_DONE)
-		return SQLiteResult(query, real_query, sqlite3_errmsg(this->sql));
+void SQLiteService::GetTransactionStats(uint64_t &c, uint64_t &r, double &seconds)
+{
+	this->StatsLock.Lock();
+	c = this->commits;
+	r = this->rollbacks;
+	seconds = this->commit_time;
+	this->StatsLock.Unlock();
+}
 
-	return result;
+void SQLiteService::Cancel(Module *m)
+{
+	this->writer->Cancel(m);
 }
 
 std::vector<Query> SQLiteService::CreateTable(const Anope::string &table, const Data &data)
@@ -229,7 +517,7 @@ std::vector<Query> SQLiteService::CreateTable(const Anope::string &table, const
 		query_text = "CREATE INDEX `" + table + "_timestamp_idx` ON `" + table + "` (`timestamp`)";
 		queries.push_back(query_text);
 
-		query_text = "CREATE TRIGGER `" + table + "_trigger` AFTER UPDATE ON `" + table + "` FOR EACH ROW BEGIN UPDATE `" + table + "` SET `timestamp` = CURRENT_TIMESTAMP WHERE `id` = `old.id`; end;";
+		query_text = "CREATE TRIGGER `" + table + "_trigger` AFTER UPDATE ON `" + table + "` FOR EACH ROW BEGIN UPDATE `" + table + "` SET `timestamp` = CURRENT_TIMESTAMP WHERE `id` = old.id; end;";
 		queries.push_back(query_text);
 	}
 	else
@@ -285,12 +573,175 @@ Query SQLiteService::BuildInsert(const Anope::string &table, unsigned int id, Da
 	return query;
 }
 
+Query SQLiteService::BuildInsert(const Anope::string &table, const std::map<unsigned int, Data *> &rows)
+{
+	/* Every row has to have the same columns, so empty any column a row does not have */
+	std::set<Anope::string> columns = this->active_schema[table];
+	columns.erase("id");
+	columns.erase("timestamp");
+	for (std::map<unsigned int, Data *>::const_iterator it = rows.begin(), it_end = rows.end(); it != it_end; ++it)
+		for (Data::Map::const_iterator dit = it->second->data.begin(), dit_end = it->second->data.end(); dit != dit_end; ++dit)
+			columns.insert(dit->first);
+
+	Anope::string query_text = "REPLACE INTO `" + table + "` (`id`";
+	for (std::set<Anope::string>::iterator it = columns.begin(), it_end = columns.end(); it != it_end; ++it)
+		query_text += ",`" + *it + "`";
+	query_text += ") VALUES ";
+
+	Query query;
+	unsigned row = 0;
+	for (std::map<unsigned int, Data *>::const_iterator it = rows.begin(), it_end = rows.end(); it != it_end; ++it, ++row)
+	{
+		const Anope::string prefix = stringify(row) + ".";
+
+		query_text += (row ? ",(" : "(") + stringify(it->first);
+		for (std::set<Anope::string>::iterator cit = columns.begin(), cit_end = columns.end(); cit != cit_end; ++cit)
+		{
+			Anope::string buf;
+			Data::Map::const_iterator dit = it->second->data.find(*cit);
+			if (dit != it->second->data.end())
+				*dit->second >> buf;
+
+			query_text += ",@" + prefix + *cit + "@";
+			query.SetValue(prefix + *cit, buf);
+		}
+		query_text += ")";
+	}
+
+	query.query = query_text;
+	return query;
+}
+
 Query SQLiteService::GetTables(const Anope::string &prefix)
 {
 	return Query("SELECT name FROM sqlite_master WHERE type='table' AND name LIKE '" + prefix + "%';");
 }
 
-Anope::string SQLiteService::Escape(const Anope::string &query)
+Anope::string SQLiteService::FromUnixtime(time_t t)
+{
+	return "datetime('" + stringify(t) + "', 'unixepoch')";
+}
+
+SQLiteConnection::SQLiteConnection(const Anope::string &database, unsigned cache) : sql(NULL), statements(cache)
+{
+	int db = sqlite3_open_v2(database.c_str(), &this->sql, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, 0);
+	if (db != SQLITE_OK)
+	{
+		Anope::string error = sqlite3_errmsg(this->sql);
+		sqlite3_close(this->sql);
+		throw SQL::Exception("Unable to open SQLite database " + database + ": " + error);
+	}
+
+	/* With a write ahead log, readers and the writer do not block each other, and
+	 * the database only needs syncing at checkpoints instead of for every transaction
+	 */
+	sqlite3_exec(this->sql, "PRAGMA journal_mode = WAL", NULL, NULL, NULL);
+	sqlite3_exec(this->sql, "PRAGMA synchronous = NORMAL", NULL, NULL, NULL);
+	/* Wait for the other connection to finish writing rather than failing */
+	sqlite3_busy_timeout(this->sql, 5000);
+}
+
+SQLiteConnection::~SQLiteConnection()
+{
+	std::vector<sqlite3_stmt *> stmts = this->statements.Clear();
+	for (unsigned i = 0; i < stmts.size(); ++i)
+		sqlite3_finalize(stmts[i]);
+
+	sqlite3_interrupt(this->sql);
+	sqlite3_close(this->sql);
+}
+
+bool SQLiteConnection::InTransaction()
+{
+	return !sqlite3_get_autocommit(this->sql);
+}
+
+Result SQLiteConnection::RunQuery(const Query &query)
+{
+	std::vector<Anope::string> values;
+	Anope::string real_query;
+	sqlite3_stmt *stmt = NULL;
+	bool cached = false;
+	int err;
+
+	/* Queries with parameters are kept prepared, so the same query
+	 * with different values is not parsed again
+	 */
+	if (this->statements.max && !query.parameters.empty())
+	{
+		Anope::string statement = query.Prepare(values);
+
+		if (!values.empty())
+		{
+			stmt = this->statements.Find(statement);
+			if (!stmt && sqlite3_prepare_v2(this->sql, statement.c_str(), statement.length(), &stmt, NULL) == SQLITE_OK)
+			{
+				sqlite3_stmt *evicted;
+				this->statements.Add(statement, stmt, evicted);
+				if (evicted)
+					sqlite3_finalize(evicted);
+			}
+		}
+
+		/* If it could not be prepared, such as if it has too many parameters, build it instead */
+		if (stmt)
+		{
+			real_query = statement;
+			cached = true;
+			for (unsigned i = 0; i < values.size(); ++i)
+				sqlite3_bind_text(stmt, i + 1, values[i].c_str(), values[i].length(), SQLITE_STATIC);
+		}
+	}
+
+	if (!stmt)
+	{
+		real_query = this->BuildQuery(query);
+		err = sqlite3_prepare_v2(this->sql, real_query.c_str(), real_query.length(), &stmt, NULL);
+		if (err != SQLITE_OK)
+			return SQLiteResult(query, real_query, sqlite3_errmsg(this->sql));
+	}
+
+	std::vector<Anope::string> columns;
+	int cols = sqlite3_column_count(stmt);
+	columns.resize(cols);
+	for (int i = 0; i < cols; ++i)
+		columns[i] = sqlite3_column_name(stmt, i);
+
+	SQLiteResult result(0, query, real_query);
+
+	while ((err = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		std::map<Anope::string, Anope::string> items;
+		for (int i = 0; i < cols; ++i)
+		{
+			const char *data = reinterpret_cast<const char *>(sqlite3_column_text(stmt, i));
+			if (data && *data)
+				items[columns[i]] = data;
+		}
+		result.AddRow(items);
+	}
+
+	result.id = sqlite3_last_insert_rowid(this->sql);
+
+	Anope::string error;
+	if (err != SQLITE_DONE)
+		error = sqlite3_errmsg(this->sql);
+
+	if (cached)
+	{
+		sqlite3_reset(stmt);
+		sqlite3_clear_bindings(stmt);
+	}
+	else
+		sqlite3_finalize(stmt);
+
+	if (err != SQLITE_DONE)
+		return SQLiteResult(query, cached ? this->BuildQuery(query) : real_query, error);
+
+	return result;
+}
+
+Anope::string SQLiteConnection::Escape(const Anope::string &query)
 {
 	char *e = sqlite3_mprintf("%q", query.c_str());
 	Anope::string buffer = e;
@@ -298,20 +749,255 @@ Anope::string SQLiteService::Escape(const Anope::string &query)
 	return buffer;
 }
 
-Anope::string SQLiteService::BuildQuery(const Query &q)
+Anope::string SQLiteConnection::BuildQuery(const Query &q)
 {
-	Anope::string real_query = q.query;
+	/* Substitute every @parameter@ in one pass, as batched inserts have thousands of them */
+	Anope::string real_query;
+	size_t last = 0;
+
+	for (size_t start; (start = q.query.find('@', last)) != Anope::string::npos;)
+	{
+		size_t end = q.query.find('@', start + 1);
+		if (end == Anope::string::npos)
+			break;
+
+		std::map<Anope::string, QueryData>::const_iterator it = q.parameters.find(q.query.substr(start + 1, end - start - 1));
+		if (it == q.parameters.end())
+		{
+			/* Not a parameter, the closing @ may open one */
+			real_query += q.query.substr(last, end - last);
+			last = end;
+			continue;
+		}
 
-	for (std::map<Anope::string, QueryData>::const_iterator it = q.parameters.begin(), it_end = q.parameters.end(); it != it_end; ++it)
-		real_query = real_query.replace_all_cs("@" + it->first + "@", (it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data));
+		real_query += q.query.substr(last, start - last);
+		real_query += it->second.escape ? ("'" + this->Escape(it->second.data) + "'") : it->second.data;
+		last = end + 1;
+	}
 
+	real_query += q.query.substr(last);
 	return real_query;
 }
 
-Anope::string SQLiteService::FromUnixtime(time_t t)
+SQLiteWriter::SQLiteWriter(SQLiteService *s, SQLiteConnection *c) : service(s), conn(c), busy(false), idle(true)
 {
-	return "datetime('" + stringify(t) + "', 'unixepoch')";
 }
 
-MODULE_INIT(ModuleSQLite)
+SQLiteWriter::~SQLiteWriter()
+{
+	delete this->conn;
+}
+
+void SQLiteWriter::AddPending(const QueryRequest &r)
+{
+	for (std::set<Anope::string>::const_iterator it = r.tables.begin(), it_end = r.tables.end(); it != it_end; ++it)
+		++this->pending_tables[*it];
+}
 
+void SQLiteWriter::DelPending(const QueryRequest &r)
+{
+	for (std::set<Anope::string>::const_iterator it = r.tables.begin(), it_end = r.tables.end(); it != it_end; ++it)
+	{
+		std::map<Anope::string, unsigned>::iterator pit = this->pending_tables.find(*it);
+		if (pit != this->pending_tables.end() && !--pit->second)
+			this->pending_tables.erase(pit);
+	}
+}
+
+void SQLiteWriter::Queue(const QueryRequest &r)
+{
+	this->Lock();
+	this->requests.push_back(r);
+	this->AddPending(r);
+
+	this->Drained.Lock();
+	this->idle = false;
+	this->Drained.Unlock();
+
+	this->Wakeup();
+	this->Unlock();
+}
+
+void SQLiteWriter::Flush()
+{
+	this->Drained.Lock();
+	while (!this->idle)
+		this->Drained.Wait();
+	this->Drained.Unlock();
+}
+
+bool SQLiteWriter::HasPending(const std::set<Anope::string> &tables)
+{
+	bool pending = false;
+
+	this->Lock();
+	for (std::set<Anope::string>::const_iterator it = tables.begin(), it_end = tables.end(); !pending && it != it_end; ++it)
+		pending = this->pending_tables.count(*it) > 0;
+	this->Unlock();
+
+	return pending;
+}
+
+size_t SQLiteWriter::GetQueueSize()
+{
+	size_t count = 0;
+
+	this->Lock();
+	for (std::deque<QueryRequest>::const_iterator it = this->requests.begin(), it_end = this->requests.end(); it != it_end; ++it)
+		count += it->transaction.empty() ? 1 : it->transaction.size();
+	this->Unlock();
+
+	return count;
+}
+
+void SQLiteWriter::Cancel(Module *m)
+{
+	this->Lock();
+
+	for (std::deque<QueryRequest>::iterator it = this->requests.begin(); it != this->requests.end();)
+	{
+		if (it->owner == m)
+		{
+			this->DelPending(*it);
+			it = this->requests.erase(it);
+		}
+		else
+			++it;
+	}
+
+	if (this->busy)
+		this->cancelled.insert(m);
+
+	this->Unlock();
+}
+
+/** Fail the results of requests whose writes were rolled back with the transaction they were in
+ * @param group The requests
+ * @param results Their results so far
+ * @param rolledback Whether each request is a transaction which was rolled back
+ * @param from The first request in the transaction
+ * @param to One past the last request in the transaction
+ * @param error Why the transaction was rolled back
+ */
+static void FailRolledBack(const std::deque<QueryRequest> &group, std::vector<Result> &results, std::vector<bool> &rolledback, unsigned from, unsigned to, const Result &error)
+{
+	for (unsigned i = from; i < to && i < results.size(); ++i)
+	{
+		if (results[i])
+			results[i] = SQLiteResult(group[i].query, error.finished_query, error.GetError());
+		rolledback[i] = true;
+	}
+}
+
+std::vector<Result> SQLiteWriter::RunGroup(const std::deque<QueryRequest> &group)
+{
+	std::vector<Result> results;
+	/* Whether each request is a transaction which was rolled back */
+	std::vector<bool> rolledback(group.size());
+	/* The first request in the currently open transaction */
+	unsigned first = 0;
+
+	this->conn->RunQuery(Query("BEGIN"));
+
+	for (unsigned i = 0; i < group.size(); ++i)
+	{
+		const QueryRequest &r = group[i];
+
+		/* A query may have ended the transaction itself, so open a new one for the rest */
+		if (!this->conn->InTransaction())
+		{
+			first = i;
+			this->conn->RunQuery(Query("BEGIN"));
+		}
+
+		Result res;
+		if (r.transaction.empty())
+			res = this->conn->RunQuery(r.query);
+		else
+		{
+			/* Transactions can not be nested, so explicit transactions are savepoints within the group */
+			res = this->conn->RunQuery(Query("SAVEPOINT anope_transaction"));
+			for (unsigned j = 0; res && j < r.transaction.size(); ++j)
+				res = this->conn->RunQuery(r.transaction[j]);
+
+			if (!res)
+			{
+				this->conn->RunQuery(Query("ROLLBACK TO anope_transaction"));
+				rolledback[i] = true;
+			}
+			this->conn->RunQuery(Query("RELEASE anope_transaction"));
+		}
+
+		results.push_back(res);
+
+		/* Some errors, such as the disk being full, make SQLite roll back the whole transaction,
+		 * which takes the requests run before this one in it with it
+		 */
+		if (!res && !this->conn->InTransaction())
+			FailRolledBack(group, results, rolledback, first, i, res);
+	}
+
+	if (this->conn->InTransaction())
+	{
+		Result res = this->conn->RunQuery(Query("COMMIT"));
+		if (!res)
+		{
+			this->conn->RunQuery(Query("ROLLBACK"));
+
+			/* Nothing since the transaction was opened was written */
+			FailRolledBack(group, results, rolledback, first, group.size(), res);
+		}
+	}
+
+	for (unsigned i = 0; i < group.size(); ++i)
+		if (!group[i].transaction.empty())
+			this->service->AddTransaction(!rolledback[i], group[i].queued);
+
+	return results;
+}
+
+void SQLiteWriter::Run()
+{
+	this->Lock();
+
+	while (true)
+	{
+		if (this->requests.empty())
+		{
+			this->Drained.Lock();
+			this->idle = true;
+			this->Drained.Wakeup();
+			this->Drained.Unlock();
+
+			/* Only exit once everything queued before shutting down is written */
+			if (this->GetExitState())
+				break;
+
+			this->Wait();
+			continue;
+		}
+
+		/* Everything queued since the last group is written in one transaction */
+		std::deque<QueryRequest> group;
+		group.swap(this->requests);
+		this->busy = true;
+		this->cancelled.clear();
+		this->Unlock();
+
+		std::vector<Result> results = this->RunGroup(group);
+
+		this->Lock();
+		this->busy = false;
+
+		for (unsigned i = 0; i < group.size(); ++i)
+			this->DelPending(group[i]);
+
+		for (unsigned i = 0; i < group.size(); ++i)
+			if (group[i].sqlinterface && !this->cancelled.count(group[i].owner))
+				me->AddResult(QueryResult(group[i].sqlinterface, results[i]));
+	}
+
+	this->Unlock();
+}
+
+MODULE_INIT(ModuleSQLite)
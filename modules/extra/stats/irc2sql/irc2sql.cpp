@@ -115,7 +115,7 @@ void IRC2SQL::OnUserConnect(User *u, bool &exempt)
 
 void IRC2SQL::OnUserQuit(User *u, const Anope::string &msg)
 {
-	if (quitting || u->server->IsQuitting())
+	if (quitting || !u->server || u->server->IsQuitting())
 		return;
 
 	query = "CALL " + prefix + "UserQuit(@nick@)";
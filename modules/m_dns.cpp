@@ -650,6 +650,8 @@ class MyManager : public Manager, public Timer
 
 	typedef TR1NS::unordered_map<Question, Query, Question::hash> cache_map;
 	cache_map cache;
+	uint64_t cache_hits, cache_misses;
+	MemoryCounter cache_memory;
 
 	TCPSocket *tcpsock;
 	UDPSocket *udpsock;
@@ -661,7 +663,7 @@ class MyManager : public Manager, public Timer
  public:
 	std::map<unsigned short, Request *> requests;
 
-	MyManager(Module *creator) : Manager(creator), Timer(300, Anope::CurTime, true), serial(Anope::CurTime), tcpsock(NULL), udpsock(NULL),
+	MyManager(Module *creator) : Manager(creator), Timer(300, Anope::CurTime, true), serial(Anope::CurTime), cache_hits(0), cache_misses(0), cache_memory("dns", "cache", creator), tcpsock(NULL), udpsock(NULL),
 		listen(false), cur_id(rand())
 	{
 	}
@@ -736,11 +738,17 @@ class MyManager : public Manager, public Timer
 	{
 		Log(LOG_DEBUG_2) << "Resolver: Processing request to lookup " << req->name << ", of type " << req->type;
 
-		if (req->use_cache && this->CheckCache(req))
+		if (req->use_cache)
 		{
-			Log(LOG_DEBUG_2) << "Resolver: Using cached result";
-			delete req;
-			return;
+			if (this->CheckCache(req))
+			{
+				Log(LOG_DEBUG_2) << "Resolver: Using cached result";
+				++this->cache_hits;
+				delete req;
+				return;
+			}
+
+			++this->cache_misses;
 		}
 
 		if (!this->udpsock)
@@ -957,6 +965,13 @@ class MyManager : public Manager, public Timer
 		return serial;
 	}
 
+	void GetCacheStats(uint64_t &hits, uint64_t &misses, size_t &entries) const anope_override
+	{
+		hits = this->cache_hits;
+		misses = this->cache_misses;
+		entries = this->cache.size();
+	}
+
 	void Tick(time_t now) anope_override
 	{
 		Log(LOG_DEBUG_2) << "Resolver: Purging DNS cache";
@@ -969,11 +984,31 @@ class MyManager : public Manager, public Timer
 			++it_next;
 
 			if (req.created + static_cast<time_t>(req.ttl) < now)
+			{
+				this->cache_memory.Free(CacheSize(q));
 				this->cache.erase(it);
+			}
 		}
 	}
 	
  private:
+	/** Estimate the memory used by a cache entry
+	 * @param q The cached query
+	 */
+	static size_t CacheSize(const Query &q)
+	{
+		size_t size = MemoryCounter::HashNode(sizeof(cache_map::value_type)) + q.questions.size() * sizeof(Question);
+		for (unsigned i = 0; i < q.questions.size(); ++i)
+			size += q.questions[i].name.length();
+
+		const std::vector<ResourceRecord> *records[] = { &q.answers, &q.authorities, &q.additional };
+		for (unsigned i = 0; i < 3; ++i)
+			for (unsigned j = 0; j < records[i]->size(); ++j)
+				size += sizeof(ResourceRecord) + (*records[i])[j].name.length() + (*records[i])[j].rdata.length();
+
+		return size;
+	}
+
 	/** Add a record to the dns cache
 	 * @param r The record
 	 */
@@ -981,7 +1016,15 @@ class MyManager : public Manager, public Timer
 	{
 		const ResourceRecord &rr = r.answers[0];
 		Log(LOG_DEBUG_3) << "Resolver cache: added cache for " << rr.name << " -> " << rr.rdata << ", ttl: " << rr.ttl;
-		this->cache[r.questions[0]] = r;
+		cache_map::iterator it = this->cache.find(r.questions[0]);
+		if (it != this->cache.end())
+		{
+			this->cache_memory.Free(CacheSize(it->second));
+			it->second = r;
+		}
+		else
+			this->cache[r.questions[0]] = r;
+		this->cache_memory.Allocate(CacheSize(r));
 	}
 
 	/** Check the DNS cache to see if request can be handled by a cached result
@@ -9,6 +9,13 @@
 #include "modules/httpd.h"
 #include "modules/ssl.h"
 
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+
+/* Counts the clients connected to all providers, the socket buffers are counted by the core */
+static MemoryCounter ClientMemory("httpd", "HTTPClient");
+
 static Anope::string BuildDate()
 {
 	char timebuf[64];
@@ -29,6 +36,14 @@ static Anope::string GetStatusFromCode(HTTPError err)
 			return "400 Bad Request";
 		case HTTP_PAGE_NOT_FOUND:
 			return "404 Not Found";
+		case HTTP_PAYLOAD_TOO_LARGE:
+			return "413 Payload Too Large";
+		case HTTP_HEADERS_TOO_LARGE:
+			return "431 Request Header Fields Too Large";
+		case HTTP_NOT_IMPLEMENTED:
+			return "501 Not Implemented";
+		case HTTP_SERVICE_UNAVAILABLE:
+			return "503 Service Unavailable";
 		case HTTP_NOT_SUPPORTED:
 			return "505 HTTP Version Not Supported";
 	}
@@ -36,15 +51,86 @@ static Anope::string GetStatusFromCode(HTTPError err)
 	return "501 Not Implemented";
 }
 
+static inline bool IsSpace(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/** Remove whitespace from both ends of a range */
+static void Trim(const char *&begin, const char *&end)
+{
+	while (begin != end && IsSpace(*begin))
+		++begin;
+	while (end != begin && IsSpace(end[-1]))
+		--end;
+}
+
+/** Split a range of name=value pairs, such as a query string, into fields.
+ * Pairs without a name or a value are skipped.
+ * @param sep The character separating pairs
+ * @param decode Whether values are URL encoded
+ */
+static void ParseFields(const char *begin, const char *end, char sep, bool decode, HTTPFields &fields)
+{
+	while (begin < end)
+	{
+		const char *next = static_cast<const char *>(memchr(begin, sep, end - begin));
+		if (!next)
+			next = end;
+
+		const char *pbegin = begin, *pend = next;
+		Trim(pbegin, pend);
+
+		const char *eq = static_cast<const char *>(memchr(pbegin, '=', pend - pbegin));
+		if (eq && eq != pbegin && eq + 1 < pend)
+		{
+			Anope::string value(eq + 1, pend - eq - 1);
+			fields.Add(Anope::string(pbegin, eq - pbegin), decode ? HTTPUtils::URLDecode(value) : value);
+		}
+
+		begin = next + 1;
+	}
+}
+
+/* Settings of a HTTP server which its clients use */
+struct HTTPLimits
+{
+	/* How long a request, and the reply to it, may take */
+	int timeout;
+	/* How long a connection may be idle between requests */
+	int idle_timeout;
+	/* Maximum number of connections from one IP, 0 for no limit */
+	unsigned max_connections;
+	/* Maximum size of the request line and headers of a request */
+	size_t max_header_size;
+	/* Maximum size of the body of a request */
+	size_t max_body_size;
+
+	HTTPLimits() : timeout(30), idle_timeout(15), max_connections(0), max_header_size(8192), max_body_size(65536) { }
+};
+
+class MyHTTPProvider;
+
 class MyHTTPClient : public HTTPClient
 {
 	HTTPProvider *provider;
+	const HTTPLimits &limits;
 	HTTPMessage message;
-	bool header_done, served;
 	Anope::string page_name;
 	Reference<HTTPPage> page;
 	Anope::string ip;
 
+	/* Data received from the start of the request being parsed, which may also
+	 * hold requests pipelined behind it. Parsed data is only removed once it is
+	 * most of the buffer, so nothing is copied more than a few times.
+	 */
+	std::string input;
+	/* Where parsing continues in input */
+	size_t pos;
+	/* How much of input has been searched for the end of the current line */
+	size_t scanned;
+	/* Size of the request line and headers read so far */
+	size_t header_size;
 	unsigned content_length;
 
 	enum
@@ -54,11 +140,45 @@ class MyHTTPClient : public HTTPClient
 		ACTION_POST
 	} action;
 
+	enum
+	{
+		/* Reading the request line and headers */
+		STATE_HEADERS,
+		/* Reading the body of the request */
+		STATE_BODY,
+		/* Waiting for the page to reply to the request */
+		STATE_SERVING,
+		/* The connection is closed once the last reply has been written */
+		STATE_CLOSING
+	} state;
+
+	/* Whether the client talks HTTP/1.1, and so understands chunked replies */
+	bool http11;
+	/* Whether the connection is kept open after the reply to this request */
+	bool keepalive;
+	/* Whether the headers of a chunked reply have been sent */
+	bool streaming;
+	/* Whether a reply was sent from outside of Parse, so requests pipelined behind it still need parsing */
+	bool resume;
+	/* Whether we are in Parse */
+	bool parsing;
+
+	/* When what the connection is doing now was started: the connection being made or the
+	 * last reply being sent if it is idle, reading the first byte of the request being read,
+	 * or serving the request being served. Each of these is timed out on its own.
+	 */
+	time_t phase_started;
+
+	/* Whether no part of a request has been read since the last one was served */
+	bool BetweenRequests() const
+	{
+		return this->state == STATE_HEADERS && this->action == ACTION_NONE && this->pos == this->input.length();
+	}
+
 	void Serve()
 	{
-		if (this->served)
-			return;
-		this->served = true;
+		this->state = STATE_SERVING;
+		this->phase_started = Anope::CurTime;
 
 		if (!this->page)
 		{
@@ -90,148 +210,351 @@ class MyHTTPClient : public HTTPClient
 			this->SendReply(&reply);
 	}
 
- public:
-	time_t created;
-
-	MyHTTPClient(HTTPProvider *l, int f, const sockaddrs &a) : Socket(f, l->IsIPv6()), HTTPClient(l, f, a), provider(l), header_done(false), served(false), ip(a.addr()), content_length(0), action(ACTION_NONE), created(Anope::CurTime)
+	/** Parse as much of the input as possible. Pipelined requests are served one
+	 * at a time, the next one is not parsed until the reply to the previous one has been sent.
+	 */
+	void Parse()
 	{
-		Log(LOG_DEBUG, "httpd") << "Accepted connection " << f << " from " << a.addr();
-	}
+		this->parsing = true;
 
-	~MyHTTPClient()
-	{
-		Log(LOG_DEBUG, "httpd") << "Closing connection " << this->GetFD() << " from " << this->ip;
-	}
+		while (this->state == STATE_HEADERS || this->state == STATE_BODY)
+		{
+			if (this->state == STATE_HEADERS)
+			{
+				size_t nl = this->input.find('\n', this->scanned);
+				if (nl == std::string::npos)
+				{
+					this->scanned = this->input.length();
+					if (this->header_size + this->input.length() - this->pos > this->limits.max_header_size)
+						this->SendFatal(HTTP_HEADERS_TOO_LARGE, "Request headers too large");
+					break;
+				}
 
-	/* Close connection once all data is written */
-	bool ProcessWrite() anope_override
-	{
-		return !BinarySocket::ProcessWrite() || this->write_buffer.empty() ? false : true;
-	}
+				const char *begin = this->input.data() + this->pos, *end = this->input.data() + nl;
+				this->header_size += nl + 1 - this->pos;
+				this->pos = this->scanned = nl + 1;
 
-	const Anope::string GetIP() anope_override
-	{
-		return this->ip;
-	}
+				if (this->header_size > this->limits.max_header_size)
+				{
+					this->SendFatal(HTTP_HEADERS_TOO_LARGE, "Request headers too large");
+					break;
+				}
 
-	bool Read(const char *buffer, size_t l) anope_override
-	{
-		message.content.append(buffer, l);
+				Trim(begin, end);
+				if (begin != end)
+					this->ParseHeader(begin, end);
+				/* Clients may send empty lines between requests */
+				else if (this->action != ACTION_NONE)
+					this->state = STATE_BODY;
+			}
+			else if (this->input.length() - this->pos >= this->content_length)
+			{
+				this->message.content = Anope::string(this->input.data() + this->pos, this->content_length);
+				this->pos = this->scanned = this->pos + this->content_length;
 
-		for (size_t nl; !this->header_done && (nl = message.content.find('\n')) != Anope::string::npos;)
-		{
-			Anope::string token = message.content.substr(0, nl).trim();
-			message.content = message.content.substr(nl + 1);
+				ParseFields(this->message.content.c_str(), this->message.content.c_str() + this->message.content.length(), '&', true, this->message.post_data);
+				for (HTTPFields::iterator it = this->message.post_data.begin(), it_end = this->message.post_data.end(); it != it_end; ++it)
+					Log(LOG_DEBUG_2) << "HTTP POST from " << this->clientaddr.addr() << ": " << it->first << ": " << it->second;
 
-			if (token.empty())
-				this->header_done = true;
+				this->Serve();
+			}
 			else
-				this->Read(token);
+				break;
 		}
 
-		if (!this->header_done)
-			return true;
+		if (this->pos == this->input.length() || this->state == STATE_CLOSING)
+		{
+			this->input.clear();
+			this->pos = this->scanned = 0;
+		}
+		else if (this->pos > this->input.length() / 2)
+		{
+			this->input.erase(0, this->pos);
+			this->scanned -= this->pos;
+			this->pos = 0;
+		}
+
+		this->parsing = false;
+	}
+
+	void ParseRequestLine(const Anope::string &buf)
+	{
+		Log(LOG_DEBUG_2) << "HTTP from " << this->clientaddr.addr() << ": " << buf;
+
+		std::vector<Anope::string> params;
+		spacesepstream(buf).GetTokens(params);
 
-		if (this->message.content.length() >= this->content_length)
+		if (params.empty() || (params[0] != "GET" && params[0] != "POST"))
 		{
-			sepstream sep(this->message.content, '&');
-			Anope::string token;
+			this->SendFatal(HTTP_BAD_REQUEST, "Unknown operation");
+			return;
+		}
 
-			while (sep.GetToken(token))
-			{
-				size_t sz = token.find('=');
-				if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
-					continue;
-				this->message.post_data[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
-				Log(LOG_DEBUG_2) << "HTTP POST from " << this->clientaddr.addr() << ": " << token.substr(0, sz) << ": " << this->message.post_data[token.substr(0, sz)];
-			}
+		if (params.size() != 3)
+		{
+			this->SendFatal(HTTP_BAD_REQUEST, "Invalid parameters");
+			return;
+		}
 
-			this->Serve();
+		if (params[2].find("HTTP/1.") != 0)
+		{
+			this->SendFatal(HTTP_NOT_SUPPORTED, "Unsupported HTTP version");
+			return;
 		}
-		
-		return true;
+
+		/* HTTP/1.1 connections are persistent unless the client says otherwise, HTTP/1.0 ones are not */
+		this->http11 = params[2] != "HTTP/1.0";
+		this->keepalive = this->http11;
+
+		if (params[0] == "GET")
+			this->action = ACTION_GET;
+		else if (params[0] == "POST")
+			this->action = ACTION_POST;
+
+		const Anope::string &targ = params[1];
+		size_t q = targ.find('?');
+		if (q != Anope::string::npos)
+			ParseFields(targ.c_str() + q + 1, targ.c_str() + targ.length(), '&', true, this->message.get_data);
+
+		this->page_name = targ.substr(0, q);
+		this->page = this->provider->FindPage(this->page_name);
 	}
 
-	bool Read(const Anope::string &buf)
+	void ParseHeader(const char *begin, const char *end)
 	{
-		Log(LOG_DEBUG_2) << "HTTP from " << this->clientaddr.addr() << ": " << buf;
-
 		if (this->action == ACTION_NONE)
 		{
-			std::vector<Anope::string> params;
-			spacesepstream(buf).GetTokens(params);
+			this->ParseRequestLine(Anope::string(begin, end - begin));
+			return;
+		}
+
+		const char *colon = static_cast<const char *>(memchr(begin, ':', end - begin));
+		if (!colon)
+			return;
+
+		const char *vbegin = colon + 1, *vend = end;
+		Trim(vbegin, vend);
+
+		Anope::string name(begin, colon - begin);
+
+		if (name.equals_ci("Cookie"))
+		{
+			Log(LOG_DEBUG_2) << "HTTP from " << this->clientaddr.addr() << ": " << name << ": " << Anope::string(vbegin, vend - vbegin);
+			ParseFields(vbegin, vend, ';', false, this->message.cookies);
+			return;
+		}
+
+		Anope::string value(vbegin, vend - vbegin);
+		Log(LOG_DEBUG_2) << "HTTP from " << this->clientaddr.addr() << ": " << name << ": " << value;
 
-			if (params.empty() || (params[0] != "GET" && params[0] != "POST"))
+		if (name.equals_ci("Content-Length"))
+		{
+			try
 			{
-				this->SendError(HTTP_BAD_REQUEST, "Unknown operation");
-				return true;
+				this->content_length = convertTo<unsigned>(value);
 			}
-
-			if (params.size() != 3)
+			catch (const ConvertException &ex)
 			{
-				this->SendError(HTTP_BAD_REQUEST, "Invalid parameters");
-				return true;
+				this->SendFatal(HTTP_BAD_REQUEST, "Invalid Content-Length");
+				return;
 			}
 
-			if (params[0] == "GET")
-				this->action = ACTION_GET;
-			else if (params[0] == "POST")
-				this->action = ACTION_POST;
-
-			Anope::string targ = params[1];
-			size_t q = targ.find('?');
-			if (q != Anope::string::npos)
+			if (this->content_length > this->limits.max_body_size)
+				this->SendFatal(HTTP_PAYLOAD_TOO_LARGE, "Request body too large");
+		}
+		else if (name.equals_ci("Transfer-Encoding"))
+		{
+			/* We can not tell where a body we can not decode ends, so the rest of the connection is lost */
+			this->SendFatal(HTTP_NOT_IMPLEMENTED, "Transfer-Encoding is not supported");
+		}
+		else
+		{
+			if (name.equals_ci("Connection"))
 			{
-				sepstream sep(targ.substr(q + 1), '&');
-				targ = targ.substr(0, q);
-
+				commasepstream sep(value);
 				Anope::string token;
+
 				while (sep.GetToken(token))
 				{
-					size_t sz = token.find('=');
-					if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
-						continue;
-					this->message.get_data[token.substr(0, sz)] = HTTPUtils::URLDecode(token.substr(sz + 1));
+					token.trim();
+					if (token.equals_ci("close"))
+						this->keepalive = false;
+					else if (token.equals_ci("keep-alive"))
+						this->keepalive = true;
 				}
 			}
 
-			this->page = this->provider->FindPage(targ);
-			this->page_name = targ;
+			if (!value.empty())
+				this->message.headers.Add(name, value);
 		}
-		else if (buf.find("Cookie: ") == 0)
+	}
+
+	/** Send an error after which the rest of the input can not be trusted, and close the connection */
+	void SendFatal(HTTPError err, const Anope::string &msg)
+	{
+		this->keepalive = false;
+		this->SendError(err, msg);
+	}
+
+	/** Add the headers of a reply to a buffer
+	 * @param chunked Whether the body is sent with chunked transfer encoding
+	 */
+	void BuildHeaders(HTTPReply *msg, bool chunked, std::string &buf)
+	{
+		buf += "HTTP/1.1 " + GetStatusFromCode(msg->error).str() + "\r\n";
+		buf += "Date: " + BuildDate().str() + "\r\n";
+		buf += "Server: Anope-" + Anope::VersionShort().str() + "\r\n";
+		if (msg->content_type.empty())
+			buf += "Content-Type: text/html\r\n";
+		else
+			buf += "Content-Type: " + msg->content_type.str() + "\r\n";
+		if (chunked)
+			buf += "Transfer-Encoding: chunked\r\n";
+		else
+			buf += "Content-Length: " + stringify(msg->length).str() + "\r\n";
+
+		for (unsigned i = 0; i < msg->cookies.size(); ++i)
 		{
-			spacesepstream sep(buf.substr(8));
-			Anope::string token;
+			Anope::string cookie = "Set-Cookie:";
 
-			while (sep.GetToken(token))
-			{
-				size_t sz = token.find('=');
-				if (sz == Anope::string::npos || !sz || sz + 1 >= token.length())
-					continue;
-				size_t end = token.length() - (sz + 1);
-				if (!sep.StreamEnd())
-					--end; // Remove trailing ;
-				this->message.cookies[token.substr(0, sz)] = token.substr(sz + 1, end);
-			}
+			for (HTTPReply::cookie::iterator it = msg->cookies[i].begin(), it_end = msg->cookies[i].end(); it != it_end; ++it)
+				cookie += " " + it->first + "=" + it->second + ";";
+
+			cookie.erase(cookie.length() - 1);
+
+			buf += cookie.str() + "\r\n";
 		}
-		else if (buf.find("Content-Length: ") == 0)
+
+		typedef std::map<Anope::string, Anope::string> map;
+		for (map::iterator it = msg->headers.begin(), it_end = msg->headers.end(); it != it_end; ++it)
+			buf += it->first.str() + ": " + it->second.str() + "\r\n";
+
+		/* Keep-alive can be disabled by configuration */
+		if (this->limits.idle_timeout <= 0)
+			this->keepalive = false;
+
+		if (!this->keepalive)
+			buf += "Connection: Close\r\n";
+		else
 		{
-			try
+			if (!this->http11)
+				buf += "Connection: Keep-Alive\r\n";
+			buf += "Keep-Alive: timeout=" + stringify(this->limits.idle_timeout).str() + "\r\n";
+		}
+
+		buf += "\r\n";
+	}
+
+	/** Move the data of a reply to a buffer
+	 * @param chunked Whether to write it as one chunk
+	 */
+	static void BuildBody(HTTPReply *msg, bool chunked, std::string &buf)
+	{
+		if (chunked)
+		{
+			if (!msg->length)
+				return;
+			buf += Anope::printf("%lx\r\n", static_cast<unsigned long>(msg->length)).str();
+		}
+
+		for (unsigned i = 0; i < msg->out.size(); ++i)
+		{
+			HTTPReply::Data* d = msg->out[i];
+
+			buf.append(d->buf, d->len);
+
+			delete d;
+		}
+
+		if (chunked)
+			buf += "\r\n";
+
+		msg->out.clear();
+		msg->length = 0;
+	}
+
+ public:
+	/* Our position in the provider's client list */
+	std::list<MyHTTPClient *>::iterator list_pos;
+
+	MyHTTPClient(MyHTTPProvider *l, int f, const sockaddrs &a);
+
+	~MyHTTPClient();
+
+	/** Check whether this client has timed out */
+	bool IsExpired() const
+	{
+		bool idle = this->BetweenRequests() && this->write_buffer.empty();
+		return this->phase_started + (idle ? this->limits.idle_timeout : this->limits.timeout) <= Anope::CurTime;
+	}
+
+	/** Close the connection after the next reply, which must not be delayed */
+	void Reject()
+	{
+		this->SendFatal(HTTP_SERVICE_UNAVAILABLE, "Too many connections");
+	}
+
+	bool ProcessWrite() anope_override
+	{
+		/* Send pipelined replies and the chunks of a reply with one write */
+		if (this->write_buffer.size() > 1)
+		{
+			std::string buf;
+			for (unsigned i = 0; i < this->write_buffer.size(); ++i)
 			{
-				this->content_length = convertTo<unsigned>(buf.substr(16));
+				DataBlock *d = this->write_buffer[i];
+				buf.append(d->buf, d->len);
+				delete d;
 			}
-			catch (const ConvertException &ex) { }
+
+			this->write_buffer.clear();
+			this->write_buffer.push_back(new DataBlock(buf.data(), buf.length()));
 		}
-		else if (buf.find(':') != Anope::string::npos)
+
+		if (!BinarySocket::ProcessWrite())
+			return false;
+
+		if (!this->write_buffer.empty())
+			return true;
+
+		/* Close connection once all data is written */
+		if (this->state == STATE_CLOSING)
+			return false;
+
+		/* Requests pipelined behind a reply which was sent later are parsed
+		 * here, rather than from within whatever sent the reply.
+		 */
+		if (this->resume)
 		{
-			size_t sz = buf.find(':');
-			if (sz + 2 < buf.length())
-				this->message.headers[buf.substr(0, sz)] = buf.substr(sz + 2);
+			this->resume = false;
+			this->Parse();
 		}
 
 		return true;
 	}
 
+	const Anope::string GetIP() anope_override
+	{
+		return this->ip;
+	}
+
+	bool Read(const char *buffer, size_t l) anope_override
+	{
+		/* Anything sent after a request which closes the connection is ignored */
+		if (this->state == STATE_CLOSING)
+			return true;
+
+		/* A new request is timed from its first byte, not from when the connection went idle */
+		if (this->BetweenRequests())
+			this->phase_started = Anope::CurTime;
+
+		this->input.append(buffer, l);
+		this->Parse();
+
+		/* Requests pipelined behind one being served are buffered, but not without limit */
+		return this->input.length() - this->pos <= this->limits.max_header_size + this->limits.max_body_size;
+	}
+
 	void SendError(HTTPError err, const Anope::string &msg) anope_override
 	{
 		HTTPReply h;
@@ -243,78 +566,124 @@ class MyHTTPClient : public HTTPClient
 		this->SendReply(&h);
 	}
 
-	void SendReply(HTTPReply *msg) anope_override
+	void SendChunk(HTTPReply *msg) anope_override
 	{
-		this->WriteClient("HTTP/1.1 " + GetStatusFromCode(msg->error));
-		this->WriteClient("Date: " + BuildDate());
-		this->WriteClient("Server: Anope-" + Anope::VersionShort());
-		if (msg->content_type.empty())
-			this->WriteClient("Content-Type: text/html");
-		else
-			this->WriteClient("Content-Type: " + msg->content_type);
-		this->WriteClient("Content-Length: " + stringify(msg->length));
+		if (!this->http11 || this->state == STATE_CLOSING)
+			return;
 
-		for (unsigned i = 0; i < msg->cookies.size(); ++i)
+		std::string buf;
+		if (!this->streaming)
 		{
-			Anope::string buf = "Set-Cookie:";
+			this->streaming = true;
+			this->BuildHeaders(msg, true, buf);
+		}
+		BuildBody(msg, true, buf);
 
-			for (HTTPReply::cookie::iterator it = msg->cookies[i].begin(), it_end = msg->cookies[i].end(); it != it_end; ++it)
-				buf += " " + it->first + "=" + it->second + ";";
+		this->Write(buf.data(), buf.length());
+	}
 
-			buf.erase(buf.length() - 1);
+	void SendReply(HTTPReply *msg) anope_override
+	{
+		if (this->state == STATE_CLOSING)
+			return;
 
-			this->WriteClient(buf);
+		/* Write the whole reply at once, rather than a socket write per header and piece of the page */
+		std::string buf;
+		if (this->streaming)
+		{
+			BuildBody(msg, true, buf);
+			buf += "0\r\n\r\n";
+		}
+		else
+		{
+			buf.reserve(512 + msg->length);
+			this->BuildHeaders(msg, false, buf);
+			BuildBody(msg, false, buf);
 		}
 
-		typedef std::map<Anope::string, Anope::string> map;
-		for (map::iterator it = msg->headers.begin(), it_end = msg->headers.end(); it != it_end; ++it)
-			this->WriteClient(it->first + ": " + it->second);
+		this->Write(buf.data(), buf.length());
 
-		this->WriteClient("Connection: Close");
-		this->WriteClient("");
+		/* Get ready for the next request */
+		this->message.Clear();
+		this->page_name.clear();
+		this->page = NULL;
+		this->header_size = 0;
+		this->content_length = 0;
+		this->action = ACTION_NONE;
+		this->streaming = false;
+		this->phase_started = Anope::CurTime;
 
-		for (unsigned i = 0; i < msg->out.size(); ++i)
+		if (!this->keepalive)
+			this->state = STATE_CLOSING;
+		else
 		{
-			HTTPReply::Data* d = msg->out[i];
-
-			this->Write(d->buf, d->len);
-
-			delete d;
+			this->state = STATE_HEADERS;
+			if (!this->parsing && !this->input.empty())
+				this->resume = true;
 		}
-
-		msg->out.clear();
 	}
 };
 
 class MyHTTPProvider : public HTTPProvider, public Timer
 {
-	int timeout;
 	std::map<Anope::string, HTTPPage *> pages;
-	std::list<Reference<MyHTTPClient> > clients;
+	std::list<MyHTTPClient *> clients;
+	/* Number of connections from each IP */
+	TR1NS::unordered_map<Anope::string, unsigned, Anope::hash_cs> connections;
 
  public:
-	MyHTTPProvider(Module *c, const Anope::string &n, const Anope::string &i, const unsigned short p, const int t, bool s) : Socket(-1, i.find(':') != Anope::string::npos), HTTPProvider(c, n, i, p, s), Timer(c, 10, Anope::CurTime, true), timeout(t) { }
+	HTTPLimits limits;
+
+	MyHTTPProvider(Module *c, const Anope::string &n, const Anope::string &i, const unsigned short p, bool s) : Socket(-1, i.find(':') != Anope::string::npos), HTTPProvider(c, n, i, p, s), Timer(c, 5, Anope::CurTime, true) { }
+
+	~MyHTTPProvider()
+	{
+		std::list<MyHTTPClient *> c;
+		c.swap(this->clients);
+		for (std::list<MyHTTPClient *>::iterator it = c.begin(), it_end = c.end(); it != it_end; ++it)
+			delete *it;
+	}
 
 	void Tick(time_t) anope_override
 	{
-		while (!this->clients.empty())
+		for (std::list<MyHTTPClient *>::iterator it = this->clients.begin(), it_end = this->clients.end(); it != it_end;)
 		{
-			Reference<MyHTTPClient>& c = this->clients.front();
-			if (c && c->created + this->timeout >= Anope::CurTime)
-				break;
+			MyHTTPClient *c = *it;
+			++it;
 
-			delete c;
-			this->clients.pop_front();
+			if (c->IsExpired())
+				delete c;
 		}
 	}
 
 	ClientSocket* OnAccept(int fd, const sockaddrs &addr) anope_override
 	{
 		MyHTTPClient *c = new MyHTTPClient(this, fd, addr);
-		this->clients.push_back(c);
+		c->list_pos = this->clients.insert(this->clients.end(), c);
+
+		/* Connections from a reverse proxy are not limited, they are everyone's */
+		unsigned &count = this->connections[addr.addr()];
+		if (++count > this->limits.max_connections && this->limits.max_connections && addr.addr() != this->ext_ip)
+		{
+			Log(LOG_DEBUG, "httpd") << "m_httpd: Too many connections from " << addr.addr();
+			c->Reject();
+		}
+
 		return c;
 	}
 
+	void OnClose(MyHTTPClient *c)
+	{
+		if (this->clients.empty())
+			return; // Being destroyed
+
+		this->clients.erase(c->list_pos);
+
+		TR1NS::unordered_map<Anope::string, unsigned, Anope::hash_cs>::iterator it = this->connections.find(c->clientaddr.addr());
+		if (it != this->connections.end() && !--it->second)
+			this->connections.erase(it);
+	}
+
 	bool RegisterPage(HTTPPage *page) anope_override
 	{
 		return this->pages.insert(std::make_pair(page->GetURL(), page)).second;
@@ -333,6 +702,26 @@ class MyHTTPProvider : public HTTPProvider, public Timer
 	}
 };
 
+MyHTTPClient::MyHTTPClient(MyHTTPProvider *l, int f, const sockaddrs &a) : Socket(f, l->IsIPv6()), HTTPClient(l, f, a), provider(l), limits(l->limits), ip(a.addr()), pos(0), scanned(0), header_size(0), content_length(0), action(ACTION_NONE), state(STATE_HEADERS), http11(false), keepalive(false), streaming(false), resume(false), parsing(false), phase_started(Anope::CurTime)
+{
+	Log(LOG_DEBUG, "httpd") << "Accepted connection " << f << " from " << a.addr();
+
+	/* Replies are written whole, so there is nothing to gain from Nagle's algorithm,
+	 * and it holds back replies to pipelined requests until the client acknowledges the last one.
+	 */
+	const int op = 1;
+	setsockopt(f, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&op), sizeof(op));
+
+	ClientMemory.Allocate(sizeof(MyHTTPClient));
+}
+
+MyHTTPClient::~MyHTTPClient()
+{
+	Log(LOG_DEBUG, "httpd") << "Closing connection " << this->GetFD() << " from " << this->ip;
+	static_cast<MyHTTPProvider *>(this->provider)->OnClose(this);
+	ClientMemory.Free(sizeof(MyHTTPClient));
+}
+
 class HTTPD : public Module
 {
 	ServiceReference<SSLService> sslref;
@@ -340,19 +729,14 @@ class HTTPD : public Module
  public:
 	HTTPD(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR), sslref("SSLService", "ssl")
 	{
-
+		ClientMemory.owner = this;
 	}
 
 	~HTTPD()
 	{
-		for (std::map<int, Socket *>::const_iterator it = SocketEngine::Sockets.begin(), it_end = SocketEngine::Sockets.end(); it != it_end;)
-		{
-			Socket *s = it->second;
-			++it;
-
-			if (dynamic_cast<MyHTTPProvider *>(s) || dynamic_cast<MyHTTPClient *>(s))
-				delete s;
-		}
+		/* Providers close their own clients */
+		for (std::map<Anope::string, MyHTTPProvider *>::iterator it = this->providers.begin(), it_end = this->providers.end(); it != it_end; ++it)
+			delete it->second;
 
 		this->providers.clear();
 	}
@@ -373,6 +757,10 @@ class HTTPD : public Module
 			Anope::string ip = block->Get<const Anope::string>("ip");
 			int port = block->Get<int>("port", "8080");
 			int timeout = block->Get<int>("timeout", "30");
+			int idle_timeout = block->Get<int>("idle_timeout", "15");
+			unsigned max_connections = block->Get<unsigned>("max_connections_per_ip", "10");
+			size_t max_header_size = block->Get<unsigned>("max_header_size", "8192");
+			size_t max_body_size = block->Get<unsigned>("max_body_size", "65536");
 			bool ssl = block->Get<bool>("ssl", "no");
 			Anope::string ext_ip = block->Get<const Anope::string>("extforward_ip");
 			Anope::string ext_header = block->Get<const Anope::string>("extforward_header");
@@ -393,7 +781,7 @@ class HTTPD : public Module
 			{
 				try
 				{
-					p = new MyHTTPProvider(this, hname, ip, port, timeout, ssl);
+					p = new MyHTTPProvider(this, hname, ip, port, ssl);
 					if (ssl && sslref)
 						sslref->Init(p);
 				}
@@ -419,7 +807,7 @@ class HTTPD : public Module
 
 					try
 					{
-						p = new MyHTTPProvider(this, hname, ip, port, timeout, ssl);
+						p = new MyHTTPProvider(this, hname, ip, port, ssl);
 						if (ssl && sslref)
 							sslref->Init(p);
 					}
@@ -434,6 +822,11 @@ class HTTPD : public Module
 			}
 
 
+			p->limits.timeout = timeout;
+			p->limits.idle_timeout = idle_timeout;
+			p->limits.max_connections = max_connections;
+			p->limits.max_header_size = max_header_size;
+			p->limits.max_body_size = max_body_size;
 			p->ext_ip = ext_ip;
 			spacesepstream(ext_header).GetTokens(p->ext_headers);
 		}
@@ -0,0 +1,309 @@
+/*
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ */
+
+#include "module.h"
+#include "modules/httpd.h"
+#include "modules/dns.h"
+#include "modules/sql.h"
+#include "modules/os_session.h"
+
+/** Escapes a label value as required by the OpenMetrics text format
+ */
+static Anope::string EscapeLabel(const Anope::string &value)
+{
+	Anope::string escaped;
+
+	for (unsigned i = 0; i < value.length(); ++i)
+	{
+		switch (value[i])
+		{
+			case '\\':
+				escaped += "\\\\";
+				break;
+			case '"':
+				escaped += "\\\"";
+				break;
+			case '\n':
+				escaped += "\\n";
+				break;
+			default:
+				escaped += value[i];
+		}
+	}
+
+	return escaped;
+}
+
+/** Renders a label for a sample, labels are joined with a comma
+ */
+static Anope::string Label(const Anope::string &name, const Anope::string &value)
+{
+	return name + "=\"" + EscapeLabel(value) + "\"";
+}
+
+/** Renders metric families into a HTTPReply. Every family is written to the
+ * reply as soon as it is built, so a scrape only ever holds one family in memory
+ * and only asks each subsystem for counts it already keeps.
+ */
+class MetricsWriter
+{
+	HTTPReply &reply;
+	Anope::string buf;
+
+ public:
+	MetricsWriter(HTTPReply &r) : reply(r) { }
+
+	~MetricsWriter()
+	{
+		this->Flush();
+	}
+
+	void Family(const Anope::string &name, const Anope::string &type, const Anope::string &help)
+	{
+		this->Flush();
+		buf += "# TYPE anope_" + name + " " + type + "\n";
+		buf += "# HELP anope_" + name + " " + help + "\n";
+	}
+
+	template<typename T> void Sample(const Anope::string &name, const T &value, const Anope::string &labels = "")
+	{
+		buf += "anope_" + name;
+		if (!labels.empty())
+			buf += "{" + labels + "}";
+		buf += " " + stringify(value) + "\n";
+	}
+
+	template<typename T> void Gauge(const Anope::string &name, const Anope::string &help, const T &value)
+	{
+		this->Family(name, "gauge", help);
+		this->Sample(name, value);
+	}
+
+	void Flush()
+	{
+		if (buf.empty())
+			return;
+
+		reply.Write(buf);
+		buf.clear();
+	}
+};
+
+class MetricsPage : public HTTPPage
+{
+	ServiceReference<DNS::Manager> dnsmanager;
+
+	void WriteCore(MetricsWriter &w)
+	{
+		w.Gauge("users", "Users currently online", UserListByNick.size());
+		w.Gauge("opers", "Operators currently online", OperCount);
+		w.Gauge("users_max", "Highest number of users seen online", MaxUserCount);
+		w.Gauge("channels", "Channels currently in use", ChannelList.size());
+		w.Gauge("servers", "Servers currently linked", Servers::ByName.size());
+		w.Gauge("registered_nicks", "Registered nicknames", NickAliasList->size());
+		w.Gauge("registered_accounts", "Registered nickname groups", NickCoreList->size());
+		w.Gauge("registered_channels", "Registered channels", RegisteredChannelList->size());
+		w.Gauge("sockets", "Open sockets", SocketEngine::Sockets.size());
+		w.Gauge("uptime_seconds", "Seconds since services started", Anope::CurTime - Anope::StartTime);
+
+		w.Gauge("event_loop_lag_seconds", "Time the last iteration of the main loop was busy for", Watchdog::GetLag());
+		w.Family("event_loop_stalls", "counter", "Iterations of the main loop that ran for longer than options:stallthreshold");
+		w.Sample("event_loop_stalls_total", Watchdog::GetStallCount());
+		w.Family("event_loop_stall_seconds", "counter", "Time spent in stalled iterations of the main loop");
+		w.Sample("event_loop_stall_seconds_total", Watchdog::GetStallTime());
+		w.Gauge("event_loop_longest_stall_seconds", "Longest stall of the main loop", Watchdog::GetLongestStall());
+
+		if (session_service)
+			w.Gauge("sessions", "Tracked sessions", session_service->GetSessions().size());
+	}
+
+	void WriteXLines(MetricsWriter &w)
+	{
+		w.Family("xlines", "gauge", "XLines held by each XLine manager");
+		for (std::list<XLineManager *>::iterator it = XLineManager::XLineManagers.begin(), it_end = XLineManager::XLineManagers.end(); it != it_end; ++it)
+		{
+			XLineManager *xlm = *it;
+			w.Sample("xlines", xlm->GetCount(), Label("manager", xlm->name));
+		}
+	}
+
+	void WriteDNS(MetricsWriter &w)
+	{
+		if (!dnsmanager)
+			return;
+
+		uint64_t hits, misses;
+		size_t entries;
+		dnsmanager->GetCacheStats(hits, misses, entries);
+
+		w.Family("dns_cache_hits", "counter", "DNS requests answered from the cache");
+		w.Sample("dns_cache_hits_total", hits);
+		w.Family("dns_cache_misses", "counter", "Cacheable DNS requests sent to the nameserver");
+		w.Sample("dns_cache_misses_total", misses);
+		w.Gauge("dns_cache_entries", "Records in the DNS cache", entries);
+		w.Gauge("dns_cache_hit_ratio", "Fraction of cacheable DNS requests answered from the cache", hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0);
+	}
+
+	void WriteSQL(MetricsWriter &w)
+	{
+		std::vector<Anope::string> providers = Service::GetServiceKeys("SQL::Provider");
+		if (providers.empty())
+			return;
+
+		w.Family("sql_queue_depth", "gauge", "Queries waiting to be executed on each SQL provider");
+		for (unsigned i = 0; i < providers.size(); ++i)
+		{
+			ServiceReference<SQL::Provider> sql("SQL::Provider", providers[i]);
+			if (sql)
+				w.Sample("sql_queue_depth", sql->GetQueueSize(), Label("provider", providers[i]));
+		}
+
+		std::vector<uint64_t> commits(providers.size()), rollbacks(providers.size());
+		std::vector<double> seconds(providers.size());
+		for (unsigned i = 0; i < providers.size(); ++i)
+		{
+			ServiceReference<SQL::Provider> sql("SQL::Provider", providers[i]);
+			if (sql)
+				sql->GetTransactionStats(commits[i], rollbacks[i], seconds[i]);
+		}
+
+		w.Family("sql_commits", "counter", "Transactions committed on each SQL provider");
+		for (unsigned i = 0; i < providers.size(); ++i)
+			w.Sample("sql_commits_total", commits[i], Label("provider", providers[i]));
+		w.Family("sql_rollbacks", "counter", "Transactions rolled back on each SQL provider");
+		for (unsigned i = 0; i < providers.size(); ++i)
+			w.Sample("sql_rollbacks_total", rollbacks[i], Label("provider", providers[i]));
+		w.Family("sql_commit_seconds", "counter", "Time from transactions being queued until they were committed on each SQL provider");
+		for (unsigned i = 0; i < providers.size(); ++i)
+			w.Sample("sql_commit_seconds_total", seconds[i], Label("provider", providers[i]));
+	}
+
+	void WriteMemory(MetricsWriter &w)
+	{
+		const std::list<MemoryCounter *> &counters = MemoryCounter::GetCounters();
+
+		w.Family("memory_objects", "gauge", "Live objects of each kind tracked by a memory counter");
+		for (std::list<MemoryCounter *>::const_iterator it = counters.begin(), it_end = counters.end(); it != it_end; ++it)
+		{
+			const MemoryCounter *mc = *it;
+			w.Sample("memory_objects", mc->objects, Label("category", mc->category) + "," + Label("name", mc->name) + "," + Label("module", mc->GetOwnerName()));
+		}
+
+		w.Family("memory_bytes", "gauge", "Approximate memory used by the objects tracked by a memory counter");
+		for (std::list<MemoryCounter *>::const_iterator it = counters.begin(), it_end = counters.end(); it != it_end; ++it)
+		{
+			const MemoryCounter *mc = *it;
+			w.Sample("memory_bytes", mc->bytes, Label("category", mc->category) + "," + Label("name", mc->name) + "," + Label("module", mc->GetOwnerName()));
+		}
+	}
+
+	void WritePools(MetricsWriter &w)
+	{
+		const std::list<SlabPool *> &pools = SlabPool::GetPools();
+
+		w.Family("pool_objects", "gauge", "Objects allocated from each memory pool");
+		for (std::list<SlabPool *>::const_iterator it = pools.begin(), it_end = pools.end(); it != it_end; ++it)
+			w.Sample("pool_objects", (*it)->GetObjects(), Label("pool", (*it)->name));
+
+		w.Family("pool_capacity", "gauge", "Objects each memory pool can hold without growing");
+		for (std::list<SlabPool *>::const_iterator it = pools.begin(), it_end = pools.end(); it != it_end; ++it)
+			w.Sample("pool_capacity", (*it)->GetCapacity(), Label("pool", (*it)->name));
+
+		w.Family("pool_bytes", "gauge", "Memory held by each memory pool");
+		for (std::list<SlabPool *>::const_iterator it = pools.begin(), it_end = pools.end(); it != it_end; ++it)
+			w.Sample("pool_bytes", (*it)->GetBytes(), Label("pool", (*it)->name));
+
+		w.Family("pool_allocations", "counter", "Objects allocated from each memory pool since startup");
+		for (std::list<SlabPool *>::const_iterator it = pools.begin(), it_end = pools.end(); it != it_end; ++it)
+			w.Sample("pool_allocations_total", (*it)->GetAllocations(), Label("pool", (*it)->name));
+	}
+
+	void WriteEvents(MetricsWriter &w)
+	{
+		if (!ModuleManager::ProfileEvents)
+			return;
+
+		w.Family("event_dispatches", "counter", "Module events dispatched, collected when options:profileevents is set");
+		for (unsigned i = 0; i < I_SIZE; ++i)
+			if (ModuleManager::EventProfile[i].name)
+				w.Sample("event_dispatches_total", ModuleManager::EventProfile[i].calls, Label("event", ModuleManager::EventProfile[i].name));
+
+		w.Family("event_dispatch_seconds", "counter", "Time spent dispatching module events, collected when options:profileevents is set");
+		for (unsigned i = 0; i < I_SIZE; ++i)
+			if (ModuleManager::EventProfile[i].name)
+				w.Sample("event_dispatch_seconds_total", ModuleManager::EventProfile[i].time, Label("event", ModuleManager::EventProfile[i].name));
+	}
+
+	void WriteSerialize(MetricsWriter &w)
+	{
+		const std::map<Anope::string, Serialize::Type *> &types = Serialize::Type::GetTypes();
+
+		w.Family("serialize_objects", "gauge", "Objects of each serializable type");
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = types.begin(), it_end = types.end(); it != it_end; ++it)
+			w.Sample("serialize_objects", it->second->objects.size(), Label("type", it->first));
+
+		w.Family("serialize_bytes", "gauge", "Approximate memory used by the objects of each serializable type");
+		for (std::map<Anope::string, Serialize::Type *>::const_iterator it = types.begin(), it_end = types.end(); it != it_end; ++it)
+			w.Sample("serialize_bytes", Serializable::GetMemoryCounter(it->first)->bytes, Label("type", it->first));
+	}
+
+ public:
+	MetricsPage() : HTTPPage("/metrics", "application/openmetrics-text; version=1.0.0; charset=utf-8"), dnsmanager("DNS::Manager", "dns/manager") { }
+
+	bool OnRequest(HTTPProvider *server, const Anope::string &page_name, HTTPClient *client, HTTPMessage &message, HTTPReply &reply) anope_override
+	{
+		/* Each section is sent as it is finished, so the whole exposition is never held twice */
+		typedef void (MetricsPage::*Section)(MetricsWriter &);
+		static const Section sections[] = { &MetricsPage::WriteCore, &MetricsPage::WriteXLines, &MetricsPage::WriteDNS, &MetricsPage::WriteSQL,
+			&MetricsPage::WriteEvents, &MetricsPage::WriteMemory, &MetricsPage::WritePools, &MetricsPage::WriteSerialize };
+
+		for (unsigned i = 0; i < sizeof(sections) / sizeof(*sections); ++i)
+		{
+			{
+				MetricsWriter w(reply);
+				(this->*sections[i])(w);
+			}
+
+			client->SendChunk(&reply);
+		}
+
+		reply.Write("# EOF\n");
+		return true;
+	}
+};
+
+class ModulePrometheus : public Module
+{
+	ServiceReference<HTTPProvider> httpref;
+	MetricsPage page;
+
+ public:
+	ModulePrometheus(const Anope::string &modname, const Anope::string &creator) : Module(modname, creator, EXTRA | VENDOR)
+	{
+	}
+
+	~ModulePrometheus()
+	{
+		if (httpref)
+			httpref->UnregisterPage(&page);
+	}
+
+	void OnReload(Configuration::Conf *conf) anope_override
+	{
+		ServiceReference<HTTPProvider> provider("HTTPProvider", conf->GetModule(this)->Get<const Anope::string>("server", "httpd/main"));
+		if (!provider)
+			throw ConfigException("Unable to find http reference, is m_httpd loaded?");
+
+		if (httpref)
+			httpref->UnregisterPage(&page);
+
+		this->httpref = provider;
+		httpref->RegisterPage(&page);
+	}
+};
+
+MODULE_INIT(ModulePrometheus)
@@ -17,19 +17,44 @@ class MyRedisService;
 
 class RedisSocket : public BinarySocket, public ConnectionSocket
 {
-	size_t ParseReply(Reply &r, const char *buf, size_t l);
+	/* Encoded commands waiting to be sent, and how much of them has been sent */
+	std::vector<char> sendq;
+	size_t sent;
+
+	/* Received data which does not yet make up a whole element of a reply */
+	std::vector<char> recvq;
+
+	/* The reply being parsed */
+	Reply reply;
+	/* The multi bulk replies within it which are still missing elements, innermost last */
+	std::vector<Reply *> incomplete;
+
+	/* Reply nodes kept for reuse, so parsing large replies does not allocate once warmed up */
+	std::vector<Reply *> pool;
+
+	size_t ParseElement(const char *buf, size_t l);
+	Reply *NewReply();
+	void Recycle(Reply &r);
+	void Dispatch();
  public:
 	MyRedisService *provider;
 	std::deque<Interface *> interfaces;
 	std::map<Anope::string, Interface *> subinterfaces;
 
-	RedisSocket(MyRedisService *pro, bool v6) : Socket(-1, v6), provider(pro) { }
+	RedisSocket(MyRedisService *pro, bool v6) : Socket(-1, v6), sent(0), provider(pro) { }
 
 	~RedisSocket();
 
 	void OnConnect() anope_override;
 	void OnError(const Anope::string &error) anope_override;
 
+	/** Encode a command straight into the send queue
+	 * @param args The command and its arguments
+	 */
+	void WriteCommand(const std::vector<std::pair<const char *, size_t> > &args);
+
+	bool ProcessWrite() anope_override;
+
 	bool Read(const char *buffer, size_t l) anope_override;
 };
 
@@ -115,40 +140,10 @@ class MyRedisService : public Provider
 	}
 
  private:
-	inline void Pack(std::vector<char> &buffer, const char *buf, size_t sz = 0)
-	{
-		if (!sz)
-			sz = strlen(buf);
-
-		size_t old_size = buffer.size();
-		buffer.resize(old_size + sz);
-		std::copy(buf, buf + sz, buffer.begin() + old_size);
-	}
-
 	void Send(RedisSocket *s, Interface *i, const std::vector<std::pair<const char *, size_t> > &args)
 	{
-		std::vector<char> buffer;
-
-		Pack(buffer, "*");
-		Pack(buffer, stringify(args.size()).c_str());
-		Pack(buffer, "\r\n");
+		s->WriteCommand(args);
 
-		for (unsigned j = 0; j < args.size(); ++j)
-		{
-			const std::pair<const char *, size_t> &pair = args[j];
-
-			Pack(buffer, "$");
-			Pack(buffer, stringify(pair.second).c_str());
-			Pack(buffer, "\r\n");
-
-			Pack(buffer, pair.first, pair.second);
-			Pack(buffer, "\r\n");
-		}
-
-		if (buffer.empty())
-			return;
-
-		s->Write(&buffer[0], buffer.size());
 		if (in_transaction)
 		{
 			ti.interfaces.push_back(i);
@@ -252,6 +247,55 @@ class MyRedisService : public Provider
 	}
 };
 
+/* The most reply nodes kept for reuse per socket */
+static const size_t max_pool = 4096;
+
+/** Write a RESP header, such as *3 or $5, followed by CRLF
+ * @return The end of what was written
+ */
+static char *WriteHeader(char *p, char prefix, size_t n)
+{
+	char digits[20];
+	int len = 0;
+
+	do
+		digits[len++] = '0' + n % 10;
+	while (n /= 10);
+
+	*p++ = prefix;
+	while (len)
+		*p++ = digits[--len];
+	*p++ = '\r';
+	*p++ = '\n';
+
+	return p;
+}
+
+/** Parse an integer from a RESP header
+ * @return false if it is not a valid integer
+ */
+static bool ParseInteger(const char *p, const char *end, int64_t &value)
+{
+	bool negative = p != end && *p == '-';
+	if (negative)
+		++p;
+
+	if (p == end)
+		return false;
+
+	value = 0;
+	for (; p != end; ++p)
+	{
+		if (*p < '0' || *p > '9')
+			return false;
+		value = value * 10 + (*p - '0');
+	}
+
+	if (negative)
+		value = -value;
+	return true;
+}
+
 RedisSocket::~RedisSocket()
 {
 	if (provider)
@@ -271,6 +315,9 @@ RedisSocket::~RedisSocket()
 
 		inter->OnError("Interface going away");
 	}
+
+	for (unsigned i = 0; i < pool.size(); ++i)
+		delete pool[i];
 }
 
 void RedisSocket::OnConnect()
@@ -291,235 +338,275 @@ void RedisSocket::OnError(const Anope::string &error)
 	Log() << "redis: Error on " << provider->name << (this == this->provider->sub ? " (sub)" : "") << ": " << error;
 }
 
-size_t RedisSocket::ParseReply(Reply &r, const char *buffer, size_t l)
+void RedisSocket::WriteCommand(const std::vector<std::pair<const char *, size_t> > &args)
 {
-	size_t used = 0;
+	/* Headers are at most 24 bytes, so make room for the worst case and trim the rest after */
+	size_t size = 24 * (args.size() + 1);
+	for (unsigned j = 0; j < args.size(); ++j)
+		size += args[j].second + 2;
+
+	size_t old_size = this->sendq.size();
+	this->sendq.resize(old_size + size);
+	char *p = &this->sendq[old_size];
+
+	p = WriteHeader(p, '*', args.size());
+	for (unsigned j = 0; j < args.size(); ++j)
+	{
+		const std::pair<const char *, size_t> &pair = args[j];
 
-	if (!l)
-		return used;
+		p = WriteHeader(p, '$', pair.second);
+		memcpy(p, pair.first, pair.second);
+		p += pair.second;
+		*p++ = '\r';
+		*p++ = '\n';
+	}
 
-	if (r.type == Reply::MULTI_BULK)
-		goto multi_bulk_cont;
+	this->sendq.resize(p - &this->sendq[0]);
+	SocketEngine::Change(this, true, SF_WRITABLE);
+}
 
-	switch (*buffer)
+bool RedisSocket::ProcessWrite()
+{
+	if (this->sent < this->sendq.size())
 	{
-		case '+':
+		/* Everything queued goes out in one send, however many commands it is */
+		int len = this->io->Send(this, &this->sendq[this->sent], this->sendq.size() - this->sent);
+		if (len <= -1)
+			return false;
+
+		this->sent += len;
+		if (this->sent == this->sendq.size())
 		{
-			Anope::string reason(buffer, 1, l - 1);
-			size_t nl = reason.find("\r\n");
-			Log(LOG_DEBUG_2) << "redis: status ok: " << reason.substr(0, nl);
-			if (nl != Anope::string::npos)
-			{
-				r.type = Reply::OK;
-				used = 1 + nl + 2;
-			}
-			break;
+			this->sendq.clear();
+			this->sent = 0;
 		}
-		case '-':
+		else if (this->sent > this->sendq.size() / 2)
 		{
-			Anope::string reason(buffer, 1, l - 1);
-			size_t nl = reason.find("\r\n");
-			Log(LOG_DEBUG) << "redis: status error: " << reason.substr(0, nl);
-			if (nl != Anope::string::npos)
-			{
-				r.type = Reply::NOT_OK;
-				used = 1 + nl + 2;
-			}
-			break;
+			this->sendq.erase(this->sendq.begin(), this->sendq.begin() + this->sent);
+			this->sent = 0;
 		}
-		case ':':
-		{
-			Anope::string ibuf(buffer, 1, l - 1);
-			size_t nl = ibuf.find("\r\n");
-			if (nl != Anope::string::npos)
-			{
-				try
-				{
-					r.i = convertTo<int64_t>(ibuf.substr(0, nl));
-				}
-				catch (const ConvertException &) { }
+	}
 
-				r.type = Reply::INT;
-				used = 1 + nl + 2;
-			}
+	if (this->sendq.empty())
+		SocketEngine::Change(this, false, SF_WRITABLE);
+
+	return true;
+}
+
+Reply *RedisSocket::NewReply()
+{
+	if (this->pool.empty())
+		return new Reply();
+
+	Reply *r = this->pool.back();
+	this->pool.pop_back();
+	return r;
+}
+
+void RedisSocket::Recycle(Reply &r)
+{
+	for (unsigned j = 0; j < r.multi_bulk.size(); ++j)
+	{
+		Reply *child = r.multi_bulk[j];
+
+		this->Recycle(*child);
+
+		if (this->pool.size() < max_pool)
+			this->pool.push_back(child);
+		else
+			delete child;
+	}
+	r.multi_bulk.clear();
+
+	/* Clearing the bulk keeps its storage, so the next reply using this node can reuse it */
+	r.type = Reply::NOT_PARSED;
+	r.i = 0;
+	r.bulk.clear();
+	r.multi_bulk_size = 0;
+}
+
+size_t RedisSocket::ParseElement(const char *buf, size_t l)
+{
+	const char *end = buf + l;
+
+	/* Every element starts with a type and a line ending in CRLF */
+	const char *nl = static_cast<const char *>(memchr(buf, '\n', l));
+	if (!nl)
+		return 0;
+	if (nl == buf || nl[-1] != '\r')
+	{
+		Log(LOG_DEBUG) << "redis: malformed reply from " << provider->name;
+		return static_cast<size_t>(-1);
+	}
+
+	const char *line = buf + 1, *line_end = nl - 1;
+	size_t used = nl + 1 - buf;
+
+	Reply::Type type;
+	int64_t n = 0;
+	switch (*buf)
+	{
+		case '+':
+			type = Reply::OK;
+			break;
+		case '-':
+			type = Reply::NOT_OK;
+			break;
+		case ':':
+			type = Reply::INT;
 			break;
-		}
 		case '$':
-		{
-			Anope::string reply(buffer + 1, l - 1);
-			/* This assumes one bulk can always fit in our recv buffer */
-			size_t nl = reply.find("\r\n");
-			if (nl != Anope::string::npos)
-			{
-				int len;
-				try
-				{
-					len = convertTo<int>(reply.substr(0, nl));
-					if (len >= 0)
-					{
-						if (1 + nl + 2 + len + 2 <= l)
-						{
-							used = 1 + nl + 2 + len + 2;
-							r.bulk = reply.substr(nl + 2, len);
-							r.type = Reply::BULK;
-						}
-					}
-					else
-					{
-						used = 1 + nl + 2 + 2;
-						r.type = Reply::BULK;
-					}
-				}
-				catch (const ConvertException &) { }
-			}
+			type = Reply::BULK;
 			break;
-		}
-		multi_bulk_cont:
 		case '*':
+			type = Reply::MULTI_BULK;
+			break;
+		default:
+			Log(LOG_DEBUG) << "redis: unknown reply " << *buf;
+			return static_cast<size_t>(-1);
+	}
+
+	if (type == Reply::INT || type == Reply::BULK || type == Reply::MULTI_BULK)
+	{
+		if (!ParseInteger(line, line_end, n) || (type == Reply::MULTI_BULK && n > 0x7FFFFFFF))
 		{
-			if (r.type != Reply::MULTI_BULK)
-			{
-				Anope::string reply(buffer + 1, l - 1);
-				size_t nl = reply.find("\r\n");
-				if (nl != Anope::string::npos)
-				{
-					r.type = Reply::MULTI_BULK;
-					try
-					{
-						r.multi_bulk_size = convertTo<int>(reply.substr(0, nl));
-					}
-					catch (const ConvertException &) { }
+			Log(LOG_DEBUG) << "redis: invalid length in reply from " << provider->name;
+			return static_cast<size_t>(-1);
+		}
 
-					used = 1 + nl + 2;
-				}
-				else
-					break;
-			}
-			else if (r.multi_bulk_size >= 0 && r.multi_bulk.size() == static_cast<unsigned>(r.multi_bulk_size))
+		/* Wait until the whole bulk is here, it is copied straight out of the buffer */
+		if (type == Reply::BULK && n >= 0 && static_cast<uint64_t>(end - nl - 1) < static_cast<uint64_t>(n) + 2)
+			return 0;
+	}
+
+	Reply *r;
+	if (this->incomplete.empty())
+		r = &this->reply;
+	else
+	{
+		r = this->NewReply();
+		this->incomplete.back()->multi_bulk.push_back(r);
+	}
+
+	r->type = type;
+	switch (type)
+	{
+		case Reply::OK:
+		case Reply::NOT_OK:
+			r->bulk.str().assign(line, line_end - line);
+			if (type == Reply::OK)
+				Log(LOG_DEBUG_2) << "redis: status ok: " << r->bulk;
+			else
+				Log(LOG_DEBUG) << "redis: status error: " << r->bulk;
+			break;
+		case Reply::INT:
+			r->i = n;
+			break;
+		case Reply::BULK:
+			if (n >= 0)
 			{
-				/* This multi bulk is already complete, so check the sub bulks */
-				for (unsigned i = 0; i < r.multi_bulk.size(); ++i)
-					if (r.multi_bulk[i]->type == Reply::MULTI_BULK)
-						ParseReply(*r.multi_bulk[i], buffer + used, l - used);
-				break;
+				r->bulk.str().assign(nl + 1, n);
+				used += n + 2;
 			}
-
-			for (int i = r.multi_bulk.size(); i < r.multi_bulk_size; ++i)
+			break;
+		case Reply::MULTI_BULK:
+			r->multi_bulk_size = n;
+			/* The elements follow */
+			if (n > 0)
 			{
-				Reply *reply = new Reply();
-				size_t u = ParseReply(*reply, buffer + used, l - used);
-				if (!u)
-				{
-					Log(LOG_DEBUG) << "redis: ran out of data to parse";
-					delete reply;
-					break;
-				}
-				r.multi_bulk.push_back(reply);
-				used += u;
+				this->incomplete.push_back(r);
+				return used;
 			}
 			break;
-		}
 		default:
-			Log(LOG_DEBUG) << "redis: unknown reply " << *buffer;
+			break;
 	}
 
+	/* This element is done, which may complete the multi bulk replies it is in */
+	while (!this->incomplete.empty() && this->incomplete.back()->multi_bulk.size() == static_cast<unsigned>(this->incomplete.back()->multi_bulk_size))
+		this->incomplete.pop_back();
+
+	if (this->incomplete.empty())
+		this->Dispatch();
+
 	return used;
 }
 
-bool RedisSocket::Read(const char *buffer, size_t l)
+void RedisSocket::Dispatch()
 {
-	static std::vector<char> save;
-	std::vector<char> copy;
+	Reply &r = this->reply;
 
-	if (!save.empty())
+	if (this == provider->sub)
 	{
-		std::copy(buffer, buffer + l, std::back_inserter(save));
-
-		copy = save;
-
-		buffer = &copy[0];
-		l = copy.size();
-	}
-
-	while (l)
-	{
-		static Reply r;
-
-		size_t used = this->ParseReply(r, buffer, l);
-		if (!used)
+		if (r.multi_bulk.size() == 4)
 		{
-			Log(LOG_DEBUG) << "redis: used == 0 ?";
-			r.Clear();
-			break;
+			/* pmessage
+			 * pattern subscribed to
+			 * __keyevent@0__:set
+			 * key
+			 */
+			std::map<Anope::string, Interface *>::iterator it = this->subinterfaces.find(r.multi_bulk[1]->bulk);
+			if (it != this->subinterfaces.end())
+				it->second->OnResult(r);
 		}
-		else if (used > l)
-		{
-			Log(LOG_DEBUG) << "redis: used > l ?";
-			r.Clear();
-			break;
-		}
-
-		/* Full result is not here yet */
-		if (r.type == Reply::MULTI_BULK && static_cast<unsigned>(r.multi_bulk_size) != r.multi_bulk.size())
-		{
-			buffer += used;
-			l -= used;
-			break;
-		}
-
-		if (this == provider->sub)
+	}
+	else
+	{
+		if (this->interfaces.empty())
 		{
-			if (r.multi_bulk.size() == 4)
-			{
-				/* pmessage
-				 * pattern subscribed to
-				 * __keyevent@0__:set
-				 * key
-				 */
-				std::map<Anope::string, Interface *>::iterator it = this->subinterfaces.find(r.multi_bulk[1]->bulk);
-				if (it != this->subinterfaces.end())
-					it->second->OnResult(r);
-			}
+			Log(LOG_DEBUG) << "redis: no interfaces?";
 		}
 		else
 		{
-			if (this->interfaces.empty())
-			{
-				Log(LOG_DEBUG) << "redis: no interfaces?";
-			}
-			else
-			{
-				Interface *i = this->interfaces.front();
-				this->interfaces.pop_front();
+			Interface *i = this->interfaces.front();
+			this->interfaces.pop_front();
 
-				if (i)
-				{
-					if (r.type != Reply::NOT_OK)
-						i->OnResult(r);
-					else
-						i->OnError(r.bulk);
-				}
+			if (i)
+			{
+				if (r.type != Reply::NOT_OK)
+					i->OnResult(r);
+				else
+					i->OnError(r.bulk);
 			}
 		}
+	}
 
-		buffer += used;
-		l -= used;
+	this->Recycle(r);
+}
 
-		r.Clear();
+bool RedisSocket::Read(const char *buffer, size_t l)
+{
+	/* Only the part of an element which did not fit in the last read is kept, so
+	 * elements are never parsed twice and large replies are not copied around
+	 */
+	bool buffered = !this->recvq.empty();
+	if (buffered)
+	{
+		this->recvq.insert(this->recvq.end(), buffer, buffer + l);
+		buffer = &this->recvq[0];
+		l = this->recvq.size();
 	}
 
-	if (l)
+	size_t pos = 0;
+	while (pos < l)
 	{
-		save.resize(l);
-		std::copy(buffer, buffer + l, save.begin());
+		size_t used = this->ParseElement(buffer + pos, l - pos);
+		if (used == static_cast<size_t>(-1))
+			return false;
+		else if (!used)
+			break;
+
+		pos += used;
 	}
-	else
-		std::vector<char>().swap(save);
+
+	if (buffered)
+		this->recvq.erase(this->recvq.begin(), this->recvq.begin() + pos);
+	else if (pos < l)
+		this->recvq.assign(buffer + pos, buffer + l);
 
 	return true;
 }
 
-
 class ModuleRedis : public Module
 {
 	std::map<Anope::string, MyRedisService *> services;
@@ -154,22 +154,19 @@ class MyXMLRPCEvent : public XMLRPCEvent
 		if (c)
 		{
 			request.reply("bancount", stringify(c->HasMode("BAN")));
-			int count = 0;
-			std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> its = c->GetModeList("BAN");
-			for (; its.first != its.second; ++its.first)
-				request.reply("ban" + stringify(++count), iface->Sanitize(its.first->second));
+			const Channel::EntryList &bans = c->GetModeList("BAN");
+			for (unsigned i = 0; i < bans.size(); ++i)
+				request.reply("ban" + stringify(i + 1), iface->Sanitize(bans[i].GetMask()));
 
 			request.reply("exceptcount", stringify(c->HasMode("EXCEPT")));
-			count = 0;
-			its = c->GetModeList("EXCEPT");
-			for (; its.first != its.second; ++its.first)
-				request.reply("except" + stringify(++count), iface->Sanitize(its.first->second));
+			const Channel::EntryList &excepts = c->GetModeList("EXCEPT");
+			for (unsigned i = 0; i < excepts.size(); ++i)
+				request.reply("except" + stringify(i + 1), iface->Sanitize(excepts[i].GetMask()));
 
 			request.reply("invitecount", stringify(c->HasMode("INVITEOVERRIDE")));
-			count = 0;
-			its = c->GetModeList("INVITEOVERRIDE");
-			for (; its.first != its.second; ++its.first)
-				request.reply("invite" + stringify(++count), iface->Sanitize(its.first->second));
+			const Channel::EntryList &invites = c->GetModeList("INVITEOVERRIDE");
+			for (unsigned i = 0; i < invites.size(); ++i)
+				request.reply("invite" + stringify(i + 1), iface->Sanitize(invites[i].GetMask()));
 
 			Anope::string users;
 			for (Channel::ChanUserList::const_iterator it = c->users.begin(); it != c->users.end(); ++it)
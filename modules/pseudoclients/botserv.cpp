@@ -48,45 +48,56 @@ class BotServCore : public Module
 		}
 	}
 
-	void OnJoinChannel(User *user, Channel *c) anope_override
+	void OnJoinChannelBatch(Channel *c, const std::vector<User *> &users) anope_override
 	{
 		if (!Config || !IRCD)
 			return;
 
-		BotInfo *bi = user->server == Me ? dynamic_cast<BotInfo *>(user) : NULL;
-		if (bi && Config->GetModule(this)->Get<bool>("smartjoin"))
-		{
-			std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> bans = c->GetModeList("BAN");
+		bool smartjoin = Config->GetModule(this)->Get<bool>("smartjoin");
+		bool others = false;
 
-			/* We check for bans */
-			for (; bans.first != bans.second; ++bans.first)
-			{
-				Entry ban("BAN", bans.first->second);
-				if (ban.Matches(user))
-					c->RemoveMode(NULL, "BAN", ban.GetMask());
-			}
+		for (unsigned i = 0; i < users.size(); ++i)
+		{
+			User *user = users[i];
 
-			Anope::string Limit;
-			unsigned limit = 0;
-			try
+			if (user->server != Me)
 			{
-				if (c->GetParam("LIMIT", Limit))
-					limit = convertTo<unsigned>(Limit);
+				others = true;
+				continue;
 			}
-			catch (const ConvertException &) { }
 
-			/* Should we be invited? */
-			if (c->HasMode("INVITE") || (limit && c->users.size() >= limit))
+			BotInfo *bi = dynamic_cast<BotInfo *>(user);
+			if (bi && smartjoin)
 			{
-				ChannelMode *cm = ModeManager::FindChannelModeByName("OP");
-				char symbol = cm ? anope_dynamic_static_cast<ChannelModeStatus *>(cm)->symbol : 0;
-				IRCD->SendNotice(bi, (symbol ? Anope::string(symbol) : "") + c->name, "%s invited %s into the channel.", user->nick.c_str(), user->nick.c_str());
+				/* We check for bans, removing them changes the list */
+				const Channel::EntryList bans = c->GetModeList("BAN");
+				for (unsigned j = 0; j < bans.size(); ++j)
+					if (bans[j].Matches(user))
+						c->RemoveMode(NULL, "BAN", bans[j].GetMask());
+
+				Anope::string Limit;
+				unsigned limit = 0;
+				try
+				{
+					if (c->GetParam("LIMIT", Limit))
+						limit = convertTo<unsigned>(Limit);
+				}
+				catch (const ConvertException &) { }
+
+				/* Should we be invited? */
+				if (c->HasMode("INVITE") || (limit && c->users.size() >= limit))
+				{
+					ChannelMode *cm = ModeManager::FindChannelModeByName("OP");
+					char symbol = cm ? anope_dynamic_static_cast<ChannelModeStatus *>(cm)->symbol : 0;
+					IRCD->SendNotice(bi, (symbol ? Anope::string(symbol) : "") + c->name, "%s invited %s into the channel.", user->nick.c_str(), user->nick.c_str());
+				}
+
+				ModeManager::ProcessModes();
 			}
-
-			ModeManager::ProcessModes();
 		}
 
-		if (user->server != Me && c->ci && c->ci->bi)
+		/* The bot only needs to be checked once for the whole batch */
+		if (others && c->ci && c->ci->bi)
 		{
 			/**
 			 * We let the bot join even if it was an ignored user, as if we don't,
@@ -421,15 +421,10 @@ class ChanServCore : public Module, public ChanServService
 			ci->c->SetMode(NULL, "PERM");
 	}
 
-	void OnJoinChannel(User *u, Channel *c) anope_override
+	void OnCheckTS(Channel *c, time_t &ts) anope_override
 	{
-		if (always_lower && c->ci && c->creation_time > c->ci->time_registered)
-		{
-			Log(LOG_DEBUG) << "Changing TS of " << c->name << " from " << c->creation_time << " to " << c->ci->time_registered;
-			c->creation_time = c->ci->time_registered;
-			IRCD->SendChannel(c);
-			c->Reset();
-		}
+		if (always_lower && c->ci && ts > c->ci->time_registered)
+			ts = c->ci->time_registered;
 	}
 
 	EventReturn OnChannelModeSet(Channel *c, MessageSource &setter, ChannelMode *mode, const Anope::string &param) anope_override
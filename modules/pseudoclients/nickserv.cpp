@@ -33,6 +33,13 @@ class NickServCollide : public Timer
 		if (u->Account() == na->nc || u->timestamp > ts)
 			return;
 
+		/* Their server split, wait and see if they come back (options:splitgrace) */
+		if (!u->server)
+		{
+			new NickServCollide(service, u, na, 10);
+			return;
+		}
+
 		service->Collide(u, na);
 	}
 };
@@ -482,7 +489,8 @@ class NickServCore : public Module, public NickServService
 
 	void OnUserQuit(User *u, const Anope::string &msg)
 	{
-		if (u->server && !u->server->GetQuitReason().empty() && Config->GetModule(this)->Get<bool>("hidenetsplitquit"))
+		/* Users without a server were parked by options:splitgrace and never came back */
+		if ((!u->server || !u->server->GetQuitReason().empty()) && Config->GetModule(this)->Get<bool>("hidenetsplitquit"))
 			return;
 
 		/* Update last quit and last seen for the user */
@@ -103,7 +103,7 @@ class WebPanelProtectedPage : public WebPanelPage
 
 		Anope::string sections, get;
 
-		for (std::map<Anope::string, Anope::string>::iterator it = message.get_data.begin(), it_end = message.get_data.end(); it != it_end; ++it)
+		for (HTTPFields::iterator it = message.get_data.begin(), it_end = message.get_data.end(); it != it_end; ++it)
 			if (this->GetData().count(it->first) > 0)
 				get += "&" + it->first + "=" + HTTPUtils::URLEncode(it->second);
 		if (get.empty() == false)
@@ -0,0 +1,139 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#include "services.h"
+#include "atom.h"
+#include "memstats.h"
+
+using Anope::Atom;
+
+Atom::Node Atom::Empty("", 0);
+
+namespace
+{
+	/** The set of interned strings, an open addressing table of nodes */
+	struct AtomPool
+	{
+		/* Number of slots, always a power of 2 */
+		size_t capacity;
+		/* Number of used slots */
+		size_t count;
+		Atom::Node **slots;
+		MemoryCounter memory;
+
+		AtomPool() : capacity(1024), count(0), slots(new Atom::Node *[capacity]()), memory("core", "Atom") { }
+
+		size_t Home(size_t hash) const
+		{
+			return hash & (this->capacity - 1);
+		}
+
+		/** Find the slot of a string, or the empty slot it belongs in */
+		size_t Locate(const Anope::string &value, size_t hash) const
+		{
+			size_t i = this->Home(hash);
+			while (this->slots[i] && (this->slots[i]->hash != hash || this->slots[i]->value != value))
+				i = (i + 1) & (this->capacity - 1);
+			return i;
+		}
+
+		void Rehash(size_t newcapacity)
+		{
+			Atom::Node **old = this->slots;
+			size_t oldcapacity = this->capacity;
+
+			this->capacity = newcapacity;
+			this->slots = new Atom::Node *[newcapacity]();
+
+			for (size_t i = 0; i < oldcapacity; ++i)
+				if (old[i])
+				{
+					size_t j = this->Home(old[i]->hash);
+					while (this->slots[j])
+						j = (j + 1) & (this->capacity - 1);
+					this->slots[j] = old[i];
+				}
+
+			delete [] old;
+		}
+
+		static size_t NodeSize(const Atom::Node *n)
+		{
+			return sizeof(Atom::Node) + sizeof(Atom::Node *) + n->value.length() + 1;
+		}
+	};
+
+	/* This is on the heap and never freed, as atoms can be static and
+	 * outlive any static pool.
+	 */
+	AtomPool *Pool;
+}
+
+Atom::Node *Atom::Acquire(const Anope::string &value)
+{
+	if (value.empty())
+		return &Empty;
+
+	if (!Pool)
+		Pool = new AtomPool();
+
+	size_t hash = Anope::hash_cs()(value);
+	size_t i = Pool->Locate(value, hash);
+	if (Pool->slots[i])
+		return Pool->slots[i];
+
+	/* Keep the table at most 3/4 full */
+	if ((Pool->count + 1) * 4 > Pool->capacity * 3)
+	{
+		Pool->Rehash(Pool->capacity * 2);
+		i = Pool->Locate(value, hash);
+	}
+
+	Node *n = new Node(value, hash);
+	Pool->slots[i] = n;
+	++Pool->count;
+	Pool->memory.Allocate(AtomPool::NodeSize(n));
+	return n;
+}
+
+void Atom::Release(Node *n)
+{
+	if (n == &Empty)
+		return;
+
+	size_t i = Pool->Locate(n->value, n->hash);
+
+	/* Shift back the entries after this one which are not in their home slot,
+	 * so lookups never need to skip over deleted slots.
+	 */
+	const size_t mask = Pool->capacity - 1;
+	for (size_t j = (i + 1) & mask; Pool->slots[j]; j = (j + 1) & mask)
+	{
+		size_t home = Pool->Home(Pool->slots[j]->hash);
+		if (((j - home) & mask) >= ((j - i) & mask))
+		{
+			Pool->slots[i] = Pool->slots[j];
+			i = j;
+		}
+	}
+	Pool->slots[i] = NULL;
+	--Pool->count;
+
+	Pool->memory.Free(AtomPool::NodeSize(n));
+	delete n;
+
+	/* Give memory back after large splits */
+	if (Pool->capacity > 1024 && Pool->count * 8 < Pool->capacity)
+		Pool->Rehash(Pool->capacity / 2);
+}
+
+size_t Atom::PoolSize()
+{
+	return Pool ? Pool->count : 0;
+}
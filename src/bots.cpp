@@ -115,12 +115,12 @@ void BotInfo::GenerateUID()
 	if (!this->uid.empty())
 	{
 		BotListByUID->erase(this->uid);
-		UserListByUID.erase(this->uid);
+		UserListByUID.Erase(this->uid);
 	}
 
 	this->uid = Servers::TS6_UID_Retrieve();
 	(*BotListByUID)[this->uid] = this;
-	UserListByUID[this->uid] = this;
+	UserListByUID.Set(this->uid, this);
 }
 
 void BotInfo::OnKill()
@@ -199,7 +199,10 @@ void BotInfo::Join(Channel *c, ChannelStatus *status)
 	if (IRCD)
 		IRCD->SendJoin(this, c, status);
 
-	FOREACH_MOD(OnJoinChannel, (this, c));
+	c->CheckTS();
+
+	std::vector<User *> joined(1, this);
+	FOREACH_MOD(OnJoinChannelBatch, (c, joined));
 }
 
 void BotInfo::Join(const Anope::string &chname, ChannelStatus *status)
@@ -25,18 +25,29 @@
 #include "sockets.h"
 #include "language.h"
 #include "uplink.h"
+#include "memstats.h"
 
 channel_map ChannelList;
 
+static MemoryCounter ChannelMemory("core", "Channel"), ChanUserMemory("core", "ChanUserContainer");
+static SlabPool ChannelPool("Channel", sizeof(Channel)), ChanUserPool("ChanUserContainer", sizeof(ChanUserContainer));
+static const size_t ChannelSize = sizeof(Channel) + MemoryCounter::HashNode(sizeof(std::pair<Anope::string, Channel *>));
+/* A ChanUserContainer is in both the user's and the channel's map */
+static const size_t ChanUserSize = sizeof(ChanUserContainer) + MemoryCounter::TreeNode(sizeof(std::pair<User *, ChanUserContainer *>)) + MemoryCounter::TreeNode(sizeof(std::pair<Channel *, ChanUserContainer *>));
+
 Channel::Channel(const Anope::string &nname, time_t ts)
 {
 	if (nname.empty())
 		throw CoreException("A channel without a name ?");
 
+	ChannelMemory.Allocate(ChannelSize);
+
 	this->name = nname;
 
 	this->creation_time = ts;
 	this->syncing = this->botchannel = false;
+	this->sync_server = NULL;
+	this->sync_prev = this->sync_next = NULL;
 	this->server_modetime = this->chanserv_modetime = 0;
 	this->server_modecount = this->chanserv_modecount = this->bouncy_modes = this->topic_ts = this->topic_time = 0;
 
@@ -55,6 +66,10 @@ Channel::~Channel()
 	FOREACH_MOD(OnChannelDelete, (this));
 
 	ModeManager::StackerDel(this);
+	ChannelMemory.Free(ChannelSize);
+
+	if (this->sync_server)
+		this->sync_server->DelSyncingChannel(this);
 
 	if (Me && Me->IsSynced())
 		Log(NULL, this, "destroy");
@@ -67,7 +82,9 @@ Channel::~Channel()
 
 void Channel::Reset()
 {
-	this->modes.clear();
+	this->mode_set.reset();
+	this->mode_params.clear();
+	this->mode_lists.clear();
 
 	for (ChanUserList::const_iterator it = this->users.begin(), it_end = this->users.end(); it != it_end; ++it)
 	{
@@ -97,6 +114,8 @@ void Channel::Reset()
 
 void Channel::Sync()
 {
+	if (this->sync_server)
+		this->sync_server->DelSyncingChannel(this);
 	syncing = false;
 	FOREACH_MOD(OnChannelSync, (this));
 	CheckModes();
@@ -137,12 +156,58 @@ bool Channel::CheckDelete()
 	return MOD_RESULT != EVENT_STOP && this->users.empty();
 }
 
+bool Channel::CheckTS()
+{
+	time_t ts = this->creation_time;
+	FOREACH_MOD(OnCheckTS, (this, ts));
+
+	if (ts >= this->creation_time)
+		return false;
+
+	Log(LOG_DEBUG) << "Changing TS of " << this->name << " from " << this->creation_time << " to " << ts;
+	this->creation_time = ts;
+	IRCD->SendChannel(this);
+	this->Reset();
+	return true;
+}
+
+void *ChanUserContainer::operator new(size_t size)
+{
+	if (size == sizeof(ChanUserContainer))
+		return ChanUserPool.Allocate();
+	return ::operator new(size);
+}
+
+void ChanUserContainer::operator delete(void *ptr, size_t size)
+{
+	if (size == sizeof(ChanUserContainer))
+		ChanUserPool.Deallocate(ptr);
+	else
+		::operator delete(ptr);
+}
+
+void *Channel::operator new(size_t size)
+{
+	if (size == sizeof(Channel))
+		return ChannelPool.Allocate();
+	return ::operator new(size);
+}
+
+void Channel::operator delete(void *ptr, size_t size)
+{
+	if (size == sizeof(Channel))
+		ChannelPool.Deallocate(ptr);
+	else
+		::operator delete(ptr);
+}
+
 ChanUserContainer* Channel::JoinUser(User *user, const ChannelStatus *status)
 {
 	if (user->server && user->server->IsSynced())
 		Log(user, this, "join");
 
 	ChanUserContainer *cuc = new ChanUserContainer(user, this);
+	ChanUserMemory.Allocate(ChanUserSize);
 	user->chans[this] = cuc;
 	this->users[user] = cuc;
 	if (status)
@@ -164,6 +229,8 @@ void Channel::DeleteUser(User *user)
 
 	if (!user->chans.erase(this))
 		Log(LOG_DEBUG) << "Channel::DeleteUser() tried to delete nonexistant channel " << this->name << " from " << user->nick << "'s channel list";
+	if (cu)
+		ChanUserMemory.Free(ChanUserSize);
 	delete cu;
 
 	if (this->CheckDelete())
@@ -198,13 +265,64 @@ bool Channel::HasUserStatus(User *u, const Anope::string &mname)
 	return HasUserStatus(u, anope_dynamic_static_cast<ChannelModeStatus *>(ModeManager::FindChannelModeByName(mname)));
 }
 
+Anope::string *Channel::FindParam(unsigned id)
+{
+	for (unsigned i = 0; i < this->mode_params.size(); ++i)
+		if (this->mode_params[i].first == id)
+			return &this->mode_params[i].second;
+	return NULL;
+}
+
+const Anope::string *Channel::FindParam(unsigned id) const
+{
+	for (unsigned i = 0; i < this->mode_params.size(); ++i)
+		if (this->mode_params[i].first == id)
+			return &this->mode_params[i].second;
+	return NULL;
+}
+
+Channel::EntryList *Channel::FindList(unsigned id, bool create)
+{
+	for (unsigned i = 0; i < this->mode_lists.size(); ++i)
+		if (this->mode_lists[i].first == id)
+			return &this->mode_lists[i].second;
+
+	if (!create)
+		return NULL;
+
+	this->mode_lists.push_back(std::make_pair(id, EntryList()));
+	return &this->mode_lists.back().second;
+}
+
+const Channel::EntryList *Channel::FindList(unsigned id) const
+{
+	for (unsigned i = 0; i < this->mode_lists.size(); ++i)
+		if (this->mode_lists[i].first == id)
+			return &this->mode_lists[i].second;
+	return NULL;
+}
+
 size_t Channel::HasMode(const Anope::string &mname, const Anope::string &param)
 {
+	ChannelMode *cm = ModeManager::FindChannelModeByName(mname);
+	if (!cm || cm->id >= ModeManager::MaxChannelModes || !this->mode_set[cm->id])
+		return 0;
+
+	if (cm->type != MODE_LIST)
+	{
+		if (param.empty())
+			return 1;
+		const Anope::string *p = this->FindParam(cm->id);
+		return p && p->equals_ci(param) ? 1 : 0;
+	}
+
+	const EntryList *list = this->FindList(cm->id);
+	if (!list)
+		return 0;
 	if (param.empty())
-		return modes.count(mname);
-	std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> its = this->GetModeList(mname);
-	for (; its.first != its.second; ++its.first)
-		if (its.first->second.equals_ci(param))
+		return list->size();
+	for (unsigned i = 0; i < list->size(); ++i)
+		if ((*list)[i].GetMask().equals_ci(param))
 			return 1;
 	return 0;
 }
@@ -213,39 +331,92 @@ Anope::string Channel::GetModes(bool complete, bool plus)
 {
 	Anope::string res, params;
 
-	for (std::multimap<Anope::string, Anope::string>::const_iterator it = this->modes.begin(), it_end = this->modes.end(); it != it_end; ++it)
+	for (unsigned i = 0; i < ModeManager::MaxChannelModes; ++i)
 	{
-		ChannelMode *cm = ModeManager::FindChannelModeByName(it->first);
+		if (!this->mode_set[i])
+			continue;
+
+		ChannelMode *cm = ModeManager::FindChannelModeById(i);
 		if (!cm || cm->type == MODE_LIST)
 			continue;
 
 		res += cm->mchar;
 
-		if (complete && !it->second.empty())
+		const Anope::string *param = cm->type == MODE_PARAM ? this->FindParam(i) : NULL;
+		if (complete && param && !param->empty())
 		{
-			ChannelModeParam *cmp = NULL;
-			if (cm->type == MODE_PARAM)
-				cmp = anope_dynamic_static_cast<ChannelModeParam *>(cm);
+			ChannelModeParam *cmp = anope_dynamic_static_cast<ChannelModeParam *>(cm);
 
-			if (plus || !cmp || !cmp->minus_no_arg)
-				params += " " + it->second;
+			if (plus || !cmp->minus_no_arg)
+				params += " " + *param;
 		}
 	}
 
 	return res + params;
 }
 
-const Channel::ModeList &Channel::GetModes() const
+Channel::ModeList Channel::GetModes() const
+{
+	ModeList ml;
+
+	for (unsigned i = 0; i < ModeManager::MaxChannelModes; ++i)
+	{
+		if (!this->mode_set[i])
+			continue;
+
+		ChannelMode *cm = ModeManager::FindChannelModeById(i);
+		if (!cm)
+			continue;
+
+		if (cm->type == MODE_LIST)
+		{
+			const EntryList *list = this->FindList(i);
+			if (list)
+				for (unsigned j = 0; j < list->size(); ++j)
+					ml.insert(std::make_pair(cm->name, (*list)[j].GetMask()));
+		}
+		else
+		{
+			const Anope::string *param = this->FindParam(i);
+			ml.insert(std::make_pair(cm->name, param ? *param : ""));
+		}
+	}
+
+	return ml;
+}
+
+const Channel::EntryList &Channel::GetModeList(const Anope::string &mname) const
 {
-	return this->modes;
+	static const EntryList empty;
+
+	ChannelMode *cm = ModeManager::FindChannelModeByName(mname);
+	if (!cm || cm->type != MODE_LIST)
+		return empty;
+
+	const EntryList *list = this->FindList(cm->id);
+	return list ? *list : empty;
 }
 
-std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> Channel::GetModeList(const Anope::string &mname)
+void Channel::ForgetMode(ChannelMode *cm)
 {
-	Channel::ModeList::iterator it = this->modes.find(mname), it_end = it;
-	if (it != this->modes.end())
-		it_end = this->modes.upper_bound(mname);
-	return std::make_pair(it, it_end);
+	if (cm->id >= ModeManager::MaxChannelModes)
+		return;
+
+	this->mode_set.reset(cm->id);
+
+	for (unsigned i = 0; i < this->mode_params.size(); ++i)
+		if (this->mode_params[i].first == cm->id)
+		{
+			this->mode_params.erase(this->mode_params.begin() + i);
+			break;
+		}
+
+	for (unsigned i = 0; i < this->mode_lists.size(); ++i)
+		if (this->mode_lists[i].first == cm->id)
+		{
+			this->mode_lists.erase(this->mode_lists.begin() + i);
+			break;
+		}
 }
 
 void Channel::SetModeInternal(MessageSource &setter, ChannelMode *ocm, const Anope::string &oparam, bool enforce_mlock)
@@ -290,12 +461,24 @@ void Channel::SetModeInternal(MessageSource &setter, ChannelMode *ocm, const Ano
 		return;
 	}
 
-	if (cm->type != MODE_LIST)
-		this->modes.erase(cm->name);
-	else if (this->HasMode(cm->name, param))
+	if (cm->id >= ModeManager::MaxChannelModes)
 		return;
 
-	this->modes.insert(std::make_pair(cm->name, param));
+	if (cm->type == MODE_LIST)
+	{
+		if (this->HasMode(cm->name, param))
+			return;
+		this->FindList(cm->id, true)->push_back(Entry(cm->name, param));
+	}
+	else if (cm->type == MODE_PARAM)
+	{
+		Anope::string *p = this->FindParam(cm->id);
+		if (p)
+			*p = param;
+		else
+			this->mode_params.push_back(std::make_pair(cm->id, param));
+	}
+	this->mode_set.set(cm->id);
 
 	if (param.empty() && cm->type != MODE_REGULAR)
 	{
@@ -363,17 +546,23 @@ void Channel::RemoveModeInternal(MessageSource &setter, ChannelMode *ocm, const
 
 	if (cm->type == MODE_LIST)
 	{
-		std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> its = this->GetModeList(cm->name);
-		for (; its.first != its.second; ++its.first)
-			if (param.equals_ci(its.first->second))
-			{
-				this->modes.erase(its.first);
-				break;
-			}
+		EntryList *list = this->FindList(cm->id);
+		if (list)
+		{
+			for (unsigned i = 0; i < list->size(); ++i)
+				if (param.equals_ci((*list)[i].GetMask()))
+				{
+					list->erase(list->begin() + i);
+					break;
+				}
+
+			if (list->empty())
+				this->ForgetMode(cm);
+		}
 	}
 	else
-		this->modes.erase(cm->name);
-	
+		this->ForgetMode(cm);
+
 	if (cm->type == MODE_LIST)
 	{
 		ChannelModeList *cml = anope_dynamic_static_cast<ChannelModeList *>(cm);
@@ -508,17 +697,27 @@ void Channel::RemoveMode(BotInfo *bi, const Anope::string &mname, const Anope::s
 
 bool Channel::GetParam(const Anope::string &mname, Anope::string &target) const
 {
-	std::multimap<Anope::string, Anope::string>::const_iterator it = this->modes.find(mname);
-
 	target.clear();
 
-	if (it != this->modes.end())
+	ChannelMode *cm = ModeManager::FindChannelModeByName(mname);
+	if (!cm || cm->id >= ModeManager::MaxChannelModes || !this->mode_set[cm->id])
+		return false;
+
+	if (cm->type == MODE_LIST)
+	{
+		/* The oldest entry */
+		const EntryList *list = this->FindList(cm->id);
+		if (list && !list->empty())
+			target = list->front().GetMask();
+	}
+	else
 	{
-		target = it->second;
-		return true;
+		const Anope::string *param = this->FindParam(cm->id);
+		if (param)
+			target = *param;
 	}
 
-	return false;
+	return true;
 }
 
 void Channel::SetModes(BotInfo *bi, bool enforce_mlock, const char *cmodes, ...)
@@ -708,17 +907,10 @@ void Channel::SetModesInternal(MessageSource &source, const Anope::string &mode,
 
 bool Channel::MatchesList(User *u, const Anope::string &mode)
 {
-	if (!this->HasMode(mode))
-		return false;
-
-
-	std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> m = this->GetModeList(mode);
-	for (; m.first != m.second; ++m.first)
-	{
-		Entry e(mode, m.first->second);
-		if (e.Matches(u))
+	const EntryList &list = this->GetModeList(mode);
+	for (unsigned i = 0; i < list.size(); ++i)
+		if (list[i].Matches(u))
 			return true;
-	}
 
 	return false;
 }
@@ -817,9 +1009,58 @@ void Channel::SetCorrectModes(User *user, bool give_modes)
 	if (!this->ci)
 		return;
 
-	Log(LOG_DEBUG) << "Setting correct user modes for " << user->nick << " on " << this->name << " (" << (give_modes ? "" : "not ") << "giving modes)";
-
 	AccessGroup u_access = ci->AccessFor(user);
+	this->ApplyCorrectModes(user, u_access, give_modes);
+}
+
+/* Whether a user's access on a channel depends only on their account, that is
+ * no entry can match a nick, host or another channel's access list
+ */
+static bool AccessByAccountOnly(const ChannelInfo *ci)
+{
+	for (unsigned i = 0, end = ci->GetAccessCount(); i < end; ++i)
+	{
+		const ChanAccess *a = ci->GetAccess(i);
+		if (a->nc)
+			continue;
+		if (a->mask.find_first_of("!@?*") != Anope::string::npos || IRCD->IsChannelValid(a->mask))
+			return false;
+	}
+
+	return true;
+}
+
+void Channel::SetCorrectModes(const std::vector<User *> &batch, bool give_modes)
+{
+	if (!this->ci)
+		return;
+
+	bool memoize = batch.size() > 1 && AccessByAccountOnly(this->ci);
+	std::map<const NickCore *, AccessGroup> memo;
+
+	for (unsigned i = 0; i < batch.size(); ++i)
+	{
+		User *user = batch[i];
+
+		if (!memoize || user->super_admin || !user->Account())
+		{
+			this->SetCorrectModes(user, give_modes);
+			continue;
+		}
+
+		std::map<const NickCore *, AccessGroup>::iterator it = memo.find(user->Account());
+		if (it == memo.end())
+			it = memo.insert(std::make_pair(user->Account(), this->ci->AccessFor(user))).first;
+
+		/* Modules may modify the access they are given, so give them a copy */
+		AccessGroup u_access = it->second;
+		this->ApplyCorrectModes(user, u_access, give_modes);
+	}
+}
+
+void Channel::ApplyCorrectModes(User *user, AccessGroup &u_access, bool give_modes)
+{
+	Log(LOG_DEBUG) << "Setting correct user modes for " << user->nick << " on " << this->name << " (" << (give_modes ? "" : "not ") << "giving modes)";
 
 	/* Initially only take modes if the channel is being created by a non netmerge */
 	bool take_modes = this->syncing && user->server->IsSynced();
@@ -863,22 +1104,16 @@ void Channel::SetCorrectModes(User *user, bool give_modes)
 
 bool Channel::Unban(User *u, const Anope::string &mode, bool full)
 {
-	if (!this->HasMode(mode))
-		return false;
-
 	bool ret = false;
 
-	std::pair<Channel::ModeList::iterator, Channel::ModeList::iterator> bans = this->GetModeList(mode);
-	for (; bans.first != bans.second;)
-	{
-		Entry ban(mode, bans.first->second);
-		++bans.first;
-		if (ban.Matches(u, full))
+	/* Removing the matches changes the list */
+	const EntryList bans = this->GetModeList(mode);
+	for (unsigned i = 0; i < bans.size(); ++i)
+		if (bans[i].Matches(u, full))
 		{
-			this->RemoveMode(NULL, mode, ban.GetMask());
+			this->RemoveMode(NULL, mode, bans[i].GetMask());
 			ret = true;
 		}
-	}
 
 	return ret;
 }
@@ -924,10 +1159,13 @@ Channel* Channel::Find(const Anope::string &name)
 
 Channel *Channel::FindOrCreate(const Anope::string &name, bool &created, time_t ts)
 {
-	Channel* &chan = ChannelList[name];
+	Channel *chan = Channel::Find(name);
 	created = chan == NULL;
 	if (!chan)
+	{
 		chan = new Channel(name, ts);
+		ChannelList[name] = chan;
+	}
 	return chan;
 }
 
@@ -17,6 +17,7 @@
 #include "access.h"
 #include "regchannel.h"
 #include "channels.h"
+#include "watchdog.h"
 
 CommandSource::CommandSource(const Anope::string &n, User *user, NickCore *core, CommandReply *r, BotInfo *bi) : nick(n), u(user), nc(core), reply(r),
 	c(NULL), service(bi)
@@ -280,7 +281,11 @@ void Command::Run(CommandSource &source, const Anope::string &message)
 		return;
 	}
 
-	c->Execute(source, params);
+	{
+		Watchdog::Scope scope("command", c->name.c_str());
+		scope.SetModule(c->owner->name.c_str());
+		c->Execute(source, params);
+	}
 	FOREACH_MOD(OnPostCommand, (source, c, params));
 }
 
@@ -114,6 +114,9 @@ template<typename T> static void ValidateNotZero(const Anope::string &block, con
 Conf::Conf() : Block("")
 {
 	ReadTimeout = 0;
+	StallThreshold = 0;
+	StallBacktrace = false;
+	SplitGrace = 0;
 	UsePrivmsg = DefPrivmsg = false;
 
 	this->LoadConf(ServicesConf);
@@ -191,6 +194,9 @@ Conf::Conf() : Block("")
 	}
 	this->DefLanguage = options->Get<const Anope::string>("defaultlanguage");
 	this->TimeoutCheck = options->Get<time_t>("timeoutcheck");
+	this->StallThreshold = options->Get<unsigned>("stallthreshold");
+	this->StallBacktrace = options->Get<bool>("stallbacktrace");
+	this->SplitGrace = options->Get<time_t>("splitgrace");
 
 	for (int i = 0; i < this->CountBlock("uplink"); ++i)
 	{
@@ -509,6 +515,8 @@ Conf::Conf() : Block("")
 		Anope::casemap = std::locale(std::locale(), new Anope::ascii_ctype<char>());
 	else if (options->Get<const Anope::string>("casemap") == "rfc1459")
 		Anope::casemap = std::locale(std::locale(), new Anope::rfc1459_ctype<char>());
+	else if (options->Get<const Anope::string>("casemap") == "ircd-rfc1459")
+		Anope::casemap = std::locale(std::locale(), new Anope::ircd_rfc1459_ctype<char>());
 	else
 	{
 		try
@@ -522,6 +530,8 @@ Conf::Conf() : Block("")
 	}
 	Anope::CaseMapRebuild();
 
+	ModuleManager::ProfileEvents = options->Get<bool>("profileevents");
+
 	/* Check the user keys */
 	if (!options->Get<unsigned>("seed"))
 		Log() << "Configuration option options:seed should be set. It's for YOUR safety! Remember that!";
@@ -12,7 +12,7 @@
 
 static std::set<ExtensibleBase *> extensible_items;
 
-ExtensibleBase::ExtensibleBase(Module *m, const Anope::string &n) : Service(m, "Extensible", n)
+ExtensibleBase::ExtensibleBase(Module *m, const Anope::string &n) : Service(m, "Extensible", n), memory("extensible", n, m)
 {
 	extensible_items.insert(this);
 }
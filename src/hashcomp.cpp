@@ -11,10 +11,24 @@
 #include "hashcomp.h"
 #include "anope.h"
 
+#include <cstring>
+
+#if defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define ANOPE_CASEMAP_SSE2
+#endif
+
 /* Case map in use by Anope */
 std::locale Anope::casemap = std::locale(std::locale(), new Anope::ascii_ctype<char>());
-/* Cache of the above case map, forced upper */
-static unsigned char case_map_upper[256], case_map_lower[256];
+/* Cache of the above case map */
+unsigned char Anope::case_map_upper[256], Anope::case_map_lower[256];
+
+/* ascii, rfc1459 and ircd-rfc1459 all lowercase a single range of characters
+ * starting at 'A' by adding 32 (A-Z, A-], and A-^ respectively). If the case map
+ * in use is one of these this is the last character of that range, which lets
+ * whole blocks of characters be folded at once, otherwise it is 0.
+ */
+static unsigned char case_fold_last;
 
 /* called whenever Anope::casemap is modified to rebuild the casemap cache */
 void Anope::CaseMapRebuild()
@@ -26,16 +40,134 @@ void Anope::CaseMapRebuild()
 		case_map_upper[i] = ct.toupper(i);
 		case_map_lower[i] = ct.tolower(i);
 	}
+
+	unsigned last = 'A';
+	while (last < '_' && case_map_lower[last + 1] == last + 1 + 32)
+		++last;
+
+	case_fold_last = last;
+	for (unsigned i = 0; i < sizeof(case_map_lower); ++i)
+	{
+		bool folded = i >= 'A' && i <= last;
+		if (case_map_lower[i] != (folded ? i + 32 : i) || case_map_upper[i] != (i >= 'a' && i <= last + 32 ? i - 32 : i))
+		{
+			case_fold_last = 0;
+			break;
+		}
+	}
+}
+
+#ifdef ANOPE_CASEMAP_SSE2
+/** Lowercase 16 characters at once, for when case_fold_last is set.
+ * The characters to fold all have 0x20 clear, so folding is just setting it.
+ */
+static inline __m128i CaseFold(__m128i v)
+{
+	/* Shift the range to start at -128 so one signed compare checks both ends */
+	__m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(0x80 - 'A')));
+	__m128i in_range = _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(0x80 + case_fold_last - 'A' + 1)));
+	return _mm_or_si128(v, _mm_and_si128(in_range, _mm_set1_epi8(0x20)));
+}
+#endif
+
+int Anope::CaseCompare(const char *s1, const char *s2, size_t n)
+{
+	size_t i = 0;
+
+#ifdef ANOPE_CASEMAP_SSE2
+	if (case_fold_last)
+	{
+		const __m128i zero = _mm_setzero_si128();
+
+		/* Skip over equal blocks, and finish off the first block which differs
+		 * or contains a NUL with the table below.
+		 */
+		for (; i + 16 <= n; i += 16)
+		{
+			__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s1 + i)),
+				b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s2 + i));
+
+			__m128i equal = _mm_cmpeq_epi8(CaseFold(a), CaseFold(b));
+			__m128i nul = _mm_or_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero));
+			if (_mm_movemask_epi8(_mm_andnot_si128(nul, equal)) != 0xFFFF)
+				break;
+		}
+	}
+#endif
+
+	for (; i < n; ++i)
+	{
+		unsigned char c1 = Anope::case_map_upper[static_cast<unsigned char>(s1[i])],
+			c2 = Anope::case_map_upper[static_cast<unsigned char>(s2[i])];
+
+		if (c1 > c2)
+			return 1;
+		else if (c1 < c2)
+			return -1;
+		else if (!c1 || !c2)
+			return 0;
+	}
+
+	return 0;
 }
 
-unsigned char Anope::tolower(unsigned char c)
+/** Lowercase 8 characters packed into a word at once, for when case_fold_last is set */
+static inline uint64_t CaseFoldWord(uint64_t w)
 {
-	return case_map_lower[c];
+	const uint64_t ones = 0x0101010101010101ULL, high = ones * 0x80;
+
+	/* With the high bits cleared no byte can carry into the next one. The high
+	 * bit of each byte of ge is set if it is at least 'A', and of gt if it is past
+	 * case_fold_last. Characters with the high bit set are never folded.
+	 */
+	uint64_t low = w & ~high;
+	uint64_t ge = low + ones * (0x80 - 'A'), gt = low + ones * (0x7F - case_fold_last);
+	uint64_t in_range = ge & ~gt & ~w & high;
+	return w | (in_range >> 2);
 }
 
-unsigned char Anope::toupper(unsigned char c)
+/** Mix eight folded characters into a hash */
+static inline uint64_t CaseHashWord(uint64_t h, uint64_t w)
 {
-	return case_map_upper[c];
+	h ^= w;
+	h *= 0x9E3779B97F4A7C15ULL;
+	return h ^ (h >> 29);
+}
+
+size_t Anope::CaseHash(const char *s, size_t n)
+{
+	/* The string is lowercased and hashed eight characters at a time, the last
+	 * word padded with NULs. Folding a whole word gives the same result as the
+	 * table, so both paths hash a string to the same value.
+	 */
+	uint64_t h = 0xCBF29CE484222325ULL ^ n;
+	size_t i = 0;
+
+	if (case_fold_last)
+	{
+		for (; i < n; i += 8)
+		{
+			uint64_t w = 0;
+			memcpy(&w, s + i, std::min<size_t>(8, n - i));
+			h = CaseHashWord(h, CaseFoldWord(w));
+		}
+	}
+	else
+	{
+		for (; i < n; i += 8)
+		{
+			unsigned char buf[8] = { 0 };
+			for (unsigned j = 0; j < 8 && i + j < n; ++j)
+				buf[j] = case_map_lower[static_cast<unsigned char>(s[i + j])];
+
+			uint64_t w;
+			memcpy(&w, buf, sizeof(w));
+			h = CaseHashWord(h, w);
+		}
+	}
+
+	h ^= h >> 32;
+	return static_cast<size_t>(h);
 }
 
 /*
@@ -47,7 +179,7 @@ unsigned char Anope::toupper(unsigned char c)
  
 bool ci::ci_char_traits::eq(char c1st, char c2nd)
 {
-	return case_map_upper[static_cast<unsigned char>(c1st)] == case_map_upper[static_cast<unsigned char>(c2nd)];
+	return Anope::case_map_upper[static_cast<unsigned char>(c1st)] == Anope::case_map_upper[static_cast<unsigned char>(c2nd)];
 }
 
 bool ci::ci_char_traits::ne(char c1st, char c2nd)
@@ -57,39 +189,26 @@ bool ci::ci_char_traits::ne(char c1st, char c2nd)
 
 bool ci::ci_char_traits::lt(char c1st, char c2nd)
 {
-	return case_map_upper[static_cast<unsigned char>(c1st)] < case_map_upper[static_cast<unsigned char>(c2nd)];
+	return Anope::case_map_upper[static_cast<unsigned char>(c1st)] < Anope::case_map_upper[static_cast<unsigned char>(c2nd)];
 }
 
 int ci::ci_char_traits::compare(const char *str1, const char *str2, size_t n)
 {
-	for (unsigned i = 0; i < n; ++i)
-	{
-		register unsigned char c1 = case_map_upper[static_cast<unsigned char>(*str1)],
-					c2 = case_map_upper[static_cast<unsigned char>(*str2)];
-
-		if (c1 > c2)
-			return 1;
-		else if (c1 < c2)
-			return -1;
-		else if (!c1 || !c2)
-			return 0;
-
-		++str1;
-		++str2;
-	}
-	return 0;
+	return Anope::CaseCompare(str1, str2, n);
 }
 
 const char *ci::ci_char_traits::find(const char *s1, int n, char c)
 {
-	while (n-- > 0 && case_map_upper[static_cast<unsigned char>(*s1)] != case_map_upper[static_cast<unsigned char>(c)])
+	while (n-- > 0 && Anope::case_map_upper[static_cast<unsigned char>(*s1)] != Anope::case_map_upper[static_cast<unsigned char>(c)])
 		++s1;
 	return n >= 0 ? s1 : NULL;
 }
 
 bool ci::less::operator()(const Anope::string &s1, const Anope::string &s2) const
 {
-	return s1.ci_str().compare(s2.ci_str()) < 0;
+	size_t len1 = s1.length(), len2 = s2.length();
+	int r = Anope::CaseCompare(s1.c_str(), s2.c_str(), std::min(len1, len2));
+	return r < 0 || (!r && len1 < len2);
 }
 
 sepstream::sepstream(const Anope::string &source, char seperator, bool ae) : tokens(source), sep(seperator), pos(0), allow_empty(ae)
@@ -492,7 +492,7 @@ void Anope::Init(int ac, char **av)
 	Me = new Server(NULL, block->Get<const Anope::string>("name"), 0, block->Get<const Anope::string>("description"), block->Get<const Anope::string>("id"));
 	for (botinfo_map::const_iterator it = BotListByNick->begin(), it_end = BotListByNick->end(); it != it_end; ++it)
 	{
-		it->second->server = Me;
+		Me->AddUser(it->second);
 		++Me->users;
 	}
 
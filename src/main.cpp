@@ -16,6 +16,7 @@
 #include "bots.h"
 #include "socketengine.h"
 #include "uplink.h"
+#include "watchdog.h"
 
 #ifndef _WIN32
 #include <limits.h>
@@ -172,6 +173,12 @@ int main(int ac, char **av, char **envp)
 			last_check = Anope::CurTime;
 		}
 
+		/* Send modes stacked during this iteration before waiting for more to do */
+		ModeManager::ProcessModes();
+
+		/* This iteration's work is done, report it if it stalled */
+		Watchdog::Idle();
+
 		/* Process the socket engine */
 		SocketEngine::Process();
 
@@ -179,6 +186,8 @@ int main(int ac, char **av, char **envp)
 			Anope::HandleSignal();
 	}
 
+	Watchdog::Shutdown();
+
 	if (Anope::Restarting)
 	{
 		FOREACH_MOD(OnRestart, ());
@@ -0,0 +1,41 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#include "services.h"
+#include "memstats.h"
+#include "modules.h"
+
+std::list<MemoryCounter *> *MemoryCounter::Counters;
+
+MemoryCounter::MemoryCounter(const Anope::string &c, const Anope::string &n, Module *o) : category(c), name(n), owner(o), objects(0), bytes(0)
+{
+	if (Counters == NULL)
+		Counters = new std::list<MemoryCounter *>();
+	Counters->push_back(this);
+
+	this->it = Counters->end();
+	--this->it;
+}
+
+MemoryCounter::~MemoryCounter()
+{
+	Counters->erase(this->it);
+}
+
+Anope::string MemoryCounter::GetOwnerName() const
+{
+	return this->owner ? this->owner->name : "core";
+}
+
+const std::list<MemoryCounter *> &MemoryCounter::GetCounters()
+{
+	if (Counters == NULL)
+		Counters = new std::list<MemoryCounter *>();
+	return *Counters;
+}
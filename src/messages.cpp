@@ -99,9 +99,11 @@ void Join::SJoin(MessageSource &source, const Anope::string &chan, time_t ts, co
 	bool created;
 	Channel *c = Channel::FindOrCreate(chan, created, ts ? ts : Anope::CurTime);
 	bool keep_their_modes = true;
+	Server *src = source.GetServer() ? source.GetServer() : Me;
 
 	if (created)
-		c->syncing = true;
+		/* The channel is synced when the burst it came in is */
+		src->AddSyncingChannel(c);
 	/* Some IRCds do not include a TS */
 	else if (!ts)
 		;
@@ -121,12 +123,21 @@ void Join::SJoin(MessageSource &source, const Anope::string &chan, time_t ts, co
 		 * so that Channel::SetCorrectModes can correctly detect the presence of channel mode +r.
 		 */
 		c->SetModesInternal(source, modes, ts, !c->syncing);
-	
+
+	/* Lower the TS once for the whole join, such as to when the channel was registered, before
+	 * any user is given modes. Lowering it resets the channel, which would undo them.
+	 */
+	if (!users.empty())
+		c->CheckTS();
+
+	/* Their status modes are only kept if the TS is still not newer than ours */
+	keep_their_modes = ts <= c->creation_time;
+	std::vector<User *> joined;
+
 	for (std::list<SJoinUser>::const_iterator it = users.begin(), it_end = users.end(); it != it_end; ++it)
 	{
 		const ChannelStatus &status = it->first;
 		User *u = it->second;
-		keep_their_modes = ts <= c->creation_time; // OnJoinChannel can call modules which can modify this channel's ts
 
 		if (c->FindUser(u))
 			continue;
@@ -138,12 +149,17 @@ void Join::SJoin(MessageSource &source, const Anope::string &chan, time_t ts, co
 		if (c->CheckKick(u))
 			continue;
 
-		/* Set whatever modes the user should have, and remove any that
+		joined.push_back(u);
+	}
+
+	if (!joined.empty())
+	{
+		/* Set whatever modes the users should have, and remove any that
 		 * they aren't allowed to have (secureops etc).
 		 */
-		c->SetCorrectModes(u, true);
-		
-		FOREACH_MOD(OnJoinChannel, (u, c));
+		c->SetCorrectModes(joined, true);
+
+		FOREACH_MOD(OnJoinChannelBatch, (c, joined));
 	}
 
 	/* Channel is done syncing */
@@ -151,8 +167,7 @@ void Join::SJoin(MessageSource &source, const Anope::string &chan, time_t ts, co
 	{
 		/* Sync the channel (mode lock, topic, etc) */
 		/* the channel is synced when the netmerge is complete */
-		Server *src = source.GetServer() ? source.GetServer() : Me;
-		if (src && src->IsSynced())
+		if (src->IsSynced())
 		{
 			c->Sync();
 
@@ -14,12 +14,7 @@
 #include "protocol.h"
 #include "channels.h"
 #include "uplink.h"
-
-struct StackerInfo;
-
-/* List of pairs of user/channels and their stacker info */
-static std::map<User *, StackerInfo *> UserStackerObjects;
-static std::map<Channel *, StackerInfo *> ChannelStackerObjects;
+#include "memstats.h"
 
 /* Array of all modes Anope knows about.*/
 static std::vector<ChannelMode *> ChannelModes;
@@ -32,6 +27,8 @@ static std::vector<ChannelMode *> ChannelModesIdx;
 static std::vector<UserMode *> UserModesIdx;
 
 static std::map<Anope::string, ChannelMode *> ChannelModesByName;
+/* Channel modes by ChannelMode::id */
+static ChannelMode *ChannelModesById[ModeManager::MaxChannelModes];
 static std::map<Anope::string, UserMode *> UserModesByName;
 
 /* Sorted by status */
@@ -40,16 +37,69 @@ static std::vector<ChannelModeStatus *> ChannelModesByStatus;
 /* Number of generic modes we support */
 unsigned ModeManager::GenericChannelModes = 0, ModeManager::GenericUserModes = 0;
 
+static MemoryCounter StackerMemory("modes", "StackerInfo");
+
+/* A mode waiting to be sent, mode is NULL if it was cancelled out */
+struct StackedMode
+{
+	Mode *mode;
+	Anope::string param;
+
+	StackedMode(Mode *m, const Anope::string &p) : mode(m), param(p) { }
+};
+
 struct StackerInfo
 {
-	/* Modes to be added */
-	std::list<std::pair<Mode *, Anope::string> > AddModes;
-	/* Modes to be deleted */
-	std::list<std::pair<Mode *, Anope::string> > DelModes;
+	/* Identifies a stacked mode, the param is empty for modes that can only be set once */
+	typedef std::pair<Mode *, Anope::string> Key;
+
+	struct KeyHash
+	{
+		size_t operator()(const Key &k) const
+		{
+			return TR1NS::hash<Mode *>()(k.first) ^ Anope::hash_cs()(k.second);
+		}
+	};
+
+	/* Modes to be added, in the order they were stacked */
+	std::vector<StackedMode> AddModes;
+	/* Modes to be deleted, in the order they were stacked */
+	std::vector<StackedMode> DelModes;
+	/* Where each mode is on AddModes (true) or DelModes (false). Most objects
+	 * only ever have a few modes stacked, so this is only built once there
+	 * are enough to make searching them slow.
+	 */
+	TR1NS::unordered_map<Key, std::pair<bool, size_t>, KeyHash> *index;
 	/* Bot this is sent from */
 	BotInfo *bi;
+	/* Position of this in the list of stacker objects */
+	size_t pos;
+
+	/* Number of stacked modes at which the index is built */
+	static const size_t IndexThreshold = 8;
+	/* Approximate memory used by a mode on AddModes or DelModes */
+	static const size_t EntrySize = sizeof(StackedMode);
+
+	StackerInfo(size_t p) : index(NULL), bi(NULL), pos(p)
+	{
+		StackerMemory.Allocate(ObjectSize());
+	}
 
-	StackerInfo() : bi(NULL) { }
+	~StackerInfo()
+	{
+		StackerMemory.Free(ObjectSize() + (AddModes.size() + DelModes.size()) * EntrySize);
+		delete index;
+	}
+
+	/* Approximate memory used by a stacker object, including its entries in StackerObjects */
+	static size_t ObjectSize()
+	{
+		return sizeof(StackerInfo) + MemoryCounter::HashNode(sizeof(std::pair<void *, StackerInfo *>)) + sizeof(std::pair<void *, StackerInfo *>);
+	}
+
+	/* StackerInfos are allocated from a slab pool */
+	static void *operator new(size_t size);
+	static void operator delete(void *ptr, size_t size);
 
 	/** Add a mode to this object
 	 * @param mode The mode
@@ -57,8 +107,57 @@ struct StackerInfo
 	 * @param param The param for the mode
 	 */
 	void AddMode(Mode *mode, bool set, const Anope::string &param);
+
+	/** Cancel every stacked change of a mode
+	 * @param mode The mode
+	 */
+	void DelMode(Mode *mode);
+
+ private:
+	/** Find where a mode is stacked
+	 * @param key The mode
+	 * @param set Set to true if the mode is being added, false if it is being deleted
+	 * @param i Set to the position of the mode on AddModes or DelModes
+	 * @return true if the mode is stacked
+	 */
+	bool Find(const Key &key, bool &set, size_t &i);
+
+	/** Build the index of stacked modes
+	 */
+	void BuildIndex();
 };
 
+static SlabPool StackerPool("StackerInfo", sizeof(StackerInfo));
+
+void *StackerInfo::operator new(size_t size)
+{
+	if (size == sizeof(StackerInfo))
+		return StackerPool.Allocate();
+	return ::operator new(size);
+}
+
+void StackerInfo::operator delete(void *ptr, size_t size)
+{
+	if (size == sizeof(StackerInfo))
+		StackerPool.Deallocate(ptr);
+	else
+		::operator delete(ptr);
+}
+
+/* Users and channels with modes waiting to be sent */
+template<typename T> struct StackerObjects
+{
+	/* The objects, in the order modes were first stacked for them. Objects
+	 * which were removed before their modes were sent have a NULL StackerInfo.
+	 */
+	std::vector<std::pair<T *, StackerInfo *> > order;
+	/* The objects by address */
+	TR1NS::unordered_map<T *, StackerInfo *> objects;
+};
+
+static StackerObjects<User> UserStackerObjects;
+static StackerObjects<Channel> ChannelStackerObjects;
+
 ChannelStatus::ChannelStatus()
 {
 }
@@ -137,7 +236,7 @@ UserModeParam::UserModeParam(const Anope::string &un, char mch) : UserMode(un, m
 	this->type = MODE_PARAM;
 }
 
-ChannelMode::ChannelMode(const Anope::string &cm, char mch) : Mode(cm, MC_CHANNEL, mch, MODE_REGULAR)
+ChannelMode::ChannelMode(const Anope::string &cm, char mch) : Mode(cm, MC_CHANNEL, mch, MODE_REGULAR), id(ModeManager::MaxChannelModes)
 {
 }
 
@@ -249,79 +348,110 @@ bool ChannelModeNoone::CanSet(User *u) const
 	return false;
 }
 
-void StackerInfo::AddMode(Mode *mode, bool set, const Anope::string &param)
+bool StackerInfo::Find(const Key &key, bool &set, size_t &i)
 {
-	bool is_param = mode->type == MODE_PARAM;
-
-	std::list<std::pair<Mode *, Anope::string> > *list, *otherlist;
-	if (set)
+	if (index)
 	{
-		list = &AddModes;
-		otherlist = &DelModes;
+		TR1NS::unordered_map<Key, std::pair<bool, size_t>, KeyHash>::iterator it = index->find(key);
+		if (it == index->end())
+			return false;
+
+		set = it->second.first;
+		i = it->second.second;
+		return true;
 	}
-	else
+
+	bool is_param = key.first->type == MODE_PARAM;
+	for (int l = 0; l < 2; ++l)
 	{
-		list = &DelModes;
-		otherlist = &AddModes;
+		const std::vector<StackedMode> &list = l == 0 ? AddModes : DelModes;
+		for (i = 0; i < list.size(); ++i)
+			/* The param must match too (can have multiple status or list modes), but
+			 * if it is a param mode it can match no matter what the param is
+			 */
+			if (list[i].mode == key.first && (is_param || key.second.equals_cs(list[i].param)))
+			{
+				set = l == 0;
+				return true;
+			}
 	}
 
-	/* Loop through the list and find if this mode is already on here */
-	std::list<std::pair<Mode *, Anope::string > >::iterator it, it_end;
-	for (it = list->begin(), it_end = list->end(); it != it_end; ++it)
+	return false;
+}
+
+void StackerInfo::BuildIndex()
+{
+	index = new TR1NS::unordered_map<Key, std::pair<bool, size_t>, KeyHash>();
+
+	for (int l = 0; l < 2; ++l)
 	{
-		/* The param must match too (can have multiple status or list modes), but
-		 * if it is a param mode it can match no matter what the param is
-		 */
-		if (it->first == mode && (is_param || param.equals_cs(it->second)))
-		{
-			list->erase(it);
-			/* It can only be on this list once */
-			break;
-		}
+		const std::vector<StackedMode> &list = l == 0 ? AddModes : DelModes;
+		for (size_t i = 0; i < list.size(); ++i)
+			if (list[i].mode)
+				(*index)[Key(list[i].mode, list[i].mode->type == MODE_PARAM ? "" : list[i].param)] = std::make_pair(l == 0, i);
 	}
-	/* If the mode is on the other list, remove it from there (eg, we dont want +o-o Adam Adam) */
-	for (it = otherlist->begin(), it_end = otherlist->end(); it != it_end; ++it)
+}
+
+void StackerInfo::AddMode(Mode *mode, bool set, const Anope::string &param)
+{
+	Key key(mode, mode->type == MODE_PARAM ? "" : param);
+	bool on_add;
+	size_t i;
+
+	if (this->Find(key, on_add, i))
 	{
-		/* The param must match too (can have multiple status or list modes), but
-		 * if it is a param mode it can match no matter what the param is
+		/* Cancelled modes are left in place so positions in the index stay valid */
+		(on_add ? AddModes : DelModes)[i].mode = NULL;
+		if (index)
+			index->erase(key);
+
+		/* If the mode is on the other list this is like setting + and - on the same mode
+		 * within the same cycle, so no change is made (eg, we dont want +o-o Adam Adam).
+		 * If it is on the same list it is moved to the end, with the new param.
 		 */
-		if (it->first == mode && (is_param || param.equals_cs(it->second)))
-		{
-			otherlist->erase(it);
+		if (on_add != set)
 			return;
-			/* Note that we return here because this is like setting + and - on the same mode within the same
-			 * cycle, no change is made. This causes no problems with something like - + and -, because after the
-			 * second mode change the list is empty, and the third mode change starts fresh.
-			 */
-		}
 	}
 
 	/* Add this mode and its param to our list */
-	list->push_back(std::make_pair(mode, param));
+	std::vector<StackedMode> &list = set ? AddModes : DelModes;
+	list.push_back(StackedMode(mode, param));
+	StackerMemory.Resize(0, EntrySize);
+
+	if (index)
+		(*index)[key] = std::make_pair(set, list.size() - 1);
+	else if (AddModes.size() + DelModes.size() >= IndexThreshold)
+		this->BuildIndex();
 }
 
-static class ModePipe : public Pipe
+void StackerInfo::DelMode(Mode *mode)
 {
- public:
-	void OnNotify()
+	for (int l = 0; l < 2; ++l)
 	{
-		ModeManager::ProcessModes();
+		std::vector<StackedMode> &list = l == 0 ? AddModes : DelModes;
+		for (size_t i = 0; i < list.size(); ++i)
+			if (list[i].mode == mode)
+			{
+				if (index)
+					index->erase(Key(mode, mode->type == MODE_PARAM ? "" : list[i].param));
+				list[i].mode = NULL;
+			}
 	}
-} *modePipe;
+}
 
 /** Get the stacker info for an item, if one doesnt exist it is created
  * @param Item The user/channel etc
  * @return The stacker info
  */
-template<typename List, typename Object>
-static StackerInfo *GetInfo(List &l, Object *o)
+template<typename T>
+static StackerInfo *GetInfo(StackerObjects<T> &l, T *o)
 {
-	typename List::const_iterator it = l.find(o);
-	if (it != l.end())
-		return it->second;
-
-	StackerInfo *s = new StackerInfo();
-	l[o] = s;
+	StackerInfo* &s = l.objects[o];
+	if (!s)
+	{
+		s = new StackerInfo(l.order.size());
+		l.order.push_back(std::make_pair(o, s));
+	}
 	return s;
 }
 
@@ -332,12 +462,15 @@ static StackerInfo *GetInfo(List &l, Object *o)
 static std::list<Anope::string> BuildModeStrings(StackerInfo *info)
 {
 	std::list<Anope::string> ret;
-	std::list<std::pair<Mode *, Anope::string> >::iterator it, it_end;
+	std::vector<StackedMode>::iterator it, it_end;
 	Anope::string buf = "+", parambuf;
 	unsigned NModes = 0;
 
 	for (it = info->AddModes.begin(), it_end = info->AddModes.end(); it != it_end; ++it)
 	{
+		if (!it->mode)
+			continue;
+
 		if (++NModes > IRCD->MaxModes || (buf.length() + parambuf.length() > IRCD->MaxLine - 100)) // Leave room for command, channel, etc
 		{
 			ret.push_back(buf + parambuf);
@@ -346,10 +479,10 @@ static std::list<Anope::string> BuildModeStrings(StackerInfo *info)
 			NModes = 1;
 		}
 
-		buf += it->first->mchar;
+		buf += it->mode->mchar;
 
-		if (!it->second.empty())
-			parambuf += " " + it->second;
+		if (!it->param.empty())
+			parambuf += " " + it->param;
 	}
 
 	if (buf[buf.length() - 1] == '+')
@@ -358,6 +491,9 @@ static std::list<Anope::string> BuildModeStrings(StackerInfo *info)
 	buf += "-";
 	for (it = info->DelModes.begin(), it_end = info->DelModes.end(); it != it_end; ++it)
 	{
+		if (!it->mode)
+			continue;
+
 		if (++NModes > IRCD->MaxModes || (buf.length() + parambuf.length() > IRCD->MaxLine - 100)) // Leave room for command, channel, etc
 		{
 			ret.push_back(buf + parambuf);
@@ -366,10 +502,10 @@ static std::list<Anope::string> BuildModeStrings(StackerInfo *info)
 			NModes = 1;
 		}
 
-		buf += it->first->mchar;
+		buf += it->mode->mchar;
 
-		if (!it->second.empty())
-			parambuf += " " + it->second;
+		if (!it->param.empty())
+			parambuf += " " + it->param;
 	}
 
 	if (buf[buf.length() - 1] == '-')
@@ -415,12 +551,24 @@ bool ModeManager::AddChannelMode(ChannelMode *cm)
 	if (ModeManager::FindChannelModeByName(cm->name) != NULL)
 		return false;
 
+	unsigned id = 0;
+	while (id < MaxChannelModes && ChannelModesById[id] != NULL)
+		++id;
+	if (id == MaxChannelModes)
+	{
+		Log() << "ModeManager: Unable to add channel mode " << cm->mchar << ", too many channel modes";
+		return false;
+	}
+
 	if (cm->name.empty())
 	{
 		cm->name = stringify(++GenericChannelModes);
 		Log() << "ModeManager: Added generic support for channel mode " << cm->mchar;
 	}
 
+	cm->id = id;
+	ChannelModesById[id] = cm;
+
 	if (cm->mchar)
 	{
 		unsigned want = cm->mchar;
@@ -512,6 +660,24 @@ void ModeManager::RemoveChannelMode(ChannelMode *cm)
 		ChannelModes.erase(it);
 
 	StackerDel(cm);
+
+	/* The id may be given to another mode, so no channel can keep this one set */
+	if (cm->id < MaxChannelModes && ChannelModesById[cm->id] == cm)
+	{
+		for (channel_map::const_iterator cit = ChannelList.begin(), cit_end = ChannelList.end(); cit != cit_end; ++cit)
+			cit->second->ForgetMode(cm);
+
+		ChannelModesById[cm->id] = NULL;
+		cm->id = MaxChannelModes;
+	}
+}
+
+ChannelMode *ModeManager::FindChannelModeById(unsigned id)
+{
+	if (id >= MaxChannelModes)
+		return NULL;
+
+	return ChannelModesById[id];
 }
 
 ChannelMode *ModeManager::FindChannelModeByChar(char mode)
@@ -605,10 +771,6 @@ void ModeManager::StackerAdd(BotInfo *bi, Channel *c, ChannelMode *cm, bool Set,
 		s->bi = bi;
 	else
 		s->bi = c->ci->WhoSends();
-
-	if (!modePipe)
-		modePipe = new ModePipe();
-	modePipe->Notify();
 }
 
 void ModeManager::StackerAdd(BotInfo *bi, User *u, UserMode *um, bool Set, const Anope::string &Param)
@@ -617,58 +779,51 @@ void ModeManager::StackerAdd(BotInfo *bi, User *u, UserMode *um, bool Set, const
 	s->AddMode(um, Set, Param);
 	if (bi)
 		s->bi = bi;
-
-	if (!modePipe)
-		modePipe = new ModePipe();
-	modePipe->Notify();
 }
 
-void ModeManager::ProcessModes()
+template<typename T>
+static void ProcessModes(StackerObjects<T> &l)
 {
-	if (!UserStackerObjects.empty())
+	if (l.order.empty())
+		return;
+
+	for (size_t i = 0; i < l.order.size(); ++i)
 	{
-		for (std::map<User *, StackerInfo *>::const_iterator it = UserStackerObjects.begin(), it_end = UserStackerObjects.end(); it != it_end; ++it)
-		{
-			User *u = it->first;
-			StackerInfo *s = it->second;
+		T *obj = l.order[i].first;
+		StackerInfo *s = l.order[i].second;
+		if (!s)
+			continue;
 
-			std::list<Anope::string> ModeStrings = BuildModeStrings(s);
-			for (std::list<Anope::string>::iterator lit = ModeStrings.begin(), lit_end = ModeStrings.end(); lit != lit_end; ++lit)
-				IRCD->SendMode(s->bi, u, lit->c_str());
-			delete it->second;
-		}
-		UserStackerObjects.clear();
+		std::list<Anope::string> ModeStrings = BuildModeStrings(s);
+		for (std::list<Anope::string>::iterator lit = ModeStrings.begin(), lit_end = ModeStrings.end(); lit != lit_end; ++lit)
+			IRCD->SendMode(s->bi, obj, lit->c_str());
+		delete s;
 	}
 
-	if (!ChannelStackerObjects.empty())
-	{
-		for (std::map<Channel *, StackerInfo *>::const_iterator it = ChannelStackerObjects.begin(), it_end = ChannelStackerObjects.end(); it != it_end; ++it)
-		{
-			Channel *c = it->first;
-			StackerInfo *s = it->second;
+	l.order.clear();
+	l.objects.clear();
+}
 
-			std::list<Anope::string> ModeStrings = BuildModeStrings(s);
-			for (std::list<Anope::string>::iterator lit = ModeStrings.begin(), lit_end = ModeStrings.end(); lit != lit_end; ++lit)
-				IRCD->SendMode(s->bi, c, lit->c_str());
-			delete it->second;
-		}
-		ChannelStackerObjects.clear();
-	}
+void ModeManager::ProcessModes()
+{
+	::ProcessModes(UserStackerObjects);
+	::ProcessModes(ChannelStackerObjects);
 }
 
 template<typename T>
-static void StackerDel(std::map<T *, StackerInfo *> &map, T *obj)
+static void StackerDel(StackerObjects<T> &l, T *obj)
 {
-	typename std::map<T *, StackerInfo *>::iterator it = map.find(obj);
-	if (it != map.end())
+	typename TR1NS::unordered_map<T *, StackerInfo *>::iterator it = l.objects.find(obj);
+	if (it != l.objects.end())
 	{
 		StackerInfo *si = it->second;
 		std::list<Anope::string> ModeStrings = BuildModeStrings(si);
 		for (std::list<Anope::string>::iterator lit = ModeStrings.begin(), lit_end = ModeStrings.end(); lit != lit_end; ++lit)
 			IRCD->SendMode(si->bi, obj, lit->c_str());
 
+		l.order[si->pos].second = NULL;
 		delete si;
-		map.erase(it);
+		l.objects.erase(it);
 	}
 }
 
@@ -684,49 +839,13 @@ void ModeManager::StackerDel(Channel *c)
 
 void ModeManager::StackerDel(Mode *m)
 {
-	for (std::map<User *, StackerInfo *>::const_iterator it = UserStackerObjects.begin(), it_end = UserStackerObjects.end(); it != it_end;)
-	{
-		StackerInfo *si = it->second;
-		++it;
+	for (size_t i = 0; i < UserStackerObjects.order.size(); ++i)
+		if (UserStackerObjects.order[i].second)
+			UserStackerObjects.order[i].second->DelMode(m);
 
-		for (std::list<std::pair<Mode *, Anope::string> >::iterator it2 = si->AddModes.begin(), it2_end = si->AddModes.end(); it2 != it2_end;)
-		{
-			if (it2->first == m)
-				it2 = si->AddModes.erase(it2);
-			else
-				++it2;
-		}
-
-		for (std::list<std::pair<Mode *, Anope::string> >::iterator it2 = si->DelModes.begin(), it2_end = si->DelModes.end(); it2 != it2_end;)
-		{
-			if (it2->first == m)
-				it2 = si->DelModes.erase(it2);
-			else
-				++it2;
-		}
-	}
-
-	for (std::map<Channel *, StackerInfo *>::const_iterator it = ChannelStackerObjects.begin(), it_end = ChannelStackerObjects.end(); it != it_end;)
-	{
-		StackerInfo *si = it->second;
-		++it;
-
-		for (std::list<std::pair<Mode *, Anope::string> >::iterator it2 = si->AddModes.begin(), it2_end = si->AddModes.end(); it2 != it2_end;)
-		{
-			if (it2->first == m)
-				it2 = si->AddModes.erase(it2);
-			else
-				++it2;
-		}
-
-		for (std::list<std::pair<Mode *, Anope::string> >::iterator it2 = si->DelModes.begin(), it2_end = si->DelModes.end(); it2 != it2_end;)
-		{
-			if (it2->first == m)
-				it2 = si->DelModes.erase(it2);
-			else
-				++it2;
-		}
-	}
+	for (size_t i = 0; i < ChannelStackerObjects.order.size(); ++i)
+		if (ChannelStackerObjects.order[i].second)
+			ChannelStackerObjects.order[i].second->DelMode(m);
 }
 
 Entry::Entry(const Anope::string &m, const Anope::string &fh) : name(m), mask(fh), cidr_len(0)
@@ -807,7 +926,7 @@ Entry::Entry(const Anope::string &m, const Anope::string &fh) : name(m), mask(fh
 		this->real.clear();
 }
 
-const Anope::string Entry::GetMask() const
+const Anope::string &Entry::GetMask() const
 {
 	return this->mask;
 }
@@ -843,7 +962,7 @@ bool Entry::Matches(User *u, bool full) const
 	{
 		try
 		{
-			if (!cidr(this->host, this->cidr_len).match(u->ip))
+			if (!cidr(this->host, this->cidr_len).match(sockaddrs(u->ip)))
 				ret = false;
 		}
 		catch (const SocketException &)
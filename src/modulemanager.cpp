@@ -18,11 +18,14 @@
 #ifndef _WIN32
 #include <dirent.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <dlfcn.h>
 #endif
 
 std::list<Module *> ModuleManager::Modules;
 std::vector<Module *> ModuleManager::EventHandlers[I_SIZE];
+bool ModuleManager::ProfileEvents = false;
+ModuleManager::EventStats ModuleManager::EventProfile[I_SIZE];
 
 #ifdef _WIN32
 void ModuleManager::CleanupRuntimeDirectory()
@@ -350,6 +353,26 @@ ModuleReturn ModuleManager::DeleteModule(Module *m)
 	return MOD_ERR_OK;
 }
 
+void ModuleManager::EventTimer::Start(const char *name)
+{
+	EventProfile[this->event].name = name;
+
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	this->sec = tv.tv_sec;
+	this->usec = tv.tv_usec;
+}
+
+void ModuleManager::EventTimer::Stop()
+{
+	timeval tv;
+	gettimeofday(&tv, NULL);
+
+	EventStats &stats = EventProfile[this->event];
+	++stats.calls;
+	stats.time += (tv.tv_sec - this->sec) + (tv.tv_usec - this->usec) / 1000000.0;
+}
+
 void ModuleManager::DetachAll(Module *mod)
 {
 	for (unsigned i = 0; i < I_SIZE; ++i)
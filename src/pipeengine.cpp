@@ -48,10 +48,11 @@ Pipe::~Pipe()
 
 bool Pipe::ProcessRead()
 {
-	this->OnNotify();
-
+	/* Empty the pipe first, so a notification made while handling this one is not lost */
 	char dummy[512];
 	while (read(this->GetFD(), dummy, 512) == 512);
+
+	this->OnNotify();
 	return true;
 }
 
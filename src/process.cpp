@@ -88,6 +88,9 @@ void Anope::Process(const Anope::string &buffer)
 	else if (m->HasFlag(IRCDMESSAGE_REQUIRE_SERVER) && !source.empty() && !src.GetServer())
 		Log(LOG_DEBUG) << "unexpected non-server source " << source << " for " << command;
 	else
+	{
+		Watchdog::Scope scope("message", m->Service::name.c_str());
 		m->Run(src, params);
+	}
 }
 
@@ -26,6 +26,9 @@ using namespace Serialize;
 std::vector<Anope::string> Type::TypeOrder;
 std::map<Anope::string, Type *> Serialize::Type::Types;
 std::list<Serializable *> *Serializable::SerializableItems;
+std::vector<std::pair<char *, size_t> > *Serializable::Pending;
+/* Memory counters for each type, never freed so objects can outlive their type */
+static std::map<Anope::string, MemoryCounter *> *TypeCounters;
 
 void Serialize::RegisterTypes()
 {
@@ -43,7 +46,7 @@ void Serialize::CheckTypes()
 	}
 }
 
-Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0), last_commit_time(0), id(0), redis_ignore(0)
+Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0), last_commit_time(0), s_size(TakePendingSize()), id(0), redis_ignore(0)
 {
 	if (SerializableItems == NULL)
 		SerializableItems = new std::list<Serializable *>();
@@ -51,13 +54,16 @@ Serializable::Serializable(const Anope::string &serialize_type) : last_commit(0)
 
 	this->s_type = Type::Find(serialize_type);
 
+	this->s_counter = GetMemoryCounter(serialize_type);
+	this->s_counter->Allocate(this->s_size);
+
 	this->s_iter = SerializableItems->end();
 	--this->s_iter;
 
 	FOREACH_MOD(OnSerializableConstruct, (this));
 }
 
-Serializable::Serializable(const Serializable &other) : last_commit(0), last_commit_time(0), id(0), redis_ignore(0)
+Serializable::Serializable(const Serializable &other) : last_commit(0), last_commit_time(0), s_counter(other.s_counter), s_size(TakePendingSize()), id(0), redis_ignore(0)
 {
 	SerializableItems->push_back(this);
 	this->s_iter = SerializableItems->end();
@@ -65,6 +71,8 @@ Serializable::Serializable(const Serializable &other) : last_commit(0), last_com
 
 	this->s_type = other.s_type;
 
+	this->s_counter->Allocate(this->s_size);
+
 	FOREACH_MOD(OnSerializableConstruct, (this));
 }
 
@@ -73,6 +81,7 @@ Serializable::~Serializable()
 	FOREACH_MOD(OnSerializableDestruct, (this));
 
 	SerializableItems->erase(this->s_iter);
+	this->s_counter->Free(this->s_size);
 }
 
 Serializable &Serializable::operator=(const Serializable &)
@@ -99,6 +108,12 @@ void Serializable::UpdateCache(Serialize::Data &data)
 	this->last_commit = data.Hash();
 }
 
+void Serializable::InvalidateCache()
+{
+	this->last_commit = 0;
+	this->last_commit_time = 0;
+}
+
 bool Serializable::IsTSCached()
 {
 	return this->last_commit_time == Anope::CurTime;
@@ -114,11 +129,74 @@ const std::list<Serializable *> &Serializable::GetItems()
 	return *SerializableItems;
 }
 
+MemoryCounter *Serializable::GetMemoryCounter(const Anope::string &type)
+{
+	if (TypeCounters == NULL)
+		TypeCounters = new std::map<Anope::string, MemoryCounter *>();
+
+	MemoryCounter* &counter = (*TypeCounters)[type];
+	if (counter == NULL)
+		counter = new MemoryCounter("serialize", type);
+	return counter;
+}
+
+size_t Serializable::TakePendingSize()
+{
+	if (Pending == NULL)
+		return 0;
+
+	/* The Serializable part of an object is somewhere within its allocation. Other objects may be
+	 * allocated between this one's allocation and construction, such as by its constructor's
+	 * arguments, so the most recent allocation is not necessarily this one's.
+	 */
+	const char *self = reinterpret_cast<const char *>(this);
+	for (unsigned i = Pending->size(); i > 0; --i)
+	{
+		const std::pair<char *, size_t> &p = (*Pending)[i - 1];
+		if (self >= p.first && self < p.first + p.second)
+		{
+			size_t size = p.second;
+			Pending->erase(Pending->begin() + i - 1);
+			return size;
+		}
+	}
+
+	return 0;
+}
+
+void *Serializable::operator new(size_t size)
+{
+	/* The Serializable constructor looks the object up in Pending to know the size of
+	 * the most derived object, which it has no other way of finding out.
+	 */
+	if (Pending == NULL)
+		Pending = new std::vector<std::pair<char *, size_t> >();
+
+	char *ptr = static_cast<char *>(::operator new(size));
+	Pending->push_back(std::make_pair(ptr, size));
+	return ptr;
+}
+
+void Serializable::operator delete(void *ptr)
+{
+	/* A constructor which threw before the Serializable constructor ran leaves its allocation in Pending */
+	for (unsigned i = Pending ? Pending->size() : 0; i > 0; --i)
+		if ((*Pending)[i - 1].first == ptr)
+		{
+			Pending->erase(Pending->begin() + i - 1);
+			break;
+		}
+
+	::operator delete(ptr);
+}
+
 Type::Type(const Anope::string &n, unserialize_func f, Module *o)  : name(n), unserialize(f), owner(o), timestamp(0)
 {
 	TypeOrder.push_back(this->name);
 	Types[this->name] = this;
 
+	Serializable::GetMemoryCounter(this->name)->owner = o;
+
 	FOREACH_MOD(OnSerializeTypeCreate, (this));
 }
 
@@ -128,6 +206,8 @@ Type::~Type()
 	if (it != TypeOrder.end())
 		TypeOrder.erase(it);
 	Types.erase(this->name);
+
+	Serializable::GetMemoryCounter(this->name)->owner = NULL;
 }
 
 Serializable *Type::Unserialize(Serializable *obj, Serialize::Data &data)
@@ -150,6 +230,11 @@ void Type::UpdateTimestamp()
 	this->timestamp = Anope::CurTime;
 }
 
+void Type::UpdateTimestamp(time_t ts)
+{
+	this->timestamp = ts;
+}
+
 Type *Serialize::Type::Find(const Anope::string &name)
 {
 	std::map<Anope::string, Type *>::iterator it = Types.find(name);
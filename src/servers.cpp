@@ -24,11 +24,11 @@
 Server *Me = NULL;
 
 Anope::map<Server *> Servers::ByName;
-Anope::map<Server *> Servers::ByID;
+IDMap<Server *> Servers::ByID;
 
 std::set<Anope::string> Servers::Capab;
 
-Server::Server(Server *up, const Anope::string &sname, unsigned shops, const Anope::string &desc, const Anope::string &ssid, bool jupe) : name(sname), hops(shops), description(desc), sid(ssid), uplink(up), users(0)
+Server::Server(Server *up, const Anope::string &sname, unsigned shops, const Anope::string &desc, const Anope::string &ssid, bool jupe) : name(sname), hops(shops), description(desc), sid(ssid), uplink(up), user_list(NULL), syncing_channels(NULL), users(0)
 {
 	syncing = true;
 	juped = jupe;
@@ -36,7 +36,7 @@ Server::Server(Server *up, const Anope::string &sname, unsigned shops, const Ano
 
 	Servers::ByName[sname] = this;
 	if (!ssid.empty())
-		Servers::ByID[ssid] = this;
+		Servers::ByID.Set(ssid, this);
 
 	Log(this, "connect") << "has connected to the network (uplinked to " << (this->uplink ? this->uplink->GetName() : "no uplink") << ")";
 
@@ -117,18 +117,22 @@ Server::Server(Server *up, const Anope::string &sname, unsigned shops, const Ano
 					for (Channel::ChanUserList::const_iterator cit = c->users.begin(), cit_end = c->users.end(); cit != cit_end; ++cit)
 						IRCD->SendJoin(cit->second->user, c, &cit->second->status);
 
-				for (Channel::ModeList::const_iterator it2 = c->GetModes().begin(); it2 != c->GetModes().end(); ++it2)
+				const std::vector<ChannelMode *> &cmodes = ModeManager::GetChannelModes();
+				for (unsigned i = 0; i < cmodes.size(); ++i)
 				{
-					ChannelMode *cm = ModeManager::FindChannelModeByName(it2->first);
-					if (!cm || cm->type != MODE_LIST)
+					ChannelMode *cm = cmodes[i];
+					if (cm->type != MODE_LIST)
 						continue;
-					ModeManager::StackerAdd(c->ci->WhoSends(), c, cm, true, it2->second);
+
+					const Channel::EntryList &list = c->GetModeList(cm->name);
+					for (unsigned j = 0; j < list.size(); ++j)
+						ModeManager::StackerAdd(c->ci->WhoSends(), c, cm, true, list[j].GetMask());
 				}
 
 				if (!c->topic.empty() && !c->topic_setter.empty())
 					IRCD->SendTopic(c->ci->WhoSends(), c);
 
-				c->syncing = true;
+				this->AddSyncingChannel(c);
 			}
 		}
 	}
@@ -140,15 +144,32 @@ Server::~Server()
 {
 	Log(this, "quit") << "quit from " << (this->uplink ? this->uplink->GetName() : "no uplink") << " for " << this->quit_reason;
 
-	for (user_map::const_iterator it = UserListByNick.begin(); it != UserListByNick.end(); ++it)
-	{
-		User *u = it->second;
+	std::vector<User *> split_users;
+	for (User *u = this->user_list; u; u = u->server_next)
+		split_users.push_back(u);
+
+	/* Keep the users around for a while in case the server is back soon */
+	if (Config->SplitGrace > 0 && !Anope::Quitting && !this->IsULined() && !this->IsJuped())
+		User::Park(split_users, this->quit_reason);
+	else
+		User::Quit(split_users, this->quit_reason);
+
+	while (this->user_list)
+		this->DelUser(this->user_list);
 
-		if (u->server == this)
+	/* Nothing else will sync the channels still waiting for this server's burst */
+	while (this->syncing_channels)
+	{
+		Channel *c = this->syncing_channels;
+		if (Anope::Quitting)
 		{
-			u->Quit(this->quit_reason);
-			u->server = NULL;
+			this->DelSyncingChannel(c);
+			continue;
 		}
+
+		c->Sync();
+		if (c->CheckDelete())
+			delete c;
 	}
 
 	Log(LOG_DEBUG) << "Finished removing all users for " << this->GetName();
@@ -161,7 +182,7 @@ Server::~Server()
 	
 	Servers::ByName.erase(this->name);
 	if (!this->sid.empty())
-		Servers::ByID.erase(this->sid);
+		Servers::ByID.Erase(this->sid);
 }
 
 void Server::Delete(const Anope::string &reason)
@@ -197,7 +218,7 @@ void Server::SetSID(const Anope::string &nsid)
 	if (!this->sid.empty())
 		throw CoreException("Server already has an id?");
 	this->sid = nsid;
-	Servers::ByID[nsid] = this;
+	Servers::ByID.Set(nsid, this);
 }
 
 const Anope::string &Server::GetSID() const
@@ -271,14 +292,14 @@ void Server::Sync(bool sync_links)
 		FOREACH_MOD(OnPreUplinkSync, (this));
 	}
 
-	for (channel_map::const_iterator it = ChannelList.begin(), it_end = ChannelList.end(); it != it_end;)
-	{
-		Channel *c = it->second;
-		++it;
+	/* Channel::Sync() removes the channel from the list */
+	while (this->syncing_channels)
+		this->syncing_channels->Sync();
 
-		if (c->syncing)
-			c->Sync();
-	}
+	/* Channels created by our own clients while linking wait for our uplink */
+	if (me)
+		while (Me->syncing_channels)
+			Me->syncing_channels->Sync();
 
 	if (me)
 	{
@@ -326,6 +347,70 @@ bool Server::IsQuitting() const
 	return quitting;
 }
 
+void Server::AddUser(User *u)
+{
+	if (u->server)
+		u->server->DelUser(u);
+
+	u->server = this;
+	u->server_prev = NULL;
+	u->server_next = this->user_list;
+	if (this->user_list)
+		this->user_list->server_prev = u;
+	this->user_list = u;
+}
+
+void Server::DelUser(User *u)
+{
+	if (u->server != this)
+		return;
+
+	if (u->server_prev)
+		u->server_prev->server_next = u->server_next;
+	else
+		this->user_list = u->server_next;
+	if (u->server_next)
+		u->server_next->server_prev = u->server_prev;
+
+	u->server = NULL;
+	u->server_prev = u->server_next = NULL;
+}
+
+User *Server::GetUsers() const
+{
+	return this->user_list;
+}
+
+void Server::AddSyncingChannel(Channel *c)
+{
+	if (c->sync_server)
+		c->sync_server->DelSyncingChannel(c);
+
+	c->syncing = true;
+	c->sync_server = this;
+	c->sync_prev = NULL;
+	c->sync_next = this->syncing_channels;
+	if (this->syncing_channels)
+		this->syncing_channels->sync_prev = c;
+	this->syncing_channels = c;
+}
+
+void Server::DelSyncingChannel(Channel *c)
+{
+	if (c->sync_server != this)
+		return;
+
+	if (c->sync_prev)
+		c->sync_prev->sync_next = c->sync_next;
+	else
+		this->syncing_channels = c->sync_next;
+	if (c->sync_next)
+		c->sync_next->sync_prev = c->sync_prev;
+
+	c->sync_server = NULL;
+	c->sync_prev = c->sync_next = NULL;
+}
+
 void Server::Notice(BotInfo *source, const Anope::string &message)
 {
 	if (Config->UsePrivmsg && Config->DefPrivmsg)
@@ -336,16 +421,14 @@ void Server::Notice(BotInfo *source, const Anope::string &message)
 
 Server *Server::Find(const Anope::string &name, bool name_only)
 {
-	Anope::map<Server *>::iterator it;
-	
 	if (!name_only)
 	{
-		it = Servers::ByID.find(name);
-		if (it != Servers::ByID.end())
-			return it->second;
+		Server *s = Servers::ByID.Find(name);
+		if (s)
+			return s;
 	}
 	
-	it = Servers::ByName.find(name);
+	Anope::map<Server *>::iterator it = Servers::ByName.find(name);
 	if (it != Servers::ByName.end())
 		return it->second;
 	
@@ -0,0 +1,217 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#include "services.h"
+#include "slab.h"
+
+/* Every chunk starts with a pointer to its slab, padded to keep objects 16 byte aligned */
+static const size_t ChunkHeader = 16;
+
+static size_t Align(size_t size)
+{
+	return (size + 15) & ~static_cast<size_t>(15);
+}
+
+struct SlabPool::Slab
+{
+	/* Links in the pool's list of available slabs */
+	Slab *prev, *next;
+	/* Chunks freed back to this slab */
+	void *free;
+	/* Number of chunks in use */
+	size_t used;
+	/* Number of chunks that have ever been handed out, the rest are untouched */
+	size_t carved;
+
+	char *Data()
+	{
+		return reinterpret_cast<char *>(this) + Align(sizeof(Slab));
+	}
+};
+
+std::list<SlabPool *> *SlabPool::Pools;
+
+SlabPool::SlabPool(const Anope::string &n, size_t size, size_t slab_size) : available(NULL), slabs(0), empty_slabs(0), objects(0), allocations(0), name(n), object_size(size), max_empty(4)
+{
+	this->chunk_size = Align(ChunkHeader + size);
+	this->chunks_per_slab = slab_size > Align(sizeof(Slab)) ? (slab_size - Align(sizeof(Slab))) / this->chunk_size : 0;
+	if (this->chunks_per_slab == 0)
+		this->chunks_per_slab = 1;
+
+	if (Pools == NULL)
+		Pools = new std::list<SlabPool *>();
+	Pools->push_back(this);
+}
+
+SlabPool::~SlabPool()
+{
+	/* Only empty slabs are freed. Slabs still holding objects, including full ones which are
+	 * not on the available list, are leaked, as whatever owns those objects may still use them.
+	 */
+	while (this->available)
+	{
+		Slab *slab = this->available;
+		this->Unlink(slab);
+		if (slab->used == 0)
+			::operator delete(slab);
+	}
+
+	std::list<SlabPool *>::iterator it = std::find(Pools->begin(), Pools->end(), this);
+	if (it != Pools->end())
+		Pools->erase(it);
+}
+
+void SlabPool::Link(Slab *slab, bool front)
+{
+	if (this->available == NULL)
+	{
+		slab->prev = slab->next = slab;
+		this->available = slab;
+		return;
+	}
+
+	/* The list is circular, so the back is just before the front */
+	Slab *head = this->available;
+	slab->next = head;
+	slab->prev = head->prev;
+	head->prev->next = slab;
+	head->prev = slab;
+
+	if (front)
+		this->available = slab;
+}
+
+void SlabPool::Unlink(Slab *slab)
+{
+	if (slab->next == slab)
+		this->available = NULL;
+	else
+	{
+		slab->prev->next = slab->next;
+		slab->next->prev = slab->prev;
+		if (this->available == slab)
+			this->available = slab->next;
+	}
+
+	slab->prev = slab->next = NULL;
+}
+
+void SlabPool::Release(Slab *slab)
+{
+	this->Unlink(slab);
+	--this->slabs;
+	--this->empty_slabs;
+	::operator delete(slab);
+}
+
+void *SlabPool::Allocate()
+{
+	Slab *slab = this->available;
+	if (slab == NULL)
+	{
+		slab = static_cast<Slab *>(::operator new(Align(sizeof(Slab)) + this->chunks_per_slab * this->chunk_size));
+		slab->free = NULL;
+		slab->used = slab->carved = 0;
+		this->Link(slab, true);
+
+		++this->slabs;
+		++this->empty_slabs;
+	}
+
+	char *chunk;
+	if (slab->free)
+	{
+		chunk = static_cast<char *>(slab->free);
+		slab->free = *reinterpret_cast<void **>(chunk);
+	}
+	else
+		chunk = slab->Data() + slab->carved++ * this->chunk_size;
+
+	if (slab->used++ == 0)
+		--this->empty_slabs;
+	if (slab->used == this->chunks_per_slab)
+		this->Unlink(slab);
+
+	*reinterpret_cast<Slab **>(chunk) = slab;
+
+	++this->objects;
+	++this->allocations;
+
+	return chunk + ChunkHeader;
+}
+
+void SlabPool::Deallocate(void *ptr)
+{
+	if (ptr == NULL)
+		return;
+
+	char *chunk = static_cast<char *>(ptr) - ChunkHeader;
+	Slab *slab = *reinterpret_cast<Slab **>(chunk);
+
+	*reinterpret_cast<void **>(chunk) = slab->free;
+	slab->free = chunk;
+
+	/* A full slab is not on the available list, put it at the front so it is filled up again first */
+	if (slab->used-- == this->chunks_per_slab)
+		this->Link(slab, true);
+
+	--this->objects;
+
+	if (slab->used == 0)
+	{
+		++this->empty_slabs;
+
+		if (this->empty_slabs > this->max_empty)
+			this->Release(slab);
+		else
+		{
+			/* Keep empty slabs at the back, so partially used slabs are filled up first */
+			this->Unlink(slab);
+			this->Link(slab, false);
+		}
+	}
+}
+
+void SlabPool::Trim()
+{
+	/* Empty slabs are kept at the back of the list */
+	while (this->available && this->available->prev->used == 0)
+		this->Release(this->available->prev);
+}
+
+size_t SlabPool::GetBytes() const
+{
+	return this->slabs * (Align(sizeof(Slab)) + this->chunks_per_slab * this->chunk_size);
+}
+
+void SlabPool::TrimAll()
+{
+	if (Pools == NULL)
+		return;
+
+	for (std::list<SlabPool *>::iterator it = Pools->begin(), it_end = Pools->end(); it != it_end; ++it)
+		(*it)->Trim();
+}
+
+const std::list<SlabPool *> &SlabPool::GetPools()
+{
+	if (Pools == NULL)
+		Pools = new std::list<SlabPool *>();
+	return *Pools;
+}
+
+SlabPool *SlabPool::ForSize(size_t size)
+{
+	static SlabPool *sized[16];
+
+	unsigned i = size ? (size - 1) / 16 : 0;
+	if (sized[i] == NULL)
+		sized[i] = new SlabPool("nodes/" + stringify((i + 1) * 16), (i + 1) * 16);
+	return sized[i];
+}
@@ -13,13 +13,18 @@
 #include "services.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "memstats.h"
+
+static MemoryCounter BufferedMemory("sockets", "BufferedSocket buffers"), BinaryMemory("sockets", "BinarySocket buffers");
 
 BufferedSocket::BufferedSocket()
 {
+	BufferedMemory.Allocate(0);
 }
 
 BufferedSocket::~BufferedSocket()
 {
+	BufferedMemory.Free(this->read_buffer.length() + this->write_buffer.length());
 }
 
 bool BufferedSocket::ProcessRead()
@@ -35,7 +40,9 @@ bool BufferedSocket::ProcessRead()
 		return SocketEngine::IgnoreErrno();
 	
 	tbuffer[len] = 0;
+	size_t old_len = this->read_buffer.length();
 	this->read_buffer.append(tbuffer);
+	BufferedMemory.Resize(old_len, this->read_buffer.length());
 	this->recv_len = len;
 
 	return true;
@@ -50,6 +57,7 @@ bool BufferedSocket::ProcessWrite()
 		return SocketEngine::IgnoreErrno();
 
 	this->write_buffer = this->write_buffer.substr(count);
+	BufferedMemory.Resize(count, 0);
 	if (this->write_buffer.empty())
 		SocketEngine::Change(this, false, SF_WRITABLE);
 
@@ -62,14 +70,18 @@ const Anope::string BufferedSocket::GetLine()
 	if (s == Anope::string::npos)
 		return "";
 	Anope::string str = this->read_buffer.substr(0, s + 1);
+	size_t old_len = this->read_buffer.length();
 	this->read_buffer.erase(0, s + 1);
 	this->read_buffer.ltrim("\r\n");
+	BufferedMemory.Resize(old_len, this->read_buffer.length());
 	return str.trim("\r\n");
 }
 
 void BufferedSocket::Write(const char *buffer, size_t l)
 {
+	size_t old_len = this->write_buffer.length();
 	this->write_buffer += buffer + Anope::string("\r\n");
+	BufferedMemory.Resize(old_len, this->write_buffer.length());
 	SocketEngine::Change(this, true, SF_WRITABLE);
 }
 
@@ -109,10 +121,12 @@ BinarySocket::DataBlock::DataBlock(const char *b, size_t l)
 	this->orig = this->buf = new char[l];
 	memcpy(this->buf, b, l);
 	this->len = l;
+	BinaryMemory.Allocate(sizeof(DataBlock) + l);
 }
 
 BinarySocket::DataBlock::~DataBlock()
 {
+	BinaryMemory.Free(sizeof(DataBlock) + (this->buf - this->orig) + this->len);
 	delete [] this->orig;
 }
 
@@ -122,6 +136,8 @@ BinarySocket::BinarySocket()
 
 BinarySocket::~BinarySocket()
 {
+	for (unsigned i = 0; i < this->write_buffer.size(); ++i)
+		delete this->write_buffer[i];
 }
 
 bool BinarySocket::ProcessRead()
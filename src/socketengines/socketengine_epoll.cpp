@@ -13,6 +13,7 @@
 #include "anope.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "watchdog.h"
 #include "config.h"
 
 #include <sys/epoll.h>
@@ -77,6 +78,7 @@ void SocketEngine::Process()
 
 	int total = epoll_wait(EngineHandle, &events.front(), events.size(), Config->ReadTimeout * 1000);
 	Anope::CurTime = time(NULL);
+	Watchdog::Busy();
 
 	/* EINTR can be given if the read timeout expires */
 	if (total == -1)
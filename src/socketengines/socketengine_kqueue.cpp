@@ -13,6 +13,7 @@
 #include "anope.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "watchdog.h"
 #include "logger.h"
 #include "config.h"
 
@@ -78,6 +79,7 @@ void SocketEngine::Process()
 	int total = kevent(kq_fd, &change_events.front(), change_count, &event_events.front(), event_events.size(), &kq_timespec);
 	change_count = 0;
 	Anope::CurTime = time(NULL);
+	Watchdog::Busy();
 
 	/* EINTR can be given if the read timeout expires */
 	if (total == -1)
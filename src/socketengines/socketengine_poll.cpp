@@ -13,6 +13,7 @@
 #include "anope.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "watchdog.h"
 #include "config.h"
 
 #include <errno.h>
@@ -101,6 +102,7 @@ void SocketEngine::Process()
 {
 	int total = poll(&events.front(), events.size(), Config->ReadTimeout * 1000);
 	Anope::CurTime = time(NULL);
+	Watchdog::Busy();
 
 	/* EINTR can be given if the read timeout expires */
 	if (total < 0)
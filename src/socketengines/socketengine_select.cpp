@@ -13,6 +13,7 @@
 #include "anope.h"
 #include "sockets.h"
 #include "socketengine.h"
+#include "watchdog.h"
 #include "logger.h"
 #include "config.h"
 
@@ -104,6 +105,7 @@ void SocketEngine::Process()
 
 	int sresult = select(MaxFD + 1, &rfdset, &wfdset, &efdset, &tval);
 	Anope::CurTime = time(NULL);
+	Watchdog::Busy();
 
 	if (sresult == -1)
 	{
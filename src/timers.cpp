@@ -9,6 +9,8 @@
 
 #include "services.h"
 #include "timers.h"
+#include "modules.h"
+#include "watchdog.h"
 
 std::multimap<time_t, Timer *> TimerManager::Timers;
 
@@ -107,7 +109,10 @@ void TimerManager::TickTimers(time_t ctime)
 		if (t->GetTimer() > ctime)
 			break;
 
-		t->Tick(ctime);
+		{
+			Watchdog::Scope scope("timer", t->GetOwner() ? t->GetOwner()->name.c_str() : "core");
+			t->Tick(ctime);
+		}
 
 		if (t->GetRepeat())
 			t->SetTimer(ctime + t->GetSecs());
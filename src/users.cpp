@@ -24,8 +24,15 @@
 #include "language.h"
 #include "sockets.h"
 #include "uplink.h"
+#include "memstats.h"
 
-user_map UserListByNick, UserListByUID;
+user_map UserListByNick;
+IDMap<User *> UserListByUID;
+
+static MemoryCounter UserMemory("core", "User");
+static SlabPool UserPool("User", sizeof(User));
+/* Users are in both UserListByNick and UserListByUID */
+static const size_t UserSize = sizeof(User) + 2 * MemoryCounter::HashNode(sizeof(std::pair<Anope::string, User *>));
 
 int OperCount = 0;
 unsigned MaxUserCount = 0;
@@ -33,14 +40,68 @@ time_t MaxUserTime = 0;
 
 std::list<User *> User::quitting_users;
 
+/* A user parked by options:splitgrace */
+struct ParkedUser
+{
+	User *user;
+	/* When the user is quit if they have not come back */
+	time_t expires;
+	/* The reason they are quit with */
+	Anope::string reason;
+	/* The account they were identified to, they are taken off of it while parked */
+	Serialize::Reference<NickCore> account;
+};
+
+/* Parked users, by UID or nick if the IRCd has no UIDs */
+static Anope::map<ParkedUser> ParkedUsers;
+
+/** Quits the users parked by one netsplit who have not come back
+ */
+class SplitGraceTimer : public Timer
+{
+	Anope::string reason;
+
+ public:
+	std::vector<Anope::string> ids;
+
+	SplitGraceTimer(time_t grace, const Anope::string &r) : Timer(grace), reason(r) { }
+
+	void Tick(time_t now) anope_override
+	{
+		std::vector<User *> expired;
+		for (unsigned i = 0; i < ids.size(); ++i)
+		{
+			Anope::map<ParkedUser>::iterator it = ParkedUsers.find(ids[i]);
+			/* Users who came back and split again are on a later timer */
+			if (it == ParkedUsers.end() || it->second.expires > now)
+				continue;
+
+			it->second.user->Unpark(it->second.account);
+			expired.push_back(it->second.user);
+			ParkedUsers.erase(it);
+		}
+
+		if (!expired.empty())
+		{
+			Log(LOG_DEBUG) << expired.size() << " users did not come back from a netsplit in time";
+			User::Quit(expired, reason);
+			/* Nothing else deletes them until the uplink next sends us something */
+			User::QuitUsers();
+		}
+	}
+};
+
 User::User(const Anope::string &snick, const Anope::string &sident, const Anope::string &shost, const Anope::string &svhost, const Anope::string &sip, Server *sserver, const Anope::string &srealname, time_t ts, const Anope::string &smodes, const Anope::string &suid, NickCore *account)
 {
 	if (snick.empty() || sident.empty() || shost.empty())
 		throw CoreException("Bad args passed to User::User");
 
+	UserMemory.Allocate(UserSize);
+
 	/* we used to do this by calloc, no more. */
 	quit = false;
 	server = NULL;
+	server_prev = server_next = NULL;
 	invalid_pw_count = invalid_pw_time = lastmemosend = lastnickreg = lastmail = 0;
 	on_access = false;
 
@@ -50,7 +111,8 @@ User::User(const Anope::string &snick, const Anope::string &sident, const Anope:
 	this->vhost = svhost;
 	this->chost = svhost;
 	this->ip = sip;
-	this->server = sserver;
+	if (sserver)
+		sserver->AddUser(this);
 	this->realname = srealname;
 	this->timestamp = this->signon = ts;
 	this->SetModesInternal(sserver, "%s", smodes.c_str());
@@ -61,7 +123,7 @@ User::User(const Anope::string &snick, const Anope::string &sident, const Anope:
 	size_t old = UserListByNick.size();
 	UserListByNick[snick] = this;
 	if (!suid.empty())
-		UserListByUID[suid] = this;
+		UserListByUID.Set(suid, this);
 	if (old == UserListByNick.size())
 		Log(LOG_DEBUG) << "Duplicate user " << snick << " in user table?";
 
@@ -135,6 +197,27 @@ User* User::OnIntroduce(const Anope::string &snick, const Anope::string &sident,
 		}
 	}
 
+	if (!ParkedUsers.empty())
+	{
+		Anope::map<ParkedUser>::iterator it = ParkedUsers.find(!suid.empty() ? suid : snick);
+		if (it != ParkedUsers.end())
+		{
+			u = it->second.user;
+			Anope::string reason = it->second.reason;
+			u->Unpark(it->second.account);
+			ParkedUsers.erase(it);
+
+			if (u->timestamp == ts && u->nick.equals_ci(snick))
+			{
+				u->Revive(snick, sident, shost, svhost, sip, sserver, srealname, smodes, nc);
+				return u;
+			}
+
+			/* Someone else, the user who split is not coming back */
+			User::Quit(std::vector<User *>(1, u), reason);
+		}
+	}
+
 	return new User(snick, sident, shost, svhost, sip, sserver, srealname, ts, smodes, suid, nc);
 }
 
@@ -162,14 +245,15 @@ void User::ChangeNick(const Anope::string &newnick, time_t ts)
 
 		this->nick = newnick;
 
-		User* &other = UserListByNick[this->nick];
+		/* Killing our own clients can reintroduce them, which may grow the map, so don't keep a reference into it */
+		User *other = User::Find(this->nick, true);
 		if (other)
 		{
 			CollideKill(this, "Nick collision");
 			CollideKill(other, "Nick collision");
 			return;
 		}
-		other = this;
+		UserListByNick[this->nick] = this;
 
 		on_access = false;
 		NickAlias *na = NickAlias::Find(this->nick);
@@ -297,6 +381,7 @@ User::~User()
 		if (this->server->IsSynced())
 			Log(this, "disconnect") << "(" << this->realname << ") disconnected from the network (" << this->server->GetName() << ")";
 		--this->server->users;
+		this->server->DelUser(this);
 	}
 
 	FOREACH_MOD(OnPreUserLogoff, (this));
@@ -310,11 +395,31 @@ User::~User()
 	while (!this->chans.empty())
 		this->chans.begin()->second->chan->DeleteUser(this);
 
-	UserListByNick.erase(this->nick);
-	if (!this->uid.empty())
-		UserListByUID.erase(this->uid);
+	/* Someone else may have taken our nick while we were parked */
+	user_map::iterator it = UserListByNick.find(this->nick);
+	if (it != UserListByNick.end() && it->second == this)
+		UserListByNick.erase(it);
+	if (!this->uid.empty() && UserListByUID.Find(this->uid) == this)
+		UserListByUID.Erase(this->uid);
 
 	FOREACH_MOD(OnPostUserLogoff, (this));
+
+	UserMemory.Free(UserSize);
+}
+
+void *User::operator new(size_t size)
+{
+	if (size == sizeof(User))
+		return UserPool.Allocate();
+	return ::operator new(size);
+}
+
+void User::operator delete(void *ptr, size_t size)
+{
+	if (size == sizeof(User))
+		UserPool.Deallocate(ptr);
+	else
+		::operator delete(ptr);
 }
 
 void User::SendMessage(BotInfo *source, const char *fmt, ...)
@@ -760,6 +865,186 @@ void User::Quit(const Anope::string &reason)
 	quitting_users.push_back(this);
 }
 
+void User::Quit(const std::vector<User *> &users, const Anope::string &reason)
+{
+	std::vector<User *> quitting;
+	quitting.reserve(users.size());
+	for (unsigned i = 0; i < users.size(); ++i)
+		if (!users[i]->quit)
+			quitting.push_back(users[i]);
+
+	if (quitting.empty())
+		return;
+
+	/* This is FOREACH_MOD(OnUserQuit) turned inside out, so each module handles
+	 * all of the users at once and is only dropped from the event once if it
+	 * does not implement it.
+	 */
+	std::vector<Module *> &modules = ModuleManager::EventHandlers[I_OnUserQuit];
+	if (!modules.empty())
+	{
+		ModuleManager::EventTimer timer(I_OnUserQuit, "OnUserQuit");
+		Watchdog::Scope scope("event", "OnUserQuit");
+		for (std::vector<Module *>::iterator it = modules.begin(); it != modules.end();)
+		{
+			Module *m = *it;
+			scope.SetModule(m->name.c_str());
+
+			try
+			{
+				for (unsigned i = 0; i < quitting.size(); ++i)
+				{
+					try
+					{
+						m->OnUserQuit(quitting[i], reason);
+					}
+					catch (const ModuleException &modexcept)
+					{
+						Log() << "Exception caught: " << modexcept.GetReason();
+					}
+				}
+			}
+			catch (const NotImplementedException &)
+			{
+				it = modules.erase(it);
+				continue;
+			}
+			++it;
+		}
+	}
+
+	for (unsigned i = 0; i < quitting.size(); ++i)
+	{
+		quitting[i]->quit = true;
+		quitting_users.push_back(quitting[i]);
+	}
+}
+
+void User::Park(const std::vector<User *> &users, const Anope::string &reason)
+{
+	SplitGraceTimer *timer = new SplitGraceTimer(Config->SplitGrace, reason);
+	std::vector<User *> replaced;
+
+	for (unsigned i = 0; i < users.size(); ++i)
+	{
+		User *u = users[i];
+		if (u->quit)
+			continue;
+
+		ModeManager::StackerDel(u);
+		/* Clear the server first so leaving the channels is not logged */
+		if (u->server)
+			u->server->DelUser(u);
+		while (!u->chans.empty())
+			u->chans.begin()->second->chan->DeleteUser(u);
+
+		user_map::iterator it = UserListByNick.find(u->nick);
+		if (it != UserListByNick.end() && it->second == u)
+			UserListByNick.erase(it);
+		if (!u->uid.empty() && UserListByUID.Find(u->uid) == u)
+			UserListByUID.Erase(u->uid);
+
+		ParkedUser &pu = ParkedUsers[u->GetUID()];
+		if (pu.user && pu.user != u)
+		{
+			pu.user->Unpark(pu.account);
+			replaced.push_back(pu.user);
+		}
+		pu.user = u;
+		pu.expires = Anope::CurTime + Config->SplitGrace;
+		pu.reason = reason;
+		timer->ids.push_back(u->GetUID());
+
+		/* Parked users are not online, so they do not count as opers or towards their account */
+		if (u->HasMode("OPER"))
+			--OperCount;
+		pu.account = u->nc;
+		if (u->nc)
+		{
+			std::list<User *>::iterator nit = std::find(u->nc->users.begin(), u->nc->users.end(), u);
+			if (nit != u->nc->users.end())
+				u->nc->users.erase(nit);
+			u->nc = NULL;
+		}
+
+		FOREACH_MOD(OnUserPark, (u));
+	}
+
+	Log(LOG_DEBUG) << "Parked " << timer->ids.size() << " users for " << Config->SplitGrace << " seconds";
+
+	if (!replaced.empty())
+		User::Quit(replaced, reason);
+}
+
+void User::Revive(const Anope::string &snick, const Anope::string &sident, const Anope::string &shost, const Anope::string &svhost, const Anope::string &sip, Server *sserver, const Anope::string &srealname, const Anope::string &smodes, NickCore *account)
+{
+	this->nick = snick;
+	UserListByNick[snick] = this;
+	if (!this->uid.empty())
+		UserListByUID.Set(this->uid, this);
+	sserver->AddUser(this);
+	if (sserver->IsSynced())
+		++sserver->users;
+
+	bool host_changed = this->ident != sident || this->host != shost || this->vhost != svhost;
+	this->ident = sident;
+	this->host = shost;
+	if (this->vhost != svhost)
+		this->vhost = this->chost = svhost;
+	this->ip = sip;
+	this->realname = srealname;
+
+	/* Only tell modules about the modes which changed while the user was gone */
+	ModeList newmodes;
+	spacesepstream sep(smodes);
+	Anope::string modebuf, param;
+	sep.GetToken(modebuf);
+	for (unsigned i = 0; i < modebuf.length(); ++i)
+	{
+		UserMode *um = ModeManager::FindUserModeByChar(modebuf[i]);
+		if (!um)
+			continue;
+
+		param.clear();
+		if (um->type == MODE_PARAM)
+			sep.GetToken(param);
+		newmodes[um->name] = param;
+	}
+
+	std::vector<Anope::string> removed;
+	for (ModeList::iterator it = this->modes.begin(), it_end = this->modes.end(); it != it_end; ++it)
+		if (!newmodes.count(it->first))
+			removed.push_back(it->first);
+	for (unsigned i = 0; i < removed.size(); ++i)
+		this->RemoveModeInternal(sserver, ModeManager::FindUserModeByName(removed[i]));
+
+	for (ModeList::iterator it = newmodes.begin(), it_end = newmodes.end(); it != it_end; ++it)
+	{
+		ModeList::iterator mit = this->modes.find(it->first);
+		if (mit == this->modes.end() || mit->second != it->second)
+			this->SetModeInternal(sserver, ModeManager::FindUserModeByName(it->first), it->second);
+	}
+
+	this->Login(account);
+	if (host_changed)
+		this->UpdateHost();
+
+	Log(LOG_DEBUG) << this->nick << " came back from a netsplit on " << sserver->GetName();
+
+	FOREACH_MOD(OnUserRevive, (this));
+}
+
+void User::Unpark(NickCore *account)
+{
+	if (this->HasMode("OPER"))
+		++OperCount;
+	if (account)
+	{
+		this->nc = account;
+		account->users.push_back(this);
+	}
+}
+
 bool User::Quitting() const
 {
 	return this->quit;
@@ -815,11 +1100,7 @@ bool User::BadPassword()
 User* User::Find(const Anope::string &name, bool nick_only)
 {
 	if (!nick_only && isdigit(name[0]) && IRCD->RequiresID)
-	{
-		user_map::iterator it = UserListByUID.find(name);
-		if (it != UserListByUID.end())
-			return it->second;
-	}
+		return UserListByUID.Find(name);
 	else
 	{
 		user_map::iterator it = UserListByNick.find(name);
@@ -832,8 +1113,22 @@ User* User::Find(const Anope::string &name, bool nick_only)
 
 void User::QuitUsers()
 {
+	if (quitting_users.empty())
+		return;
+
+	/* Users whose server split have had their server cleared by ~Server */
+	bool split = false;
 	for (std::list<User *>::iterator it = quitting_users.begin(), it_end = quitting_users.end(); it != it_end; ++it)
-		delete *it;
+	{
+		User *u = *it;
+		if (u->server == NULL)
+			split = true;
+		delete u;
+	}
 	quitting_users.clear();
+
+	/* Give the memory used by the split users back in one go */
+	if (split)
+		SlabPool::TrimAll();
 }
 
@@ -0,0 +1,311 @@
+/*
+ *
+ * (C) 2003-2014 Anope Team
+ * Contact us at team@anope.org
+ *
+ * Please read COPYING and README for further details.
+ *
+ */
+
+#include "services.h"
+#include "watchdog.h"
+#include "anope.h"
+#include "config.h"
+#include "logger.h"
+#include "threadengine.h"
+
+#ifndef _WIN32
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_BACKTRACE
+#include <execinfo.h>
+#include <pthread.h>
+#endif
+
+Watchdog::Frame Watchdog::Frames[Watchdog::MaxDepth];
+volatile unsigned Watchdog::Depth = 0;
+bool Watchdog::Enabled = false;
+
+static double Elapsed(const timeval &from, const timeval &to)
+{
+	return (to.tv_sec - from.tv_sec) + (to.tv_usec - from.tv_usec) / 1000000.0;
+}
+
+#ifdef HAVE_BACKTRACE
+static const int MaxBacktrace = 64;
+static pthread_t main_thread;
+static void *backtrace_frames[MaxBacktrace];
+static volatile sig_atomic_t backtrace_size = 0;
+
+/* Runs on the main thread when the watchdog asks for a backtrace */
+static void BacktraceHandler(int)
+{
+	backtrace_size = backtrace(backtrace_frames, MaxBacktrace);
+}
+#endif
+
+/** Describes what the main loop is executing, innermost scope first
+ */
+static Anope::string Describe()
+{
+	unsigned depth = Watchdog::Depth;
+	if (depth > Watchdog::MaxDepth)
+		depth = Watchdog::MaxDepth;
+
+	Anope::string what;
+	for (unsigned i = depth; i > 0; --i)
+	{
+		/* The main thread may be writing the frame, so work from a copy which is always terminated */
+		Watchdog::Frame f;
+		memcpy(&f, &Watchdog::Frames[i - 1], sizeof(f));
+		f.kind[Watchdog::MaxName - 1] = f.name[Watchdog::MaxName - 1] = f.module[Watchdog::MaxName - 1] = 0;
+
+		if (!what.empty())
+			what += " <- ";
+		what += Anope::string(*f.kind ? f.kind : "?") + " " + (*f.name ? f.name : "?");
+		if (*f.module)
+			what += Anope::string(" (") + f.module + ")";
+	}
+
+	return what.empty() ? "the main loop" : what;
+}
+
+class WatchdogThread : public Thread
+{
+	void Check()
+	{
+		timeval now;
+		gettimeofday(&now, NULL);
+
+		this->lock.Lock();
+		bool stalled = this->busy && this->threshold && this->stalled_generation != this->generation && Elapsed(this->busy_since, now) * 1000 >= this->threshold;
+		unsigned long gen = this->generation;
+#ifdef HAVE_BACKTRACE
+		bool bt = this->want_backtrace;
+#endif
+		this->lock.Unlock();
+
+		if (!stalled)
+			return;
+
+		/* The main thread may leave the stalled scope while this runs, in which
+		 * case the snapshot is thrown away below as the generation has changed.
+		 */
+		Anope::string what = Describe();
+
+#ifdef HAVE_BACKTRACE
+		if (bt)
+			pthread_kill(main_thread, SIGUSR1);
+#endif
+
+		this->lock.Lock();
+		if (this->generation == gen)
+		{
+			this->stalled_generation = gen;
+			this->snapshot = what;
+		}
+		this->lock.Unlock();
+	}
+
+ public:
+	/* Protects everything below, which is shared with the main thread. Signalled
+	 * when the watchdog is enabled or the thread should exit.
+	 */
+	Condition lock;
+	/* Whether the main loop is currently busy, and since when */
+	bool busy;
+	timeval busy_since;
+	/* Incremented every time the main loop becomes busy */
+	unsigned long generation;
+	/* options:stallthreshold, in milliseconds */
+	unsigned threshold;
+	/* options:stallbacktrace */
+	bool want_backtrace;
+	/* The generation a snapshot was last taken in, and the snapshot */
+	unsigned long stalled_generation;
+	Anope::string snapshot;
+
+	WatchdogThread() : busy(false), generation(0), threshold(0), want_backtrace(false), stalled_generation(0)
+	{
+	}
+
+	void Run() anope_override
+	{
+		while (!this->GetExitState())
+		{
+			this->lock.Lock();
+			/* Sleep until the watchdog is enabled again rather than polling */
+			while (!this->threshold && !this->GetExitState())
+				this->lock.Wait();
+			unsigned interval = this->threshold / 4;
+			this->lock.Unlock();
+
+			if (this->GetExitState())
+				break;
+
+			if (interval < 10)
+				interval = 10;
+			else if (interval > 1000)
+				interval = 1000;
+
+#ifdef _WIN32
+			Sleep(interval);
+#else
+			usleep(interval * 1000);
+#endif
+
+			this->Check();
+		}
+	}
+};
+
+static WatchdogThread *watchdog = NULL;
+static bool busy = false, failed = false;
+static timeval busy_since;
+static double lag = 0, stall_time = 0, longest_stall = 0;
+static uint64_t stall_count = 0;
+
+static void StartThread()
+{
+	watchdog = new WatchdogThread();
+
+#ifdef HAVE_BACKTRACE
+	main_thread = pthread_self();
+
+	/* The first call to backtrace() may load libgcc and allocate, which is not
+	 * safe from a signal handler, so get that done now.
+	 */
+	backtrace(backtrace_frames, MaxBacktrace);
+
+	struct sigaction sa;
+	sa.sa_handler = BacktraceHandler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR1, &sa, NULL);
+#endif
+
+	try
+	{
+		watchdog->Start();
+	}
+	catch (const CoreException &ex)
+	{
+		Log() << "Unable to start watchdog thread: " << ex.GetReason();
+		delete watchdog;
+		watchdog = NULL;
+		failed = true;
+	}
+}
+
+void Watchdog::Busy()
+{
+	gettimeofday(&busy_since, NULL);
+	busy = true;
+
+#ifdef HAVE_BACKTRACE
+	backtrace_size = 0;
+#endif
+
+	Enabled = Config && Config->StallThreshold;
+
+	if (!watchdog && !failed && Config && Config->StallThreshold)
+		StartThread();
+
+	if (watchdog)
+	{
+		watchdog->lock.Lock();
+		watchdog->busy = true;
+		watchdog->busy_since = busy_since;
+		++watchdog->generation;
+		if (!watchdog->threshold && Config->StallThreshold)
+			watchdog->lock.Wakeup();
+		watchdog->threshold = Config->StallThreshold;
+		watchdog->want_backtrace = Config->StallBacktrace;
+		watchdog->lock.Unlock();
+	}
+}
+
+void Watchdog::Idle()
+{
+	if (!busy)
+		return;
+	busy = false;
+
+	timeval now;
+	gettimeofday(&now, NULL);
+	lag = Elapsed(busy_since, now);
+
+	Anope::string what;
+	if (watchdog)
+	{
+		watchdog->lock.Lock();
+		watchdog->busy = false;
+		if (watchdog->stalled_generation == watchdog->generation)
+			what = watchdog->snapshot;
+		watchdog->lock.Unlock();
+	}
+
+	if (!Config->StallThreshold || lag * 1000 < Config->StallThreshold)
+		return;
+
+	++stall_count;
+	stall_time += lag;
+	if (lag > longest_stall)
+		longest_stall = lag;
+
+	Log(LOG_NORMAL, "watchdog") << "Main loop stalled for " << static_cast<unsigned long>(lag * 1000) << "ms" << (!what.empty() ? " in " + what : "");
+
+#ifdef HAVE_BACKTRACE
+	if (backtrace_size > 0)
+	{
+		char **symbols = backtrace_symbols(backtrace_frames, backtrace_size);
+		if (symbols)
+		{
+			for (int i = 0; i < backtrace_size; ++i)
+				Log(LOG_NORMAL, "watchdog") << "  #" << i << " " << symbols[i];
+			free(symbols);
+		}
+		backtrace_size = 0;
+	}
+#endif
+}
+
+void Watchdog::Shutdown()
+{
+	if (!watchdog)
+		return;
+
+	watchdog->lock.Lock();
+	watchdog->SetExitState();
+	watchdog->lock.Wakeup();
+	watchdog->lock.Unlock();
+	watchdog->Join();
+	delete watchdog;
+	watchdog = NULL;
+
+#ifdef HAVE_BACKTRACE
+	signal(SIGUSR1, SIG_DFL);
+#endif
+}
+
+double Watchdog::GetLag()
+{
+	return lag;
+}
+
+uint64_t Watchdog::GetStallCount()
+{
+	return stall_count;
+}
+
+double Watchdog::GetStallTime()
+{
+	return stall_time;
+}
+
+double Watchdog::GetLongestStall()
+{
+	return longest_stall;
+}